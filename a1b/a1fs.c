@@ -21,6 +21,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// renameat2() flags, for C libraries that don't define them
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
 
 // Using 2.9.x FUSE API
 #define FUSE_USE_VERSION 29
@@ -30,7 +40,18 @@
 #include "a1fs_helper.h"
 #include "fs_ctx.h"
 #include "options.h"
+#include "backend.h"
+#include "csum.h"
+#include "discard.h"
+#include "freecache.h"
+#include "group.h"
+#include "journal.h"
 #include "map.h"
+#include "readahead.h"
+#include "reclaim.h"
+#include "sbcount.h"
+#include "sync.h"
+#include "zero.h"
 #include "util.h"
 
 //NOTE: All path arguments are absolute paths within the a1fs file system and
@@ -61,11 +82,45 @@ static bool a1fs_init(fs_ctx *fs, a1fs_opts *opts)
 	// Nothing to initialize if only printing help
 	if (opts->help) return true;
 
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
 	size_t size;
-	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size);
+	int fd;
+	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size, &fd);
 	if (!image) return false;
 
-	return fs_ctx_init(fs, image, size);
+	fs->opts = opts;
+	if (!fs_ctx_init(fs, image, size, fd)) return false;
+	if (!journal_open(fs)) return false;
+	if (!csum_open(fs)) return false;
+	if (!journal_commit_mount(fs)) return false;
+	if (!freecache_open(fs)) return false;
+	if (!group_open(fs)) return false;
+
+	// On a block device the page cache of the device would only duplicate
+	// what the application caches, so file data bypasses it by default
+	const char *backend = opts->backend;
+	struct stat st;
+	if ((backend == NULL) && (fstat(fd, &st) == 0) && S_ISBLK(st.st_mode)) {
+		backend = "direct";
+	}
+	fs->backend = backend_find(backend);
+	if (fs->backend == NULL) {
+		fprintf(stderr, "Unknown backend: %s\n", backend);
+		return false;
+	}
+	if (!fs->backend->init(fs)) return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+	if (fs->fsc_loaded) {
+		fprintf(stderr, "a1fs: mounted in %.1f ms (free-space cache loaded)\n", ms);
+	} else {
+		fprintf(stderr, "a1fs: mounted in %.1f ms (free-space cache rebuilt by %d threads)\n",
+		        ms, fs->fsc_threads);
+	}
+	return true;
 }
 
 /**
@@ -78,7 +133,23 @@ static void a1fs_destroy(void *ctx)
 {
 	fs_ctx *fs = (fs_ctx*)ctx;
 	if (fs->image) {
+		journal_stop(fs);
+		zero_stop(fs);
+		reclaim_stop(fs);
+		discard_stop(fs);
+		if (fs->backend != NULL) {
+			fs->backend->destroy(fs);
+		}
+		// Goes into the final commit, or the msync() below
+		sbc_fold(fs);
+		group_close(fs);
+		freecache_close(fs);
+		csum_close(fs);
+		journal_close(fs);
+		// Whatever was not synced yet reaches the image before unmount
+		msync(fs->image, fs->size, MS_SYNC);
 		munmap(fs->image, fs->size);
+		close(fs->fd);
 		fs_ctx_destroy(fs);
 	}
 }
@@ -89,6 +160,60 @@ static fs_ctx *get_fs(void)
 	return (fs_ctx*)fuse_get_context()->private_data;
 }
 
+/**
+ * Finish setting up the file system once FUSE is running.
+ *
+ * Called by FUSE once the kernel connection is up. Asks for splicing, starts
+ * the background threads and locks the metadata in memory, none of which
+ * survive the fork FUSE does to run in the background after a1fs_init().
+ * Mapping the image is done in a1fs_init().
+ *
+ * @param conn  connection info; capable lists what the kernel supports, want
+ *              receives what a1fs requests.
+ * @return      the file system context, which becomes the FUSE private data.
+ */
+static void *a1fs_fuse_init(struct fuse_conn_info *conn)
+{
+	fs_ctx *fs = get_fs();
+
+	// FUSE only splices if asked to: the image file pieces that read_buf()
+	// returns into the kernel, and write requests into a pipe that
+	// write_buf() then splices into the image. Otherwise both are copied
+	// through a user space buffer
+	conn->want |= conn->capable &
+	              (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE | FUSE_CAP_SPLICE_READ);
+
+	// Keep the metadata resident so that lookups and allocations never fault
+	if (fs->opts->mlock_metadata) {
+		if (fs_ctx_pin_metadata(fs)) {
+			fprintf(stderr, "a1fs: locked %zu KiB of metadata, %zu of %zu pages faulted in up front\n",
+			        fs->meta_size / 1024, fs->meta_prefaulted, fs->meta_pages);
+		} else {
+			perror("a1fs: mlock_metadata");
+		}
+	}
+
+	// Blocks of large files are freed by the worker; without it they are freed
+	// inline
+	if (!reclaim_start(fs)) {
+		fprintf(stderr, "a1fs: background reclamation is disabled\n");
+	}
+	// Extending writes skip zeroing blocks the zeroer got to first
+	if (!zero_start(fs)) {
+		fprintf(stderr, "a1fs: background zeroing is disabled\n");
+	}
+	if (!discard_start(fs)) {
+		fprintf(stderr, "a1fs: online discard is disabled\n");
+	}
+	// Without periodic commits, changes only reach the image on fsync() and
+	// at unmount
+	if (!journal_start(fs)) {
+		fprintf(stderr, "a1fs: periodic journal commits are disabled\n");
+	}
+
+	return fs;
+}
+
 
 /**
  * Get file system statistics.
@@ -99,6 +224,10 @@ static fs_ctx *get_fs(void)
  * The following fields can be ignored: f_fsid, f_flag.
  * All remaining fields are required.
  *
+ * The counters are folded into the superblock first; changes made by
+ * callbacks running at the same time may be missed. f_bavail leaves out the
+ * blocks reserved for directories (mkfs -m).
+ *
  * Errors: none
  *
  * @param path  path to any file in the file system. Can be ignored.
@@ -123,8 +252,14 @@ static int a1fs_statfs(const char *path, struct statvfs *st)
 	st->f_bsize   = A1FS_BLOCK_SIZE;					/* Filesystem block size */
 	st->f_frsize  = A1FS_BLOCK_SIZE;					/* Fragment size */
 	st->f_blocks = fs->sb->size/ A1FS_BLOCK_SIZE;		/* Size of fs in f_frsize units */
+	sbc_fold(fs);
 	st->f_bfree = fs->sb->sb_free_blocks_count;			/* Number of free blocks */
-	st->f_bavail = fs->sb->sb_free_blocks_count;		/* Number of free blocks for unprivileged users */
+	st->f_bavail = fs->sb->sb_free_blocks_count;		/* Number of free blocks for file data */
+	if (st->f_bavail > fs->sb->sb_reserved_blocks) {
+		st->f_bavail -= fs->sb->sb_reserved_blocks;
+	} else {
+		st->f_bavail = 0;
+	}
 	st->f_files = fs->sb->sb_inodes_count;				/* Number of inodes */
 	st->f_ffree = fs->sb->sb_free_inodes_count;			/* Number of free inodes */
 	st->f_favail = fs->sb->sb_free_inodes_count;		/* Number of free inodes for unprivileged users */
@@ -179,16 +314,20 @@ static int a1fs_getattr(const char *path, struct stat *st)
 	// Get the inode number of the given path
 	int curr_inode = get_inode_num(fs, path, 0);
 	if (curr_inode < 0) {
-		return -ENOENT;
+		return (curr_inode == -EIO) ? -EIO : -ENOENT;
 	}
 
+	// Take a consistent copy of the inode without blocking writers
+	a1fs_inode inode;
+	inode_snapshot(fs, curr_inode, &inode);
+
 	// Fill in the required fields based on inode information
-	st->st_mode = fs->itable[curr_inode].mode;			/* File type and mode */
-	st->st_nlink = fs->itable[curr_inode].links;		/* Number of hard links */
-	st->st_size = fs->itable[curr_inode].size;			/* Total size, in bytes */
-	st->st_blocks = fs->itable[curr_inode].size/512 
-		+ sizeof(fs->itable[curr_inode]);				/* Number of 512B blocks allocated */
-	st->st_mtim = fs->itable[curr_inode].i_mtime;		/* Time of last modification */
+	st->st_mode = inode.mode;							/* File type and mode */
+	st->st_nlink = inode.links;							/* Number of hard links */
+	st->st_size = inode.size;							/* Total size, in bytes */
+	st->st_blocks = inode.size/512 
+		+ sizeof(inode);								/* Number of 512B blocks allocated */
+	st->st_mtim = inode.i_mtime;						/* Time of last modification */
 
 	return 0;
 }
@@ -233,7 +372,7 @@ static int a1fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	// Get the inode number of the given path
 	int curr_inode = get_inode_num(fs, path, 0);
 	if (curr_inode < 0) {
-		return -errno;
+		return (curr_inode == -EIO) ? -EIO : -ENOENT;
 	}
 
 
@@ -290,29 +429,10 @@ static int a1fs_mkdir(const char *path, mode_t mode)
 	mode = mode | S_IFDIR;
 	fs_ctx *fs = get_fs();
 
-	// The new directory's inode index
-	int newdir_inode_index;
-
-	// Find first available inode bit in inode bitmap
-	newdir_inode_index = get_available_bit(fs->sb, fs->inode_bits, 0, -1);
-	if (newdir_inode_index == -1) {
-		fprintf(stderr, "a1fs_mkdir: could not find empty inode for new directory\n");
-		return -ENOSPC;
-	}
-
-	// Set corresponding inode bit in inode bitmap
-	if (set_bits(fs->sb, fs->inode_bits, newdir_inode_index, 0, -1, 1) < 0) {
-		fprintf(stderr, "a1fs_mkdir: could not set inode bit for new directory\n");
-		return -errno;
-	}
-
-	// Create corresponding inode in inode table
-	create_inode(fs->itable, newdir_inode_index, mode);
-
 	// Get name of the new directory
 	char *new_dir_name = strrchr(path, '/') + 1;
 
-	// Get the parent's inode number
+	// Get the parent's inode number, which decides where the new one goes
 	int par_inode;
 	if (new_dir_name == NULL) {
 		par_inode = 0;
@@ -326,11 +446,40 @@ static int a1fs_mkdir(const char *path, mode_t mode)
 		}
 	}
 
+	// The new directory's inode index
+	int newdir_inode_index;
+
+	// Allocate an inode in the group picked for the new directory
+	newdir_inode_index = group_alloc_inode(fs, par_inode, true);
+	if (newdir_inode_index == -1) {
+		fprintf(stderr, "a1fs_mkdir: could not find empty inode for new directory\n");
+		return -ENOSPC;
+	}
+	csum_inode_new(fs, newdir_inode_index);
+	itable_init(fs, newdir_inode_index);
+
+	// Create corresponding inode in inode table
+	inode_write_begin(fs, newdir_inode_index);
+	create_inode(fs->itable, newdir_inode_index, mode);
+	fs->itable[newdir_inode_index].links = 2;
+	inode_write_end(fs, newdir_inode_index);
+
 	// Add directory entry to the parent directory
-	if (add_dentry(fs, par_inode, newdir_inode_index, new_dir_name) < 0) {
+	inode_write_begin(fs, par_inode);
+	int ret = add_dentry(fs, par_inode, newdir_inode_index, new_dir_name);
+	if (ret == 0) {
+		// The new directory's ".." links to its parent
+		fs->itable[par_inode].links += 1;
+	}
+	inode_write_end(fs, par_inode);
+	if (ret < 0) {
+		// The parent has no room for another entry block; the new inode
+		// goes back along with its counts
 		fprintf(stderr, "a1fs_mkdir: failed to add directory entry to parent inode\n");
-		return -errno;
+		release_inode(fs, newdir_inode_index);
+		return -ENOSPC;
 	}
+	sbc_add(fs, SBC_USED_DIRS, 1);
 
 	return 0;
 }
@@ -361,27 +510,6 @@ static int a1fs_rmdir(const char *path)
 		return -ENOTEMPTY;
 	}
 
-	// Reset all meta data of the inode
-	struct timespec curr_time;
-    clock_gettime(CLOCK_REALTIME, &curr_time);
-	fs->itable[ino_to_rm].i_mtime = curr_time;
-	fs->itable[ino_to_rm].links = 0;
-	fs->itable[ino_to_rm].size = 0;
-	fs->itable[ino_to_rm].last_used_extent = -1;
-	fs->itable[ino_to_rm].last_used_indirect = -1;
-	fs->itable[ino_to_rm].num_entries = 0;
-
-	// Flip corresponding inode bit in inode bitmap
-	if (check_bit_usage(fs->inode_bits, ino_to_rm)) {
-		if (set_bits(fs->sb, fs->inode_bits, ino_to_rm, 0, -1, 0) < 0) {
-			fprintf(stderr, "a1fs_rmdir: could not flip inode bit\n");
-			return -errno;
-		}
-	} else {
-		fprintf(stderr, "a1fs_rmdir: supposedly existing inode does not exist per inode bitmap\n");
-		return -errno;
-	}
-
 	// Get name of the directory to be removed
 	char *dir_to_rm_name = strrchr(path, '/') + 1;
 
@@ -411,19 +539,22 @@ static int a1fs_rmdir(const char *path)
 			// Loop through every directory entry in the current block
 			for(int k = 0; k < A1FS_BLOCK_SIZE; k += sizeof(a1fs_dentry)){
 				if( ((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->ino == ino_to_rm){
-					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->ino = -1;
-					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->name[0] = '\0';
-
 					// Update metadata
 					struct timespec curr_time;
 					clock_gettime(CLOCK_REALTIME, &curr_time);
+					inode_write_begin(fs, parent_inode_num);
+					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->ino = -1;
+					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->name[0] = '\0';
+					journal_note_change(fs, fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k);
 					fs->itable[parent_inode_num].i_mtime = curr_time;
 					fs->itable[parent_inode_num].num_entries -= 1;
 					fs->itable[parent_inode_num].links -= 1;
-					fs->sb->sb_used_dirs_count -= 1;
-					fs->sb->sb_free_blocks_count += 1;
+					inode_write_end(fs, parent_inode_num);
+					sbc_add(fs, SBC_USED_DIRS, -1);
 
-					return 0;
+					// Release its directory entry blocks and the inode itself,
+					// now that no entry refers to it
+					return release_inode(fs, ino_to_rm);
 				}
 			}
 		}	
@@ -448,38 +579,21 @@ static int a1fs_rmdir(const char *path)
  *
  * @param path  path to the file to create.
  * @param mode  file mode bits.
- * @param fi    unused.
+ * @param fi    file info; receives the caching policy for the open file.
  * @return      0 on success; -errno on error.
  */
 static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	(void)fi;// unused
 	assert(S_ISREG(mode));
 	fs_ctx *fs = get_fs();
 
-	// The new file's inode index
-	int new_inode_index;
-
-	// Find first available inode bit in inode bitmap
-	new_inode_index = get_available_bit(fs->sb, fs->inode_bits, 0, -1);
-	if (new_inode_index == -1) {
-		fprintf(stderr, "a1fs_create: could not find empty inode for new file\n");
-		return -ENOSPC;
-	}
-
-	// Set corresponding inode bit in inode bitmap
-	if (set_bits(fs->sb, fs->inode_bits, new_inode_index, 0, -1, 1) < 0) {
-		fprintf(stderr, "a1fs_create: could not set inode bit for new file\n");
-		return -errno;
-	}
-
-	// Create corresponding inode in inode table
-	create_inode(fs->itable, new_inode_index, mode);
+	// Creating also opens the file
+	fi->keep_cache = fs->opts->keep_cache;
 
 	// Get name of the file to be created
 	char *new_file_name = strrchr(path, '/') + 1;
 
-	// Get the parent's inode number
+	// Get the parent's inode number, which decides where the new one goes
 	int parent_inode_num;
 	if (new_file_name == NULL) {
 		parent_inode_num = 0;
@@ -493,15 +607,164 @@ static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 		}
 	}
 
+	// The new file's inode index
+	int new_inode_index;
+
+	// Allocate an inode in the group of the parent directory
+	new_inode_index = group_alloc_inode(fs, parent_inode_num, false);
+	if (new_inode_index == -1) {
+		fprintf(stderr, "a1fs_create: could not find empty inode for new file\n");
+		return -ENOSPC;
+	}
+	csum_inode_new(fs, new_inode_index);
+	itable_init(fs, new_inode_index);
+
+	// Create corresponding inode in inode table
+	inode_write_begin(fs, new_inode_index);
+	create_inode(fs->itable, new_inode_index, mode);
+	fs->itable[new_inode_index].links = 1;
+	inode_write_end(fs, new_inode_index);
+
 	// Add directory entry to the parent directory
-	if (add_dentry(fs, parent_inode_num, new_inode_index, new_file_name) < 0) {
+	inode_write_begin(fs, parent_inode_num);
+	int ret = add_dentry(fs, parent_inode_num, new_inode_index, new_file_name);
+	inode_write_end(fs, parent_inode_num);
+	if (ret < 0) {
+		// The parent has no room for another entry block; the new inode
+		// goes back along with its counts
 		fprintf(stderr, "a1fs_create: failed to add directory entry to parent inode\n");
-		return -errno;
+		release_inode(fs, new_inode_index);
+		return -ENOSPC;
 	}
 
 	return 0;
 }
 
+/**
+ * Open a file.
+ *
+ * Implements the open() system call for existing files and sets the caching
+ * policy of the open file. No permission checks are done. The readahead state
+ * of the open file is kept in fi->fh.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOENT  the file was removed since FUSE looked it up.
+ *   ENOMEM  not enough memory.
+ *
+ * @param path  path to the file to open.
+ * @param fi    file info; receives the caching policy for the open file.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_open(const char *path, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+
+	int inode_num = get_inode_num(fs, path, 0);
+	if (inode_num < 0) {
+		return -ENOENT;
+	}
+
+	a1fs_ra_state *ra = calloc(1, sizeof(*ra));
+	if (ra == NULL) {
+		return -ENOMEM;
+	}
+	fi->fh = (uintptr_t)ra;
+
+	// File data already sits in the page cache of the image mapping. Caching
+	// it again for the FUSE file doubles the memory used by large files that
+	// are streamed through once, so those bypass the kernel cache and are
+	// served straight from the image.
+	a1fs_inode inode;
+	inode_snapshot(fs, inode_num, &inode);
+	if ((fs->opts->direct_io_threshold != 0) &&
+	    (inode.size >= fs->opts->direct_io_threshold))
+	{
+		fi->direct_io = 1;
+		return 0;
+	}
+
+	// Writes drop the cached pages they affect, but A1FS_IOC_COPY_RANGE does
+	// not, so cached data is only kept across opens if the user asked for it
+	fi->keep_cache = fs->opts->keep_cache;
+
+	return 0;
+}
+
+/**
+ * Release an open file.
+ *
+ * Called when the last file descriptor of an open file is closed. Frees the
+ * readahead state.
+ *
+ * @param path  unused.
+ * @param fi    file info of the open file.
+ * @return      0.
+ */
+static int a1fs_release(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	free((a1fs_ra_state *)(uintptr_t)fi->fh);
+	fi->fh = 0;
+	return 0;
+}
+
+/**
+ * Flush an open file.
+ *
+ * Called on every close() of a file descriptor. Starts writing back the data
+ * the file dirtied, without waiting for it; fsync() waits.
+ *
+ * Errors:
+ *   ENOENT  the file was removed.
+ *   EIO     the backend failed to write back its cache.
+ *
+ * @param path  path to the file.
+ * @param fi    unused.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_flush(const char *path, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+
+	int inode_num = get_inode_num(fs, path, 0);
+	if (inode_num < 0) {
+		return -ENOENT;
+	}
+	return flush_inode(fs, inode_num);
+}
+
+/**
+ * Synchronize the changes of a file with the image.
+ *
+ * Implements the fsync() and fdatasync() system calls. Only the image ranges
+ * and metadata that the file changed are written back; see sync.h.
+ *
+ * Errors:
+ *   ENOENT  the file was removed.
+ *   EIO     writing back failed.
+ *   ENOMEM  not enough memory.
+ *
+ * @param path      path to the file.
+ * @param datasync  non-zero for fdatasync().
+ * @param fi        unused.
+ * @return          0 on success; -errno on error.
+ */
+static int a1fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+
+	int inode_num = get_inode_num(fs, path, 0);
+	if (inode_num < 0) {
+		return -ENOENT;
+	}
+	return sync_inode(fs, inode_num, datasync != 0);
+}
+
 /**
  * Remove a file.
  *
@@ -521,43 +784,6 @@ static int a1fs_unlink(const char *path)
 
 	// The inode index of the file to be removed
 	int ino_to_rm = get_inode_num(fs, path, 0);
-	
-	// Reset all of the data bits in the data bitmap if the file to be removed used any
-	if (fs->itable[ino_to_rm].size != 0 || fs->itable[ino_to_rm].last_used_extent != -1) {
-		for (int i = 0; i <= (int)fs->itable[ino_to_rm].last_used_extent; i++) {
-			// Flip corresponding data bit(s) in data bitmap
-			if (check_bit_usage(fs->block_bits, fs->itable[ino_to_rm].i_extent[i].start)) {
-				if (set_bits(fs->sb, fs->block_bits, fs->itable[ino_to_rm].i_extent[i].start, 1, fs->itable[ino_to_rm].i_extent[i].count, 0) < 0) {
-					fprintf(stderr, "a1fs_unlink: could not flip data bit(s)\n");
-					return -errno;
-				}
-			} else {
-				fprintf(stderr, "a1fs_unlink: supposedly existing data bit does not exist per data bitmap\n");
-				return -errno;
-			}
-		}
-	}
-
-	// Reset all meta data of the inode
-	struct timespec curr_time;
-    clock_gettime(CLOCK_REALTIME, &curr_time);
-	fs->itable[ino_to_rm].i_mtime = curr_time;
-	fs->itable[ino_to_rm].links = 0;
-	fs->itable[ino_to_rm].size = 0;
-	fs->itable[ino_to_rm].last_used_extent = -1;
-	fs->itable[ino_to_rm].last_used_indirect = -1;
-	fs->itable[ino_to_rm].num_entries = 0;
-
-	// Flip corresponding inode bit in inode bitmap
-	if (check_bit_usage(fs->inode_bits, ino_to_rm)) {
-		if (set_bits(fs->sb, fs->inode_bits, ino_to_rm, 0, -1, 0) < 0) {
-			fprintf(stderr, "a1fs_unlink: could not flip inode bit\n");
-			return -errno;
-		}
-	} else {
-		fprintf(stderr, "a1fs_unlink: supposedly existing inode does not exist per inode bitmap\n");
-		return -errno;
-	}
 
 	// Get name of the file to be removed
 	char *file_to_rm_name = strrchr(path, '/') + 1;
@@ -588,18 +814,21 @@ static int a1fs_unlink(const char *path)
 			// Loop through every directory entry in the current block
 			for(int k = 0; k < A1FS_BLOCK_SIZE; k += sizeof(a1fs_dentry)){
 				if( ((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->ino == ino_to_rm){
-					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->ino = -1;
-					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->name[0] = '\0';
-
 					// Update metadata
 					struct timespec curr_time;
 					clock_gettime(CLOCK_REALTIME, &curr_time);
+					inode_write_begin(fs, parent_inode_num);
+					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->ino = -1;
+					((a1fs_dentry *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->name[0] = '\0';
+					journal_note_change(fs, fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k);
 					fs->itable[parent_inode_num].i_mtime = curr_time;
 					fs->itable[parent_inode_num].num_entries -= 1;
-					fs->itable[parent_inode_num].links -= 1;
-					fs->sb->sb_free_blocks_count += 1;
+					inode_write_end(fs, parent_inode_num);
 
-					return 0;
+					// Release its data blocks and the inode itself, in the
+					// background if the file is large, now that no entry
+					// refers to it
+					return release_inode(fs, ino_to_rm);
 				}
 			}
 		}	
@@ -639,151 +868,86 @@ static int a1fs_utimens(const char *path, const struct timespec times[2])
 	if (inode_num < 0) {
 		return -errno;
 	}
+	inode_write_begin(fs, inode_num);
 	fs->itable[inode_num].i_mtime = times[1];
+	inode_write_end(fs, inode_num);
+	dirty_note_meta(fs, inode_num, false);
 	return 0;
 }
 
 /**
- * Change the size of a file.
+ * Change the size of the file with inode number <cur_inode>.
  *
- * Implements the truncate() system call. Supports both extending and shrinking.
- * If the file is extended, the new uninitialized range at the end must be
- * filled with zeros.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
- *
- * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
+ * The caller must hold the inode's write section (inode_write_begin()).
  *
- * @param path  path to the file to set the size.
- * @param size  new file size in bytes.
- * @return      0 on success; -errno on error.
+ * @param fs         file system context.
+ * @param cur_inode  inode number of the file.
+ * @param size       new file size in bytes.
+ * @return           0 on success; -errno on error.
  */
-static int a1fs_truncate(const char *path, off_t size)
+static int truncate_inode(fs_ctx *fs, int cur_inode, off_t size)
 {
-	fs_ctx *fs = get_fs();
-
-	int cur_inode = get_inode_num(fs, path, 0);
-	int cur_size = fs->itable[cur_inode].size;
+	off_t cur_size = fs->itable[cur_inode].size;
 
 	// Succeed if current size is wanted size
 	if (cur_size == size){
 		return 0;
 	}
 
-	// 1. Case that the file is empty
-	if (fs->itable[cur_inode].last_used_extent == -1) {
-
-		fprintf(stderr, "\na1fs_truncate: case empty file\n");
-
-		// Handle the empty file case
-		if (truncate_helper(fs, cur_inode, size) < 0) {
-			fprintf(stderr, "a1fs_truncate: truncate_helper failed for the empty file case\n");
-			return -errno;
-		}
-
-		// Initialize and set the inode size
-		fs->itable[cur_inode].size = size;
-
-		return 0;
-	}
-	
-	// 2. Case that we extend the file
+	// 1. Case that we extend the file
 	if (cur_size < size) {
 
-		fprintf(stderr, "\na1fs_truncate: current inode size = %d\n", cur_size);
-		
-		// Number of data blocks the inode is currently using (floored though)
-		int num_blocks = cur_size / A1FS_BLOCK_SIZE;
-
-		fprintf(stderr, "\na1fs_truncate: num_blocks = %d\n", num_blocks);
-
-		// The number of bytes of the last data block of the inode
-		int leftover_bytes = cur_size - (num_blocks * A1FS_BLOCK_SIZE);
-
-		fprintf(stderr, "\na1fs_truncate: leftover_bytes = %d\n", leftover_bytes);
-
-		// The number of bytes until the last data block of the inode is full (divisible by A1FS_BLOCK_SIZE)
-		int bytes_til_full = A1FS_BLOCK_SIZE - leftover_bytes;
+		// Bytes that the file's data blocks can already hold
+		off_t allocated = (off_t)file_block_count(&fs->itable[cur_inode]) * A1FS_BLOCK_SIZE;
 
-		fprintf(stderr, "\na1fs_truncate: bytes_til_full = %d\n", bytes_til_full);
+		// A. Zero out the stale tail of the blocks the file already has
+		if (allocated > cur_size) {
+			a1fs_inode whole = fs->itable[cur_inode];
+			whole.size = allocated;
 
-
-		// A. Case that the new size cannot fill up the last data block of the inode
-		if (size < bytes_til_full) {
-
-			fprintf(stderr, "\na1fs_truncate: case new size cannot fill up last DB\n");
-
-			if (truncate_helper(fs, cur_inode, size) < 0) {
-				fprintf(stderr, "a1fs_truncate: case extension; case not filler; failed truncate_helper\n");
-				return -errno;
+			a1fs_seg segs[A1FS_MAX_EXTENTS];
+			off_t tail_end = size < allocated ? size : allocated;
+			int num_segs = map_file_range(fs, &whole, cur_size, tail_end - cur_size, segs);
+			if (num_segs < 0) {
+				fprintf(stderr, "a1fs_truncate: case extension; map_file_range failed\n");
+				return -EIO;
+			}
+			for (int i = 0; i < num_segs; i++) {
+				backend_sync(fs, segs[i].pos, segs[i].len);
+				memset(fs->image + segs[i].pos, '\0', segs[i].len);
 			}
-
-			// Update the inode size
-			int bytes_added = size - cur_size;
-			fs->itable[cur_inode].size += size - cur_size;
-
-			fprintf(stderr, "\na1fs_truncate: added %d bytes to inode\n", bytes_added);
-
-			return 0;
 		}
 
-		// B. Case that the new size can fill up the last data block of the inode 
-		if (size > bytes_til_full) {
-
-			fprintf(stderr, "\na1fs_truncate: case new size can fill up last DB\n");
-			
-			// The number of remaining bytes to truncate
-			int remaining_bytes = size - fs->itable[cur_inode].size;
-
-			// TODO: indirect case
-			int last_db_index = fs->itable[cur_inode].i_extent[fs->itable[cur_inode].last_used_extent].start 
-								+ fs->itable[cur_inode].i_extent[fs->itable[cur_inode].last_used_extent].count
-								- 1;
-			
-			// Get the corresponding data block address
-			unsigned char * db_addr = (unsigned char *)(fs->image 
-														+ (A1FS_BLOCK_SIZE * last_db_index) 
-														+ (A1FS_BLOCK_SIZE * fs->sb->sb_first_data_block)
-														+ (leftover_bytes));
-			
-			// Zero out the last existing DB
-			if (memset(db_addr, '\0', bytes_til_full) == NULL) {
-				fprintf(stderr, "a1fs_truncate: case extension; case filler; failed to memset\n");
-				return -ENOMEM;
+		// B. Add zeroed blocks for the bytes that do not fit
+		if (size > allocated) {
+			if (truncate_helper(fs, cur_inode, size - allocated) < 0) {
+				fprintf(stderr, "a1fs_truncate: case extension; truncate_helper failed\n");
+				return -ENOSPC;
 			}
+		}
 
-			fprintf(stderr, "\na1fs_helper: just zeroed out %d bytes at index %d\n", bytes_til_full, last_db_index + fs->sb->sb_first_data_block);
-			remaining_bytes = remaining_bytes - bytes_til_full;
-
-			// Case that more bytes must be zeroed
-			if (remaining_bytes != 0) {
-				if (truncate_helper(fs, cur_inode, remaining_bytes) < 0) {
-					fprintf(stderr, "a1fs_truncate: case extension; case filler; case more bytes to be zeroed; truncate helper failed\n");
-					return -errno;
-				}
-			}
-
-			// Update the inode size
-			int bytes_added = size - fs->itable[cur_inode].size;
-			fs->itable[cur_inode].size += bytes_added;
-
-			fprintf(stderr, "\na1fs_truncate: added %d bytes to inode\n", bytes_added);
+		// Update the inode metadata
+		struct timespec curr_time;
+		clock_gettime(CLOCK_REALTIME, &curr_time);
+		fs->itable[cur_inode].i_mtime = curr_time;
+		fs->itable[cur_inode].size = size;
 
-			return 0;
+		// The zeroed range is new data of the file
+		a1fs_seg segs[A1FS_MAX_EXTENTS];
+		int num_segs = map_file_range(fs, &fs->itable[cur_inode], cur_size, size - cur_size, segs);
+		if (num_segs > 0) {
+			dirty_note(fs, cur_inode, segs, num_segs);
 		}
+		dirty_note_meta(fs, cur_inode, true);
+
+		return 0;
 	}
 	
-	// 3. Case that we shrink the file
+	// 2. Case that we shrink the file
 	if (cur_size > size) {
 
 		// Number of data blocks that the inode is using
-		int ino_db_num = cur_size / A1FS_BLOCK_SIZE;
-		if (cur_size % A1FS_BLOCK_SIZE != 0) {
-			ino_db_num += 1;
-		}
+		int ino_db_num = file_block_count(&fs->itable[cur_inode]);
 
 		// Number of data blocks we wish to end up with
 		int db_desired_num = size / A1FS_BLOCK_SIZE;
@@ -794,6 +958,22 @@ static int a1fs_truncate(const char *path, off_t size)
 		// Number of data blocks to unlink
 		int num_db_to_unlink = ino_db_num - db_desired_num;
 
+		// Hand whole extents past the new end over to the reclamation worker
+		// if there are many blocks to free
+		if (num_db_to_unlink >= A1FS_RECLAIM_MIN_BLOCKS) {
+			int first = 0;
+			for (int kept = 0; kept < db_desired_num; first++) {
+				kept += fs->itable[cur_inode].i_extent[first].count;
+			}
+			int detached = 0;
+			for (int i = first; i <= (int)fs->itable[cur_inode].last_used_extent; i++) {
+				detached += fs->itable[cur_inode].i_extent[i].count;
+			}
+			if ((detached > 0) && (orphan_extents(fs, cur_inode, first) == 0)) {
+				num_db_to_unlink -= detached;
+			}
+		}
+
 		// Flip the corresponding data bits to 0
 		// Loop through every used extent backwards in the corresponding inode.
 		for (int i = (int)fs->itable[cur_inode].last_used_extent; i >= 0; i--) {
@@ -814,10 +994,20 @@ static int a1fs_truncate(const char *path, off_t size)
 				}
 				
 				// Flip the corresponding data bit to 0
-				if (set_bits(fs->sb, fs->block_bits, j, 1, 1, 0) < 0) {
+				if (set_bits(fs, fs->block_bits, j, 1, 1, 0) < 0) {
 					fprintf(stderr, "a1fs_truncate: case shrinkage; set_bits failed\n");
 					return -errno;
 				}
+				freecache_note(fs, j, 1, false);
+				backend_drop(fs, j, 1);
+				journal_note_free(fs, j, 1);
+				discard_queue(fs, j, 1);
+
+				// Drop the block from the extent, and the extent once it is empty
+				fs->itable[cur_inode].i_extent[i].count -= 1;
+				if (fs->itable[cur_inode].i_extent[i].count == 0) {
+					fs->itable[cur_inode].last_used_extent -= 1;
+				}
 
 				num_db_to_unlink -= 1;
 			}
@@ -829,10 +1019,14 @@ static int a1fs_truncate(const char *path, off_t size)
 			fs->itable[cur_inode].last_used_indirect = -1;
 		}
 
+		// Update inode modification time
+		struct timespec curr_time;
+		clock_gettime(CLOCK_REALTIME, &curr_time);
+		fs->itable[cur_inode].i_mtime = curr_time;
+
 		// Update the inode size
 		fs->itable[cur_inode].size = size;
-
-		fprintf(stderr, "\na1fs_truncate: removed %ld bytes from inode\n", fs->itable[cur_inode].size );
+		dirty_note_meta(fs, cur_inode, true);
 
 		return 0;
 	}
@@ -840,92 +1034,218 @@ static int a1fs_truncate(const char *path, off_t size)
 	return -1;
 }
 
+/**
+ * Change the size of a file.
+ *
+ * Implements the truncate() system call. Supports both extending and shrinking.
+ * If the file is extended, the new uninitialized range at the end must be
+ * filled with zeros.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the file to set the size.
+ * @param size  new file size in bytes.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_truncate(const char *path, off_t size)
+{
+	fs_ctx *fs = get_fs();
+
+	int cur_inode = get_inode_num(fs, path, 0);
+
+	inode_write_begin(fs, cur_inode);
+	int ret = truncate_inode(fs, cur_inode, size);
+	inode_write_end(fs, cur_inode);
+
+	return ret;
+}
+
 
 /**
  * Read data from a file.
  *
  * Implements the pread() system call. Must return exactly the number of bytes
  * requested except on EOF (end of file). Reads from file ranges that have not
- * been written to must return ranges filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
+ * been written to must return ranges filled with zeros. The byte range from
+ * offset to offset + size may span several extents.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a file.
  *
- * Errors: none
+ * Errors:
+ *   EIO  the file's extents do not cover its size.
  *
  * @param path    path to the file to read from.
  * @param buf     pointer to the buffer that receives the data.
  * @param size    buffer size (number of bytes requested).
  * @param offset  offset from the beginning of the file to read from.
- * @param fi      unused.
+ * @param fi      file info; fh holds the readahead state.
  * @return        number of bytes read on success; 0 if offset is beyond EOF;
  *                -errno on error.
  */
 static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
                      struct fuse_file_info *fi)
 {
-	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
 	// The inode number of the corresponding file
 	int inode_num = get_inode_num(fs, path, 0);
 	if (inode_num < 0) {
-		return -errno;
+		return -ENOENT;
 	}
 
-	// The number of bytes left until we reach the offset byte
-	int remainingoffset = offset;
+	// Work on a consistent copy of the size and extent list
+	a1fs_inode inode;
+	inode_snapshot(fs, inode_num, &inode);
 
-	// Case that the offset is beyond EOF
-	if (offset > (int) fs->itable[inode_num].size){
-		return 0;
+	// Find where the requested bytes lie in the image
+	a1fs_seg segs[A1FS_MAX_EXTENTS];
+	int num_segs = map_file_range(fs, &inode, offset, size, segs);
+	if (num_segs < 0) {
+		fprintf(stderr, "a1fs_read: map_file_range failed\n");
+		return -EIO;
 	}
-	
-	// Get the extent index of the extent that contains the <offset> byte
-	int cur_extent = 0;
-	int cur_indirect_extent = -1;
+	readahead_note(fs, (a1fs_ra_state *)(uintptr_t)fi->fh, &inode, offset, size);
 
-	// Find the extent that contains the <offset> byte
-	if (find_offset_extent(fs, inode_num, &cur_extent, &cur_indirect_extent, &remainingoffset) < 0) {
-		fprintf(stderr, "a1fs_read: find_offset_extent failed\n");
-		return -errno;
+	// Copy the pieces out of the image
+	int read = 0;
+	for (int i = 0; i < num_segs; i++) {
+		read += segs[i].len;
+	}
+	if (backend_read_segs(fs, buf, segs, num_segs) != 0) {
+		return -EIO;
 	}
 
-	// The number of remaining bytes to be read
-	int remainingsize = size;
+	return read;
+}
 
-	// Number of bytes current read
-	int read = 0;
+/**
+ * Read data from a file without copying it.
+ *
+ * Same as a1fs_read(), but instead of copying the data, returns a buffer
+ * vector with one entry per contiguous piece of the range, each pointing at
+ * the image file descriptor and the piece's position in the image. FUSE can
+ * then splice the data from the image straight into the kernel. Backends that
+ * cache data in memory return a single memory buffer instead.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   EIO     the file's extents do not cover its size.
+ *
+ * @param path    path to the file to read from.
+ * @param bufp    pointer that receives the buffer vector; freed by FUSE.
+ * @param size    number of bytes requested.
+ * @param offset  offset from the beginning of the file to read from.
+ * @param fi      file info; fh holds the readahead state.
+ * @return        0 on success; -errno on error.
+ */
+static int a1fs_read_buf(const char *path, struct fuse_bufvec **bufp,
+                         size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+
+	// The inode number of the corresponding file
+	int inode_num = get_inode_num(fs, path, 0);
+	if (inode_num < 0) {
+		return -ENOENT;
+	}
 
-	while(remainingsize > 0){
-		// Note that <remainingoffset> is added here so we can reach the offset in first iteration
-		// so in the next extent, we set <remainingoffset> back to zero
-
-		//TODO: indirect case
-		unsigned char* extent_data = (unsigned char*)(fs->image 
-													+ fs->sb->sb_first_data_block * A1FS_BLOCK_SIZE 
-													+ fs->itable[inode_num].i_extent[cur_extent].start * A1FS_BLOCK_SIZE 
-													+ remainingoffset);
-		
-		// Read the entire extent if the remaining bytes to read allows
-		if (remainingsize > fs->itable[inode_num].i_extent[cur_extent].count * A1FS_BLOCK_SIZE - remainingoffset){
-			memcpy(buf, extent_data, size);
-			read = fs->itable[inode_num].i_extent[cur_extent].count * A1FS_BLOCK_SIZE - remainingoffset;
-			remainingsize = remainingsize - ((fs->itable[inode_num].i_extent[cur_extent].count * A1FS_BLOCK_SIZE) - remainingoffset);
-			cur_extent += 1;
-			remainingoffset = 0;
-
-		// Read the remaining size otherwise
-		}else{
-			memcpy(&buf[read], extent_data, remainingsize);
-			//set remaining to zero, we are done 
-			remainingsize = 0;
-			return size;
+	// Work on a consistent copy of the size and extent list
+	a1fs_inode inode;
+	inode_snapshot(fs, inode_num, &inode);
+
+	// Find where the requested bytes lie in the image
+	a1fs_seg segs[A1FS_MAX_EXTENTS];
+	int num_segs = map_file_range(fs, &inode, offset, size, segs);
+	if (num_segs < 0) {
+		fprintf(stderr, "a1fs_read_buf: map_file_range failed\n");
+		return -EIO;
+	}
+	readahead_note(fs, (a1fs_ra_state *)(uintptr_t)fi->fh, &inode, offset, size);
+
+	// Read through the backend into a buffer of its own; FUSE frees the
+	// buffer and the vector separately
+	if (!fs->backend->zero_copy) {
+		size_t total = 0;
+		for (int i = 0; i < num_segs; i++) {
+			total += segs[i].len;
+		}
+		struct fuse_bufvec *bufv = malloc(sizeof(*bufv));
+		char *data = malloc(total > 0 ? total : 1);
+		if ((bufv == NULL) || (data == NULL)) {
+			free(bufv);
+			free(data);
+			return -ENOMEM;
+		}
+		*bufv = FUSE_BUFVEC_INIT(total);
+		bufv->buf[0].mem = data;
+
+		if (backend_read_segs(fs, data, segs, num_segs) != 0) {
+			free(data);
+			free(bufv);
+			return -EIO;
 		}
+		*bufp = bufv;
+		return 0;
+	}
+
+	// The vector already holds one buffer; an empty one means EOF
+	struct fuse_bufvec *bufv = malloc(sizeof(*bufv) + (num_segs > 0 ? num_segs - 1 : 0) * sizeof(struct fuse_buf));
+	if (bufv == NULL) {
+		return -ENOMEM;
+	}
+	*bufv = FUSE_BUFVEC_INIT(0);
+
+	// Point each buffer at its piece of the image file
+	for (int i = 0; i < num_segs; i++) {
+		bufv->buf[i].size = segs[i].len;
+		bufv->buf[i].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+		bufv->buf[i].mem = NULL;
+		bufv->buf[i].fd = fs->fd;
+		bufv->buf[i].pos = segs[i].pos;
+	}
+	if (num_segs > 0) {
+		bufv->count = num_segs;
+	}
 
-	} 
-	return size;
+	*bufp = bufv;
+	return 0;
+}
+
+/**
+ * Prepare a file for a write of the byte range [offset, end).
+ *
+ * Extends the file (zero-filling any hole) if the range ends beyond EOF, and
+ * updates the modification time.
+ *
+ * @param fs         file system context.
+ * @param inode_num  inode number of the file.
+ * @param end        offset just past the last byte to be written.
+ * @return           0 on success; -errno on error.
+ */
+static int prepare_write(fs_ctx *fs, int inode_num, off_t end)
+{
+	int ret = 0;
+	inode_write_begin(fs, inode_num);
+
+	// Case that the offset plus the number of bytes to write is beyond EOF
+	if (end > (off_t)fs->itable[inode_num].size) {
+		ret = truncate_inode(fs, inode_num, end);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &fs->itable[inode_num].i_mtime);
+
+	inode_write_end(fs, inode_num);
+	dirty_note_meta(fs, inode_num, false);
+	return ret;
 }
 
 /**
@@ -934,8 +1254,8 @@ static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
  * Implements the pwrite() system call. Must return exactly the number of bytes
  * requested except on error. If the offset is beyond EOF (end of file), the
  * file must be extended. If the write creates a "hole" of uninitialized data,
- * the new uninitialized range must filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
+ * the new uninitialized range must filled with zeros. The byte range from
+ * offset to offset + size may span several extents.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a file.
@@ -957,127 +1277,531 @@ static int a1fs_write(const char *path, const char *buf, size_t size,
 {
 	(void)fi;// unused
 	fs_ctx *fs = get_fs();
-	/* 
-	Our algorithm should run like this: forget the indirect block for now
-	1. Get inode num, call truncate for a size anyays ( gotta set the zeroes first)
-	2. Travel to the offset
-		iterate through the extents until we find an extent that is bigger than our remaining offset-distance
-		Once we've found, record this distance, extent, and exit from the travel loop
-	3. call truncate if offset + size > filesize
-	4. begin writing, filling cur extent first, and then the next appropriate extent after calling truncate
-	5. return bytes written
-	*/
 
 	// The inode number of the corresponding file
 	int inode_num = get_inode_num(fs, path, 0);
 	if (inode_num < 0) {
-		return -errno;
+		return -ENOENT;
 	}
 
-	// The number of bytes left until we reach the offset byte
-	int remainingoffset = offset;
+	// Make sure the file's blocks cover the whole range
+	int ret = prepare_write(fs, inode_num, offset + size);
+	if (ret != 0) {
+		return ret;
+	}
 
-	// Case that the offset plus the number of bytes to write is beyond EOF
-	if (offset + size > (long unsigned int) fs->itable[inode_num].size){
-		if (a1fs_truncate(path, size + offset) != 0){
-			return -ENOSPC;
+	// Find where the range lies in the image
+	a1fs_seg segs[A1FS_MAX_EXTENTS];
+	int num_segs = map_file_range(fs, &fs->itable[inode_num], offset, size, segs);
+	if (num_segs < 0) {
+		fprintf(stderr, "a1fs_write: map_file_range failed\n");
+		return -EIO;
+	}
+	dirty_note(fs, inode_num, segs, num_segs);
+
+	// Copy the pieces into the image
+	int written = 0;
+	for (int i = 0; i < num_segs; i++) {
+		written += segs[i].len;
+	}
+	if (backend_write_segs(fs, buf, segs, num_segs) != 0) {
+		return -EIO;
+	}
+
+	return written;
+}
+
+/**
+ * Write data to a file from a FUSE buffer vector.
+ *
+ * Same as a1fs_write(), but the data is copied with fuse_buf_copy() into the
+ * image file descriptor at each extent the range covers. When FUSE splices the
+ * request into a pipe (see a1fs_fuse_init()), the data goes on from the pipe
+ * into the image without a user space copy.
+ * Backends that cache data in memory get it through a temporary buffer.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path    path to the file to write to.
+ * @param buf     buffer vector with the data.
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      unused.
+ * @return        number of bytes written on success; -errno on error.
+ */
+static int a1fs_write_buf(const char *path, struct fuse_bufvec *buf,
+                          off_t offset, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+	size_t size = fuse_buf_size(buf);
+
+	// The inode number of the corresponding file
+	int inode_num = get_inode_num(fs, path, 0);
+	if (inode_num < 0) {
+		return -ENOENT;
+	}
+
+	// Make sure the file's blocks cover the whole range
+	int ret = prepare_write(fs, inode_num, offset + size);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Find where the range lies in the image
+	a1fs_seg segs[A1FS_MAX_EXTENTS];
+	int num_segs = map_file_range(fs, &fs->itable[inode_num], offset, size, segs);
+	if (num_segs < 0) {
+		fprintf(stderr, "a1fs_write_buf: map_file_range failed\n");
+		return -EIO;
+	}
+	dirty_note(fs, inode_num, segs, num_segs);
+	if (num_segs == 0) {
+		return 0;
+	}
+
+	// Gather the data into memory and hand it to the backend
+	if (!fs->backend->zero_copy) {
+		struct fuse_bufvec mem = FUSE_BUFVEC_INIT(size);
+		mem.buf[0].mem = malloc(size);
+		if (mem.buf[0].mem == NULL) {
+			return -ENOMEM;
+		}
+		ssize_t copied = fuse_buf_copy(&mem, buf, 0);
+		if (copied != (ssize_t)size) {
+			free(mem.buf[0].mem);
+			return copied < 0 ? copied : -EIO;
 		}
+
+		ret = backend_write_segs(fs, mem.buf[0].mem, segs, num_segs);
+		free(mem.buf[0].mem);
+		return ret != 0 ? -EIO : (int)size;
 	}
-	
-	// Get the extent index of the extent that contains the <offset> byte
-	int cur_extent = 0;
-	int cur_indirect_extent = -1;
 
-	// Find the extent that contains the <offset> byte
-	if (find_offset_extent(fs, inode_num, &cur_extent, &cur_indirect_extent, &remainingoffset) < 0) {
-		fprintf(stderr, "a1fs_write: find_offset_extent failed\n");
-		return -errno;
+	// Destination vector with one buffer per piece of the image file
+	struct fuse_bufvec *dst = malloc(sizeof(*dst) + (num_segs - 1) * sizeof(struct fuse_buf));
+	if (dst == NULL) {
+		return -ENOMEM;
+	}
+	*dst = FUSE_BUFVEC_INIT(0);
+	dst->count = num_segs;
+	for (int i = 0; i < num_segs; i++) {
+		dst->buf[i].size = segs[i].len;
+		dst->buf[i].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK | FUSE_BUF_FD_RETRY;
+		dst->buf[i].mem = NULL;
+		dst->buf[i].fd = fs->fd;
+		dst->buf[i].pos = segs[i].pos;
 	}
 
-	// The number of remaining bytes to be write
-	int remainingsize = size;
+	ssize_t written = fuse_buf_copy(dst, buf, 0);
+	free(dst);
 
-	// Number of bytes currently written
-	int written = 0;
+	return written;
+}
+
+/**
+ * Copy a byte range between files (or within one file) inside the image.
+ *
+ * The destination is extended as needed, and the data is moved extent by
+ * extent with memmove() in the image instead of passing through a read and a
+ * write of a user space buffer.
+ *
+ * Errors:
+ *   EINVAL  the ranges overlap within the same file.
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param fs       file system context.
+ * @param src_ino  inode number of the source file.
+ * @param src_off  offset in the source file.
+ * @param dst_ino  inode number of the destination file.
+ * @param dst_off  offset in the destination file.
+ * @param len      number of bytes to copy.
+ * @return         number of bytes copied (less than len if the source ends
+ *                 before src_off + len); -errno on error.
+ */
+static ssize_t copy_range(fs_ctx *fs, int src_ino, off_t src_off,
+                          int dst_ino, off_t dst_off, size_t len)
+{
+	// Only copy what the source actually has
+	a1fs_inode src;
+	inode_snapshot(fs, src_ino, &src);
+	if ((uint64_t)src_off >= src.size) {
+		return 0;
+	}
+	if (len > src.size - src_off) {
+		len = src.size - src_off;
+	}
+
+	if ((src_ino == dst_ino) &&
+	    (src_off < dst_off + (off_t)len) && (dst_off < src_off + (off_t)len))
+	{
+		return -EINVAL;
+	}
+
+	// Make sure the destination's blocks cover the whole range
+	int ret = prepare_write(fs, dst_ino, dst_off + len);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Both ranges as pieces of the image; the source extents are unchanged
+	a1fs_seg src_segs[A1FS_MAX_EXTENTS];
+	a1fs_seg dst_segs[A1FS_MAX_EXTENTS];
+	int num_src = map_file_range(fs, &fs->itable[src_ino], src_off, len, src_segs);
+	int num_dst = map_file_range(fs, &fs->itable[dst_ino], dst_off, len, dst_segs);
+	if ((num_src < 0) || (num_dst < 0)) {
+		fprintf(stderr, "copy_range: map_file_range failed\n");
+		return -EIO;
+	}
+
+	dirty_note(fs, dst_ino, dst_segs, num_dst);
+
+	// The copy goes through the mapping, so nothing may stay cached there
+	for (int k = 0; k < num_src; k++) {
+		backend_sync(fs, src_segs[k].pos, src_segs[k].len);
+	}
+	for (int k = 0; k < num_dst; k++) {
+		backend_sync(fs, dst_segs[k].pos, dst_segs[k].len);
+	}
+
+	// Walk both lists in step, copying the overlap of the current pieces
+	size_t copied = 0;
+	int i = 0, j = 0;
+	size_t i_done = 0, j_done = 0;
+	while ((i < num_src) && (j < num_dst)) {
+		size_t n = src_segs[i].len - i_done;
+		if (n > dst_segs[j].len - j_done) {
+			n = dst_segs[j].len - j_done;
+		}
+		memmove(fs->image + dst_segs[j].pos + j_done,
+		        fs->image + src_segs[i].pos + i_done, n);
+		copied += n;
+
+		i_done += n;
+		if (i_done == src_segs[i].len) {
+			i++;
+			i_done = 0;
+		}
+		j_done += n;
+		if (j_done == dst_segs[j].len) {
+			j++;
+			j_done = 0;
+		}
+	}
+
+	return copied;
+}
+
+/**
+ * Handle a1fs specific ioctls.
+ *
+ * Only A1FS_IOC_COPY_RANGE is supported; it is how copy_file_range() style
+ * copies are requested, since the FUSE 2.9 API has no such operation. The
+ * kernel does not know that the destination changed, so its cached pages and
+ * attributes of that file are refreshed only on the next open (never, with
+ * -o keep_cache) or when the attribute timeout expires.
+ *
+ * Errors:
+ *   ENOTTY  unknown ioctl.
+ *   ENOENT  the source file does not exist.
+ *   EISDIR  the source or the destination is a directory.
+ *   EINVAL  an offset is negative, or the end of a range overflows.
+ *   errors of copy_range().
+ *
+ * @param path   path to the file the ioctl was issued on.
+ * @param cmd    ioctl number.
+ * @param arg    unused.
+ * @param fi     unused.
+ * @param flags  FUSE_IOCTL_* flags.
+ * @param data   the ioctl argument, copied in by the kernel.
+ * @return       number of bytes copied on success; -errno on error.
+ */
+static int a1fs_ioctl(const char *path, int cmd, void *arg,
+                      struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+	(void)arg;// unused
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+
+	if ((flags & FUSE_IOCTL_COMPAT) || ((unsigned int)cmd != A1FS_IOC_COPY_RANGE)) {
+		return -ENOTTY;
+	}
+	if (flags & FUSE_IOCTL_DIR) {
+		return -EISDIR;
+	}
+	a1fs_copy_range *req = (a1fs_copy_range*)data;
+	req->src_path[A1FS_PATH_MAX - 1] = '\0';
+
+	int dst_ino = get_inode_num(fs, path, 0);
+	int src_ino = get_inode_num(fs, req->src_path, 0);
+	if ((dst_ino < 0) || (src_ino < 0)) {
+		return -ENOENT;
+	}
+	if (!S_ISREG(fs->itable[src_ino].mode) || !S_ISREG(fs->itable[dst_ino].mode)) {
+		return -EISDIR;
+	}
+
+	// The return value has to fit an int
+	size_t len = req->len;
+	if (len > INT_MAX) {
+		len = INT_MAX;
+	}
+
+	// Offsets come from user space, and become off_t below
+	if ((req->src_off > (uint64_t)INT64_MAX - len) || (req->dst_off > (uint64_t)INT64_MAX - len)) {
+		return -EINVAL;
+	}
+	return copy_range(fs, src_ino, req->src_off, dst_ino, req->dst_off, len);
+}
+
+/**
+ * Move a directory entry, optionally replacing or swapping with the target.
+ *
+ * Only directory entries are changed; the inodes and data blocks of the moved
+ * files stay where they are. A replaced target is freed.
+ *
+ * Errors:
+ *   ENOENT        "from" does not exist, or "to" does not exist with
+ *                 RENAME_EXCHANGE.
+ *   EEXIST        "to" exists and RENAME_NOREPLACE was given.
+ *   EINVAL        a directory would be moved into itself, or invalid flags.
+ *   EISDIR        "to" is a directory but "from" is not.
+ *   ENOTDIR       "from" is a directory but "to" is not.
+ *   ENOTEMPTY     "to" is a non-empty directory.
+ *   ENAMETOOLONG  the new name is too long.
+ *   ENOSPC        not enough free space for a new directory entry block.
+ *
+ * @param fs     file system context.
+ * @param from   old path.
+ * @param to     new path.
+ * @param flags  0, RENAME_NOREPLACE or RENAME_EXCHANGE.
+ * @return       0 on success; -errno on error.
+ */
+static int rename_dentry(fs_ctx *fs, const char *from, const char *to,
+                         unsigned int flags)
+{
+	if (flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) {
+		return -EINVAL;
+	}
+	if ((flags & RENAME_NOREPLACE) && (flags & RENAME_EXCHANGE)) {
+		return -EINVAL;
+	}
+
+	char *from_name = strrchr(from, '/') + 1;
+	char *to_name = strrchr(to, '/') + 1;
+	if (strlen(to_name) >= A1FS_NAME_MAX) {
+		return -ENAMETOOLONG;
+	}
+
+	int from_par = get_inode_num(fs, from, 1);
+	int to_par = get_inode_num(fs, to, 1);
+	if ((from_par < 0) || (to_par < 0)) {
+		return -ENOENT;
+	}
+	a1fs_dentry *from_d = find_dentry(fs, from_par, from_name);
+	if (from_d == NULL) {
+		return -ENOENT;
+	}
+	a1fs_dentry *to_d = find_dentry(fs, to_par, to_name);
+	int from_ino = from_d->ino;
+
+	// A directory can't end up inside itself
+	size_t from_len = strlen(from);
+	if (S_ISDIR(fs->itable[from_ino].mode) &&
+	    (strncmp(to, from, from_len) == 0) && (to[from_len] == '/'))
+	{
+		return -EINVAL;
+	}
+
+	// Swap the inodes the two entries point to
+	if (flags & RENAME_EXCHANGE) {
+		if (to_d == NULL) {
+			return -ENOENT;
+		}
+		int to_ino = to_d->ino;
+		// Nor can the other one
+		size_t to_len = strlen(to);
+		if (S_ISDIR(fs->itable[to_ino].mode) &&
+		    (strncmp(from, to, to_len) == 0) && (from[to_len] == '/'))
+		{
+			return -EINVAL;
+		}
+
+		// A directory swapped with a file takes its ".." link along. Within
+		// one directory, lookups see both entries change at once
+		int moved = (S_ISDIR(fs->itable[from_ino].mode) ? 1 : 0) -
+		            (S_ISDIR(fs->itable[to_ino].mode) ? 1 : 0);
+		inode_write_begin(fs, from_par);
+		from_d->ino = to_ino;
+		journal_note_change(fs, from_d);
+		if (from_par == to_par) {
+			to_d->ino = from_ino;
+			journal_note_change(fs, to_d);
+		}
+		fs->itable[from_par].links -= moved;
+		clock_gettime(CLOCK_REALTIME, &fs->itable[from_par].i_mtime);
+		inode_write_end(fs, from_par);
+		inode_write_begin(fs, to_par);
+		if (from_par != to_par) {
+			to_d->ino = from_ino;
+			journal_note_change(fs, to_d);
+		}
+		fs->itable[to_par].links += moved;
+		clock_gettime(CLOCK_REALTIME, &fs->itable[to_par].i_mtime);
+		inode_write_end(fs, to_par);
+		return 0;
+	}
+
+	if (to_d != NULL) {
+		if (flags & RENAME_NOREPLACE) {
+			return -EEXIST;
+		}
+		int to_ino = to_d->ino;
+		if (to_ino == from_ino) {
+			return 0;
+		}
+		if (S_ISDIR(fs->itable[to_ino].mode)) {
+			if (!S_ISDIR(fs->itable[from_ino].mode)) {
+				return -EISDIR;
+			}
+			if (fs->itable[to_ino].num_entries > 0) {
+				return -ENOTEMPTY;
+			}
+		} else if (S_ISDIR(fs->itable[from_ino].mode)) {
+			return -ENOTDIR;
+		}
 
-	while(remainingsize > 0){
-		// Note that <remainingoffset> is added here so we can reach the offset in first iteration
-		// so in the next extent, we set <remainingoffset> back to zero
-
-		//TODO: indirect case
-		unsigned char* extent_data = (unsigned char*)(fs->image 
-														+ fs->sb->sb_first_data_block * A1FS_BLOCK_SIZE 
-														+ fs->itable[inode_num].i_extent[cur_extent].start * A1FS_BLOCK_SIZE 
-														+ remainingoffset);
-		
-		// Write the entire extent if the remaining bytes to read allows
-		if (remainingsize > fs->itable[inode_num].i_extent[cur_extent].count * A1FS_BLOCK_SIZE - remainingoffset){
-			memcpy(extent_data + remainingoffset, buf, fs->itable[inode_num].i_extent[cur_extent].count * A1FS_BLOCK_SIZE - remainingoffset);
-			written = fs->itable[inode_num].i_extent[cur_extent].count * A1FS_BLOCK_SIZE - remainingoffset;
-			remainingsize = remainingsize - ((fs->itable[inode_num].i_extent[cur_extent].count * A1FS_BLOCK_SIZE) - remainingoffset);
-			cur_extent += 1;
-			remainingoffset = 0;
-
-		// Write the remaining size otherwise
-		}else{
-			memcpy(extent_data, &buf[written], remainingsize);
-			//set remaining to zero, we are done 
-			remainingsize = 0;
-			return size;
+		// Repointing the target entry replaces it atomically: a lookup of
+		// "to" sees either the old or the new file, never neither
+		bool dir = S_ISDIR(fs->itable[to_ino].mode);
+		inode_write_begin(fs, to_par);
+		to_d->ino = from_ino;
+		journal_note_change(fs, to_d);
+		clock_gettime(CLOCK_REALTIME, &fs->itable[to_par].i_mtime);
+		inode_write_end(fs, to_par);
+		inode_write_begin(fs, from_par);
+		clear_dentry(fs, from_par, from_d);
+		if (dir) {
+			// to_par still has the same number of subdirectories
+			fs->itable[from_par].links -= 1;
 		}
+		inode_write_end(fs, from_par);
+		if (dir) {
+			sbc_add(fs, SBC_USED_DIRS, -1);
+		}
+
+		return release_inode(fs, to_ino);
+	}
+
+	// Within one directory the entry is simply renamed in place
+	if (from_par == to_par) {
+		inode_write_begin(fs, from_par);
+		strcpy(from_d->name, to_name);
+		journal_note_change(fs, from_d);
+		clock_gettime(CLOCK_REALTIME, &fs->itable[from_par].i_mtime);
+		inode_write_end(fs, from_par);
+		return 0;
+	}
+
+	// Otherwise link the inode into the new parent before dropping the old
+	// entry, so that the file is reachable at all times
+	int moved = S_ISDIR(fs->itable[from_ino].mode) ? 1 : 0;
+	inode_write_begin(fs, to_par);
+	int ret = add_dentry(fs, to_par, from_ino, to_name);
+	if (ret == 0) {
+		fs->itable[to_par].links += moved;
+	}
+	inode_write_end(fs, to_par);
+	if (ret < 0) {
+		return -ENOSPC;
+	}
+	inode_write_begin(fs, from_par);
+	clear_dentry(fs, from_par, from_d);
+	fs->itable[from_par].links -= moved;
+	inode_write_end(fs, from_par);
 
-	} 
-	return size;
-
-	// int inode_num = get_inode_num(fs, path, 0);
-	// fprintf(stderr, "a1fs_write: size = %ld, offset = %ld inode size = %ld, inode num = %d\n", size , offset, fs->itable[inode_num].size, inode_num);
-	// //set remaining
-	// // remaining size is the number of remaining bytes to be written
-	// int remainingsize = size;
-	// // remainingoffset is the distance of remaining bytes, until we reach the correct extent
-	// int remainingoffset = offset;
-	// int cur_extent = 0;
-	// // if there is no extent yet in this file, make one first...call truncate instead
-	// // 	we should only call truncate if the write will end up out of bounds
-	// if (offset + size > fs->itable[inode_num].size){
-	// 	fprintf(stderr, "\na1fs_write: recognized an empty file; size = %ld, offset = %ld, inode size = %ld\n", size , offset, fs->itable[inode_num].size);
-	// 	if (a1fs_truncate(path, size + offset) != 0){
-	// 		return -ENOSPC;
-	// 	}
-	// }
-	// // traveling to extent
-	// while(remainingoffset > 0){
-	// 	//if current extent is smaller than the remaining offset, then it's not in this extent, so increment
-	// 	if (fs->itable[inode_num].i_extent[cur_extent].size < remainingoffset){
-	// 		//decrease offset by the extent we just passed
-	// 		remainingoffset -= fs->itable[inode_num].i_extent[cur_extent].size;
-	// 		// goto next extent
-	// 		cur_extent++;
-	// 	}else{// otherwise, we have found, since current extent is greater or equal to remaining offset, 
-	// 		//since its in this extent, lets break out, we now have the offset from within the extent(remainingsize), and the current
-	// 		//extent in cur_extent
-	// 		break;
-	// 	}
-	// }
-	// //first set the uninitialized zone to null
-	// //once we are here we have found the correct extent, as well as the offset. time to write...
-	// int written = 0;
+	return 0;
 }
 
+/**
+ * Rename a file or directory.
+ *
+ * Implements the rename() system call. See "man 2 rename" for details. An
+ * existing "to" is replaced atomically.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "from" exists.
+ *   The parent directory of "to" exists and is a directory.
+ *
+ * Errors: see rename_dentry().
+ *
+ * @param from  old path.
+ * @param to    new path.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_rename(const char *from, const char *to)
+{
+	// The FUSE 2.9 API doesn't pass renameat2() flags
+	return rename_dentry(get_fs(), from, to, 0);
+}
+
+
+/**
+ * Define op##_journaled(), which runs callback <op> as a journal handle, so that
+ * a commit never sees its metadata changes half done.
+ */
+#define JOURNALED(op, params, args)                 \
+	static int op##_journaled params                \
+	{                                               \
+		fs_ctx *fs = get_fs();                      \
+		journal_begin(fs);                          \
+		int ret = op args;                          \
+		journal_end(fs);                            \
+		return ret;                                 \
+	}
+
+JOURNALED(a1fs_statfs, (const char *path, struct statvfs *st), (path, st))
+JOURNALED(a1fs_mkdir, (const char *path, mode_t mode), (path, mode))
+JOURNALED(a1fs_rmdir, (const char *path), (path))
+JOURNALED(a1fs_create, (const char *path, mode_t mode, struct fuse_file_info *fi),
+          (path, mode, fi))
+JOURNALED(a1fs_unlink, (const char *path), (path))
+JOURNALED(a1fs_rename, (const char *from, const char *to), (from, to))
+JOURNALED(a1fs_utimens, (const char *path, const struct timespec times[2]), (path, times))
+JOURNALED(a1fs_truncate, (const char *path, off_t size), (path, size))
+JOURNALED(a1fs_write, (const char *path, const char *buf, size_t size, off_t offset,
+                       struct fuse_file_info *fi), (path, buf, size, offset, fi))
+JOURNALED(a1fs_write_buf, (const char *path, struct fuse_bufvec *buf, off_t offset,
+                           struct fuse_file_info *fi), (path, buf, offset, fi))
+JOURNALED(a1fs_ioctl, (const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+                       unsigned int flags, void *data), (path, cmd, arg, fi, flags, data))
 
 static struct fuse_operations a1fs_ops = {
+	.init     = a1fs_fuse_init,
 	.destroy  = a1fs_destroy,
-	.statfs   = a1fs_statfs,
+	.statfs   = a1fs_statfs_journaled,
 	.getattr  = a1fs_getattr,
 	.readdir  = a1fs_readdir,
-	.mkdir    = a1fs_mkdir,
-	.rmdir    = a1fs_rmdir,
-	.create   = a1fs_create,
-	.unlink   = a1fs_unlink,
-	.utimens  = a1fs_utimens,
-	.truncate = a1fs_truncate,
+	.mkdir    = a1fs_mkdir_journaled,
+	.rmdir    = a1fs_rmdir_journaled,
+	.create   = a1fs_create_journaled,
+	.open     = a1fs_open,
+	.release  = a1fs_release,
+	.flush    = a1fs_flush,
+	.fsync    = a1fs_fsync,
+	.unlink   = a1fs_unlink_journaled,
+	.rename   = a1fs_rename_journaled,
+	.utimens  = a1fs_utimens_journaled,
+	.truncate = a1fs_truncate_journaled,
 	.read     = a1fs_read,
-	.write    = a1fs_write,
+	.read_buf = a1fs_read_buf,
+	.write    = a1fs_write_journaled,
+	.write_buf = a1fs_write_buf_journaled,
+	.ioctl    = a1fs_ioctl_journaled,
 };
 
 int main(int argc, char *argv[])
@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <limits.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 
 
@@ -45,6 +46,31 @@ typedef int32_t a1fs_ino_t;
 /** Magic value that can be used to identify an a1fs image. */
 #define A1FS_MAGIC 0xC5C369A1C5C369A1ul
 
+/*
+ * Allocation groups.
+ *
+ * The inodes and the data blocks are split into sb_groups_count groups. Group
+ * g owns inodes [g * sb_group_inodes, (g + 1) * sb_group_inodes), and data
+ * blocks (counted from sb_first_data_block) from g * sb_group_blocks up to the
+ * start of the next group; the last group takes all remaining data blocks.
+ * The bitmap and inode table slices of the groups are packed together, in
+ * group order, in the inode bitmap, block bitmap and inode table regions, so
+ * inode and data block numbers are the same as without groups.
+ *
+ * sb_group_inodes is a multiple of the inodes per inode table block, and
+ * sb_group_blocks a multiple of A1FS_FSC_CHUNK.
+ */
+
+/** Maximum number of allocation groups; their descriptors are in the superblock. */
+#define A1FS_MAX_GROUPS 512
+
+/** Allocation group descriptor. */
+typedef struct a1fs_group_desc {
+	/** Blocks at the end of the group's inode table slice not initialized yet. */
+	uint32_t gd_itable_unused;
+
+} a1fs_group_desc;
+
 /** a1fs superblock. */
 typedef struct a1fs_superblock {
 	/** Must match A1FS_MAGIC. */
@@ -52,16 +78,30 @@ typedef struct a1fs_superblock {
 	/** File system size in bytes. */
 	uint64_t size;
 
-	uint8_t   sb_first_data_block;  /* Index of first data block */
-	uint8_t	  sb_first_empty_db;	/* Index of first empty data block */
-	uint8_t	  sb_total_data_blocks; /* Total data block counts */
-	uint8_t   sb_block_bitmap;      /* Index of blocks bitmap block */
-	uint8_t   sb_inode_bitmap;      /* Index of inodes bitmap block */
-	uint8_t   sb_inode_table;       /* Index of inodes table block */
+	a1fs_blk_t sb_first_data_block; /* Index of first data block */
+	a1fs_blk_t sb_first_empty_db;	/* Index of first empty data block */
+	a1fs_blk_t sb_total_data_blocks; /* Total data block counts */
+	a1fs_blk_t sb_block_bitmap;     /* Index of blocks bitmap block */
+	a1fs_blk_t sb_inode_bitmap;     /* Index of inodes bitmap block */
+	a1fs_blk_t sb_inode_table;      /* Index of inodes table block */
 	int64_t   sb_free_blocks_count; /* Free blocks count */
 	int64_t   sb_free_inodes_count; /* Free inodes count */
 	int64_t   sb_inodes_count;		/* Total inodes count */
 	int64_t   sb_used_dirs_count;   /* Directories count */
+	a1fs_ino_t sb_orphan_head;      /* First inode waiting to be freed, 0 if none */
+	uint32_t  sb_journal_start;     /* Index of the first metadata journal block */
+	uint32_t  sb_journal_blocks;    /* Journal size in blocks, 0 if none */
+	uint32_t  sb_fsc_start;         /* Index of the first free-space cache block */
+	uint32_t  sb_fsc_blocks;        /* Free-space cache size in blocks, 0 if none */
+	uint64_t  sb_fsc_gen;           /* Generation of the valid free-space cache, 0 if none */
+	uint32_t  sb_group_blocks;      /* Data blocks per allocation group */
+	uint32_t  sb_group_inodes;      /* Inodes per allocation group */
+	uint32_t  sb_groups_count;      /* Number of allocation groups */
+	uint32_t  sb_reserved_blocks;   /* Free blocks only directories may use */
+	uint32_t  sb_mounted;           /* Non-zero while mounted */
+	uint32_t  sb_bitmap_checksum;   /* XOR of the CRC32C of each bitmap block */
+	uint32_t  sb_checksum;          /* CRC32C of this structure, taken with this field 0 */
+	a1fs_group_desc sb_groups[A1FS_MAX_GROUPS]; /* Allocation group descriptors */
 
 } a1fs_superblock;
 
@@ -82,17 +122,23 @@ typedef struct a1fs_extent {
 } a1fs_extent;
 
 
+/** Number of extents stored directly in an inode. */
+#define A1FS_MAX_EXTENTS 12
+
 /** a1fs inode. */
 typedef struct a1fs_inode {
 	mode_t 			  mode;
 	uint32_t 		  links;
 	uint64_t 		  size;						/* Number of bytes used */
 	struct timespec   i_mtime;					/* Last modified time */
-    a1fs_extent       i_extent[12];  			/* Pointers to extents */  
+    a1fs_extent       i_extent[A1FS_MAX_EXTENTS];	/* Pointers to extents */  
 	int32_t 		  last_used_extent;			/* Index of Last Used Extent */
 	int32_t		  	  last_used_indirect;
 	uint32_t 		  num_entries;				/* Number of entries if directory */
-	uint8_t           i_pad[64];	  			/* Padding */
+	a1fs_ino_t        i_next_orphan;			/* Next inode on the orphan list */
+	uint32_t          i_checksum;				/* CRC32C of the inode, taken with this field 0 */
+	uint32_t          i_dir_checksum[A1FS_MAX_EXTENTS];	/* CRC32C of each extent if directory */
+	uint8_t           i_pad[8];	  			/* Padding */
 
 } a1fs_inode;
 
@@ -116,3 +162,121 @@ typedef struct a1fs_dentry {
 } a1fs_dentry;
 
 static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size");
+
+
+/**
+ * Argument of the A1FS_IOC_COPY_RANGE ioctl, issued on the destination file.
+ *
+ * Copies len bytes at src_off in the file src_path to dst_off in the
+ * destination file, extending it if needed. The data never leaves the image.
+ */
+typedef struct a1fs_copy_range {
+	/** Source file path, relative to the root of the mounted file system. */
+	char src_path[A1FS_PATH_MAX];
+	/** Offset in the source file. */
+	uint64_t src_off;
+	/** Offset in the destination file. */
+	uint64_t dst_off;
+	/** Number of bytes to copy. */
+	uint64_t len;
+
+} a1fs_copy_range;
+
+#define A1FS_IOC_COPY_RANGE _IOW('a', 1, a1fs_copy_range)
+
+
+/*
+ * Metadata journal.
+ *
+ * The journal occupies sb_journal_blocks blocks between the inode table and
+ * the first data block. Its first block is the header; transactions follow it
+ * back to back. A transaction is one or more descriptor blocks, each followed
+ * by the images of the blocks it lists, and a commit block. Every block of a
+ * transaction carries its sequence number; replay stops at the first block
+ * with the wrong magic or sequence number, or at a commit block whose
+ * checksum doesn't match.
+ */
+
+#define A1FS_JOURNAL_MAGIC  0x4A4E4C41u// "ALNJ"
+#define A1FS_JDESC_MAGIC    0x43534544u// "DESC"
+#define A1FS_JCOMMIT_MAGIC  0x54494D43u// "CMIT"
+
+/** Journal header, in the first journal block. */
+typedef struct a1fs_journal_header {
+	/** Must match A1FS_JOURNAL_MAGIC. */
+	uint32_t magic;
+	/** Non-zero if all transactions have been written in place. */
+	uint32_t clean;
+	/** Sequence number of the first transaction after the header. */
+	uint64_t seq;
+
+} a1fs_journal_header;
+
+/** Number of block numbers in a descriptor block. */
+#define A1FS_JDESC_MAX ((A1FS_BLOCK_SIZE - 16) / sizeof(a1fs_blk_t))
+
+/** Descriptor block: where the blocks that follow it belong. */
+typedef struct a1fs_journal_desc {
+	/** Must match A1FS_JDESC_MAGIC. */
+	uint32_t magic;
+	/** Number of entries in blocks. */
+	uint32_t count;
+	/** Transaction sequence number. */
+	uint64_t seq;
+	/** Image block numbers. */
+	a1fs_blk_t blocks[A1FS_JDESC_MAX];
+
+} a1fs_journal_desc;
+
+static_assert(sizeof(a1fs_journal_desc) == A1FS_BLOCK_SIZE, "invalid descriptor size");
+
+/** Commit block, ending a transaction. */
+typedef struct a1fs_journal_commit {
+	/** Must match A1FS_JCOMMIT_MAGIC. */
+	uint32_t magic;
+	/** CRC32C of all descriptor and data blocks of the transaction. */
+	uint32_t checksum;
+	/** Transaction sequence number. */
+	uint64_t seq;
+
+} a1fs_journal_commit;
+
+/**
+ * Most blocks that a single file system operation changes: the superblock, a
+ * few inode bitmap, inode table and directory blocks (A1FS_JOURNAL_OP_FIXED in
+ * all), and any block of the block bitmap, since truncating a file may free
+ * blocks all over the image. The journal must fit a transaction this large.
+ */
+#define A1FS_JOURNAL_OP_FIXED 13
+#define A1FS_JOURNAL_OP_BLOCKS(data_blocks) \
+	(A1FS_JOURNAL_OP_FIXED + ((data_blocks) + A1FS_BLOCK_SIZE * 8 - 1) / (A1FS_BLOCK_SIZE * 8))
+
+/** Journal blocks taken by a transaction of n blocks, with the header. */
+#define A1FS_JOURNAL_MIN_BLOCKS(n) \
+	(1 + ((n) + A1FS_JDESC_MAX - 1) / A1FS_JDESC_MAX + (n) + 1)
+
+
+/*
+ * Free-space cache.
+ *
+ * The data blocks are split into chunks of A1FS_FSC_CHUNK blocks, and the
+ * cache holds the number of free blocks in each chunk, right after its header
+ * in the sb_fsc_blocks blocks that follow the journal. It is written at clean
+ * unmount, and is only valid if its generation matches sb_fsc_gen.
+ */
+
+#define A1FS_FSC_MAGIC 0x43534641u // "AFSC"
+
+/** Number of data blocks per free-space cache entry. */
+#define A1FS_FSC_CHUNK 4096
+
+/** Free-space cache header, followed by one uint32_t count per chunk. */
+typedef struct a1fs_fsc_header {
+	/** Must match A1FS_FSC_MAGIC. */
+	uint32_t magic;
+	/** Number of chunks. */
+	uint32_t nchunks;
+	/** Must match sb_fsc_gen. */
+	uint64_t gen;
+
+} a1fs_fsc_header;
@@ -1,4 +1,5 @@
 #include "a1fs_helper.h"
+#include "journal.h"
 
 int get_inode_num(fs_ctx *fs_context, const char* path, int tog) {
 	// Create copy of the path string before mutation  
@@ -22,6 +23,9 @@ int get_inode_num(fs_ctx *fs_context, const char* path, int tog) {
         // directory of the current directory, or   
         // possibly -1.
 		curr_inode = inode_lookup(fs_context, par_inode, token);
+		if (curr_inode == -EIO) {
+			return -EIO;
+		}
 
 		// Next token
 		token = strtok(NULL, "/");
@@ -30,6 +34,9 @@ int get_inode_num(fs_ctx *fs_context, const char* path, int tog) {
 	if (tog == 1) {
 		return par_inode;
 	}
+	if ((curr_inode >= 0) && !csum_verify_inode(fs_context, curr_inode)) {
+		return -EIO;
+	}
 	return curr_inode;
 }
 
@@ -39,14 +46,21 @@ int inode_lookup(fs_ctx *fs_context, int par_inode, char* token){
 	if (par_inode == -1) {
 		return -1;
 	}
+	if (!csum_verify_inode(fs_context, par_inode)) {
+		return -EIO;
+	}
+
+	// Work on a consistent copy of the parent's extent list
+	a1fs_inode parent;
+	inode_snapshot(fs_context, par_inode, &parent);
 
 	// TODO: indirect case
 	// Loop through every used extent in the corresponding directory's inode
-	for (int i = 0; i <= (int)fs_context->itable[par_inode].last_used_extent; i++){
+	for (int i = 0; i <= (int)parent.last_used_extent; i++){
 
 		// Loop through every block in the current extent
-		int start = fs_context->itable[par_inode].i_extent[i].start;
-		int length = fs_context->itable[par_inode].i_extent[i].count;
+		int start = parent.i_extent[i].start;
+		int length = parent.i_extent[i].count;
 		for( int j = start; j < start + length; j++) {
 
 			// Loop through every directory entry in the current block
@@ -62,6 +76,44 @@ int inode_lookup(fs_ctx *fs_context, int par_inode, char* token){
 	return -1;
 }
 
+a1fs_dentry *find_dentry(fs_ctx *fs_context, int dir_inode, const char *name) {
+	a1fs_inode dir;
+	inode_snapshot(fs_context, dir_inode, &dir);
+
+	for (int i = 0; i <= (int)dir.last_used_extent; i++) {
+		int start = dir.i_extent[i].start;
+		int length = dir.i_extent[i].count;
+		for (int j = start; j < start + length; j++) {
+			a1fs_dentry *block = (a1fs_dentry *)(fs_context->image + A1FS_BLOCK_SIZE * (fs_context->sb->sb_first_data_block + j));
+			for (int k = 0; k < (int)(A1FS_BLOCK_SIZE / sizeof(a1fs_dentry)); k++) {
+				if ((block[k].ino != (a1fs_ino_t)-1) && (strcmp(block[k].name, name) == 0)) {
+					return &block[k];
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+void clear_dentry(fs_ctx *fs_context, int dir_inode, a1fs_dentry *dentry) {
+	dentry->ino = -1;
+	dentry->name[0] = '\0';
+	journal_note_change(fs_context, dentry);
+
+	fs_context->itable[dir_inode].num_entries -= 1;
+	clock_gettime(CLOCK_REALTIME, &fs_context->itable[dir_inode].i_mtime);
+}
+
+void inode_snapshot(fs_ctx *fs_context, int inode_num, a1fs_inode *inode) {
+	unsigned int seq;
+
+	// Copy the inode, retrying if a writer updated it in the meantime
+	do {
+		seq = inode_read_begin(fs_context, inode_num);
+		memcpy(inode, &fs_context->itable[inode_num], sizeof(*inode));
+	} while (inode_read_retry(fs_context, inode_num, seq));
+}
+
 // Disclosure: last ditch effort to implement indirection involved
 int attachable(fs_ctx *fs_context, int inode_index, int extent_count, int *index_of_last_used_extent, int *index_db_after_last_used_extent) {
 	// Can we add to the end of the last extent?
@@ -113,20 +165,19 @@ int attachable(fs_ctx *fs_context, int inode_index, int extent_count, int *index
 	// This is the index of the data block right after the last extent
 	*index_db_after_last_used_extent = last_used_extent.start + last_used_extent.count;
 
+	// The blocks after the last extent must all exist
+	int num_data_blocks = fs_context->sb->size / A1FS_BLOCK_SIZE - fs_context->sb->sb_first_data_block;
+	if (*index_db_after_last_used_extent + extent_count > num_data_blocks) {
+		return 0;
+	}
+
 	// Check the <extent_count> blocks after the last extent
+	large_enough = 1;
 	for (int i = *index_db_after_last_used_extent; i < extent_count + (*index_db_after_last_used_extent); i++) {
-		// Get specific byte containing the data block
-		int byte = i / 8;
-
-		// Get number of bits to left-shift
-		int bit = i % 8;
-
 		// Indicate if space after last extent is not large enough or continue with the loop
-		if (fs_context->block_bits[byte] & (1 << bit)) {
-			large_enough = 1;
+		if (check_bit_usage(fs_context->block_bits, i)) {
+			large_enough = 0;
 			break;
-		} else {
-			continue;
 		}
 	}
 	return large_enough;
@@ -158,13 +209,18 @@ int set_dirb_extent(fs_ctx *fs_context, a1fs_inode *inode, int extent_index, int
 	} else {
 		inode->i_extent[extent_index].count += extent_count;
 	}
+	// Mark every entry of the new block as empty
 	for (int i = 0; i < A1FS_BLOCK_SIZE; i += sizeof(a1fs_dentry)) {
 		a1fs_dentry *dentry = (a1fs_dentry *)(fs_context->image 
 											+ (A1FS_BLOCK_SIZE * fs_context->sb->sb_first_data_block) 
-											+ (A1FS_BLOCK_SIZE * inode->i_extent[extent_index].start) 
+											+ (A1FS_BLOCK_SIZE * extent_start) 
 											+ i);
 		dentry->ino = (a1fs_ino_t)-1;
+		dentry->name[0] = '\0';
 	}
+	journal_note_change(fs_context, fs_context->image
+	                    + (A1FS_BLOCK_SIZE * fs_context->sb->sb_first_data_block)
+	                    + (A1FS_BLOCK_SIZE * extent_start));
 
 	struct timespec curr_time;
 	clock_gettime(CLOCK_REALTIME, &curr_time);
@@ -236,13 +292,11 @@ int allocate_data_blks(fs_ctx *fs_context, int inode_index, int data_index, int
 		// ALLOCATING DATA BLOCKS
 		if (db_type == 0) {
 			(*inode).last_used_extent = 0;
-			fprintf(stderr, "\nallocate_data_blks: empty, new, data block; ino %d, num_blks %d, extent_index %d, db_index %d\n", inode_index, extent_size, 0, data_index);
 			return set_db_extent(inode, 0, data_index, extent_size, 1);
 
 		// ALLOCATING DIRECTORY BLOCK
 		} else {
 			(*inode).last_used_extent = 0;
-			fprintf(stderr, "\nallocate_data_blks: empty, new, dir block; ino %d, num_blks %d, extent_index %d, db_index %d\n", inode_index, extent_size, 0, data_index);
 			return set_dirb_extent(fs_context, inode, 0, data_index, extent_size, 1);
 		}
 
@@ -258,29 +312,31 @@ int allocate_data_blks(fs_ctx *fs_context, int inode_index, int data_index, int
 
 			// ALLOCATING DATA BLOCKS
 			if (db_type == 0) {
-				fprintf(stderr, "\nallocate_data_blks: non-empty, addon, and data block; ino %d, num_blks %d, extent_index %d, db_index %d\n", inode_index, extent_size, index_of_last_used_extent, index_db_after_last_used_extent);
 				return set_db_extent(inode, index_of_last_used_extent, index_db_after_last_used_extent, extent_size, 0);
 				
 			// ALLOCATING DIRECTORY BLOCK
 			} else {
-				fprintf(stderr, "\nallocate_data_blks: non-empty, addon, and dir block; ino %d, num_blks %d, extent_index %d, db_index %d\n", inode_index, extent_size, index_of_last_used_extent, index_db_after_last_used_extent);
 				return set_dirb_extent(fs_context, inode, index_of_last_used_extent, index_db_after_last_used_extent, extent_size, 0);
 			}
 
 		// Case that no, we cannot add to the end of the last extent
 		} else {
+			// Every direct extent is already in use
+			if (index_of_last_used_extent + 1 >= A1FS_MAX_EXTENTS) {
+				fprintf(stderr, "allocate_data_blks: ino %d is out of extents\n", inode_index);
+				return -1;
+			}
+
 			// ALLOCATING DATA BLOCKS
 			if (db_type == 0) {
 				int next_i_extent_index = index_of_last_used_extent + 1;
 				(*inode).last_used_extent = next_i_extent_index;
-				fprintf(stderr, "\nallocate_data_blks: non-empty, new, and data block; ino %d, num_blks %d, extent_index %d, db_index %d\n", inode_index, extent_size, next_i_extent_index, data_index);
 				return set_db_extent(inode, next_i_extent_index, data_index, extent_size, 1);
 
 			// ALLOCATING DIRECTORY BLOCK
 			} else {
 				int next_i_extent_index = index_of_last_used_extent + 1;
 				(*inode).last_used_extent = next_i_extent_index;
-				fprintf(stderr, "\nallocate_data_blks: non-empty, new, and dir block; ino %d, num_blks %d, extent_index %d, db_index %d\n", inode_index, extent_size, next_i_extent_index, data_index);
 				return set_dirb_extent(fs_context, inode, next_i_extent_index, data_index, extent_size, 1);
 			}
 		}
@@ -294,12 +350,16 @@ int make_dentry_block(fs_ctx *fs_context, int directory_inode_num) {
 	// currently existing extents present. We will initialize entire block
 	// to be full of direntries that are empty with (ino value = -1)
 
+	// Keep the background zeroer off the block until it is marked used
+	pthread_mutex_lock(&fs_context->lock);
+
 	// Get the index of the first-fit data bit
 	// Note that this disregards tacking on to the last used extent of the
 	// corresponding inode; just find the first-fit.
-	int available_data_blk = get_available_bit(fs_context->sb, fs_context->block_bits, 1, 1);
+	int available_data_blk = freecache_find(fs_context, 1, group_goal(fs_context, directory_inode_num));
 	if (available_data_blk < 0) {
-		fprintf(stderr, "a1fs_helper: make_dentry_block: get_available_bit failed\n");
+		fprintf(stderr, "a1fs_helper: make_dentry_block: freecache_find failed\n");
+		pthread_mutex_unlock(&fs_context->lock);
 		return -1;
 	}
 
@@ -307,15 +367,21 @@ int make_dentry_block(fs_ctx *fs_context, int directory_inode_num) {
 	available_data_blk = allocate_data_blks(fs_context, directory_inode_num, available_data_blk, 1, 1);
 	if (available_data_blk < 0) {
 		fprintf(stderr, "a1fs_helper: make_dentry_block: allocate_data_blks failed\n");
+		pthread_mutex_unlock(&fs_context->lock);
 		return -1;
 	}
+	zero_note_alloc(fs_context, available_data_blk, 1);
 
 	// Set the data bit in the data bitmap
-	if (set_bits(fs_context->sb, fs_context->block_bits, available_data_blk, 1, 1, 1) < 0) {
+	if (set_bits(fs_context, fs_context->block_bits, available_data_blk, 1, 1, 1) < 0) {
 		fprintf(stderr, "a1fs_helper: make_dentry_block: set_bits failed\n");
+		pthread_mutex_unlock(&fs_context->lock);
 		return -1;
 	}
+	journal_note_alloc(fs_context, available_data_blk, 1);
+	freecache_note(fs_context, available_data_blk, 1, true);
 
+	pthread_mutex_unlock(&fs_context->lock);
 	return 0;
 }
 
@@ -376,17 +442,14 @@ int add_dentry(fs_ctx *fs_context, int directory_inode_num, int dentry_inode_num
 					((a1fs_dentry *)(fs_context->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->name[strlen(name)] = '\0';
 					// Set the directory entry's inode member
 					((a1fs_dentry *)(fs_context->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k))->ino = (a1fs_ino_t)dentry_inode_num;
+					journal_note_change(fs_context, fs_context->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * first_data_block) + k);
 
 					// Update inode metadata
-					fs_context->itable[directory_inode_num].links = 2;
 					fs_context->itable[directory_inode_num].size += 1;
 					struct timespec curr_time;
 					clock_gettime(CLOCK_REALTIME, &curr_time);
 					fs_context->itable[directory_inode_num].i_mtime = curr_time;
 					fs_context->itable[directory_inode_num].num_entries += 1;
-					
-					// Update superblock metadata
-					fs_context->sb->sb_used_dirs_count += 1;
 
 					return 0;
 				}
@@ -400,7 +463,7 @@ int add_dentry(fs_ctx *fs_context, int directory_inode_num, int dentry_inode_num
 int make_data_blocks(fs_ctx *fs_context, int inode_index, int num_blocks) {
 	
 	// Get the index of the first-fit data bit
-	int available_data_blk = get_available_bit(fs_context->sb, fs_context->block_bits, 1, num_blocks);
+	int available_data_blk = freecache_find(fs_context, num_blocks, group_goal(fs_context, inode_index));
 
 	// Base case
 	if (available_data_blk > -1) {
@@ -412,230 +475,197 @@ int make_data_blocks(fs_ctx *fs_context, int inode_index, int num_blocks) {
 		}
 
 		// Set the data bit in the data bitmap
-		if (set_bits(fs_context->sb, fs_context->block_bits, available_data_blk, 1, num_blocks, 1) < 0) {
+		if (set_bits(fs_context, fs_context->block_bits, available_data_blk, 1, num_blocks, 1) < 0) {
 			fprintf(stderr, "a1fs_helper: make_data_blocks: set_bits failed\n");
 			return -1;
 		}
+		journal_note_alloc(fs_context, available_data_blk, num_blocks);
+		freecache_note(fs_context, available_data_blk, num_blocks, true);
 
 		return num_blocks;
+	}
 
-	// Recursion
-	} else {
-		int total_created = 0;
-		int blocks_created = 0;
-		do
-		{
-			int blocks_created = make_data_blocks(fs_context, inode_index, num_blocks - 1);
-			if (blocks_created != -1) {
-				total_created += blocks_created;
-			} else {
-				return -1;
-			}
-		} while (num_blocks - blocks_created > 0);
-		return total_created;
+	// Not even a single free block
+	if (num_blocks == 1) {
+		return -1;
 	}
 
-	return -1;
+	// Recursion: no contiguous run is large enough, so place each half first-fit
+	int first_half = num_blocks - num_blocks / 2;
+	int first_created = make_data_blocks(fs_context, inode_index, first_half);
+	if (first_created < 0) {
+		return -1;
+	}
+	int second_created = make_data_blocks(fs_context, inode_index, num_blocks / 2);
+	if (second_created < 0) {
+		return -1;
+	}
+	return first_created + second_created;
 }
 
 int truncate_helper(fs_ctx *fs, int cur_inode, off_t size) {
-	// Num blocks is the floored number of blocks of the incoming size
-	int num_blocks = size / A1FS_BLOCK_SIZE;
-	int leftover_bytes = size - (num_blocks * A1FS_BLOCK_SIZE);
-	
-	fprintf(stderr, "\ntruncate_helper: num_blocks = %d \n", num_blocks);
-	fprintf(stderr, "\ntruncate_helper: leftover_bytes = %d \n", leftover_bytes);
+	// Number of new blocks needed to hold <size> more bytes
+	int num_blocks = size / A1FS_BLOCK_SIZE + (size % A1FS_BLOCK_SIZE != 0);
+
+	// Keep the background zeroer off the blocks until they are zeroed here
+	pthread_mutex_lock(&fs->lock);
+
+	// The reserved blocks are kept for directories
+	if (sbc_read(fs, SBC_FREE_BLOCKS) - (int64_t)fs->sb->sb_reserved_blocks < num_blocks) {
+		fprintf(stderr, "a1fs_truncate: only the reserved blocks are left\n");
+		pthread_mutex_unlock(&fs->lock);
+		return -1;
+	}
 
 	// Make the corresponding data blocks
-	//     - a non-zero leftover_bytes indicates the need for an extra block
-	if (leftover_bytes != 0) {
-		if ((num_blocks + 1) != make_data_blocks(fs, cur_inode, (num_blocks + 1))) {
-			fprintf(stderr, "a1fs_truncate: make_data_blocks failed\n");
-			return -1;
-		}
-	} else {
-		if (num_blocks != make_data_blocks(fs, cur_inode, num_blocks)) {
-			fprintf(stderr, "a1fs_truncate: make_data_blocks failed\n");
+	if (num_blocks != make_data_blocks(fs, cur_inode, num_blocks)) {
+		fprintf(stderr, "a1fs_truncate: make_data_blocks failed\n");
+		pthread_mutex_unlock(&fs->lock);
+		return -1;
+	}
+
+	// TODO: indirect case
+	// The new blocks are the last <num_blocks> blocks of the file; zero them
+	// out walking the extents backwards
+	int blocks_left_to_zero = num_blocks;
+	for (int i = fs->itable[cur_inode].last_used_extent; i >= 0 && blocks_left_to_zero > 0; i--) {
+		a1fs_extent *extent = &fs->itable[cur_inode].i_extent[i];
+		int count = extent->count < blocks_left_to_zero ? extent->count : blocks_left_to_zero;
+
+		if (zero_out_blocks(fs, extent->start + extent->count - count, count) < 0) {
+			fprintf(stderr, "truncate_helper: zero_out_blocks failed\n");
+			pthread_mutex_unlock(&fs->lock);
 			return -1;
 		}
+		blocks_left_to_zero -= count;
 	}
+	pthread_mutex_unlock(&fs->lock);
 
-	// Update inode metadata
+	// Update inode modification time
 	struct timespec curr_time;
 	clock_gettime(CLOCK_REALTIME, &curr_time);
 	fs->itable[cur_inode].i_mtime = curr_time;
 
-	// The number of blocks to zero out
-	int blocks_left_to_zero;
-	if (leftover_bytes != 0) {
-		blocks_left_to_zero = num_blocks + 1;	
-	} else {
-		blocks_left_to_zero = num_blocks;
-	}
+	return 0;
+}
 
+int zero_out_blocks(fs_ctx *fs, int start, int length) {
 
-	// TODO: indirect case
-	// Number of blocks needed for zeroeing
-	int blocks_needed = blocks_left_to_zero;
-	// Find the index of the extent that holds the first block to zero
-	int extent_first_db_to_zero;
-
-	// Find the starting block index at which we begin zeroeing such that the last <blocks_left_to_zero> blocks are zeroed
-	int first_db_to_zero;
-	for (int i = fs->itable[cur_inode].last_used_extent; i >= 0; i--) {
-		if (fs->itable[cur_inode].i_extent[i].count >= blocks_needed) {
-			extent_first_db_to_zero = i;
-			first_db_to_zero = (fs->itable[cur_inode].i_extent[i].start + fs->itable[cur_inode].i_extent[i].count) - blocks_needed;
-			break;
-		} else {
-			blocks_needed -= fs->itable[cur_inode].i_extent[i].count;
+	// Zero out each run of blocks that the background zeroer has not already
+	// zeroed
+	int i = start;
+	while (i < start + length) {
+		if (zero_known(fs, i)) {
+			i++;
+			continue;
+		}
+		int run = i;
+		while ((i < start + length) && !zero_known(fs, i)) {
+			i++;
 		}
+
+		// Get the address of the first data block of the run
+		unsigned char * db_addr = (unsigned char *)(fs->image + (A1FS_BLOCK_SIZE * run) + (A1FS_BLOCK_SIZE * fs->sb->sb_first_data_block));
+		memset(db_addr, '\0', (size_t)A1FS_BLOCK_SIZE * (i - run));
 	}
 
-	fprintf(stderr, "\ntruncate_helper: extent_first_db_to_zero = %d \n", extent_first_db_to_zero);
-	fprintf(stderr, "\ntruncate_helper: first_db_to_zero = %d \n", first_db_to_zero);
+	// The blocks are about to hold data
+	zero_note_alloc(fs, start, length);
 
-	// TODO: indirect case
-	// Loop through the extents of which contain the blocks to be zeroed
-	for (int i = extent_first_db_to_zero; i <= (int)fs->itable[cur_inode].last_used_extent; i++){
+	return 0;
+}
 
-		// Break out of loop if corresponding blocks are all zeroed out
-		if (blocks_left_to_zero == 0) {
-			break;
-		}
+void itable_init(fs_ctx *fs, int ino)
+{
+	const int per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_inode);
+	uint32_t per_group = fs->sb->sb_group_inodes;
+	uint32_t nblocks = per_group / per_block;
+	a1fs_group_desc *gd = &fs->sb->sb_groups[ino / per_group];
+	a1fs_inode *slice = &fs->itable[ino - ino % per_group];
+	uint32_t block = ino % per_group / per_block;
+	if (block < nblocks - __atomic_load_n(&gd->gd_itable_unused, __ATOMIC_ACQUIRE)) {
+		return;
+	}
 
-		// First extent may have existing blocks already, therefore it starts with a different index
-		if (i == extent_first_db_to_zero) {
+	// Blocks are zeroed before they are counted as initialized, so that
+	// whoever sees them as such also sees the zeros
+	pthread_mutex_lock(&fs->lock);
+	while (block >= nblocks - gd->gd_itable_unused) {
+		uint32_t next = nblocks - gd->gd_itable_unused;
+		memset(&slice[next * per_block], 0, A1FS_BLOCK_SIZE);
+		journal_note_change(fs, &slice[next * per_block]);
+		__atomic_store_n(&gd->gd_itable_unused, gd->gd_itable_unused - 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&fs->lock);
+}
 
-			if (zero_out_blocks(fs, cur_inode, i, 
-									first_db_to_zero, 
-									fs->itable[cur_inode].i_extent[i].count, 
-									&blocks_left_to_zero, 
-									leftover_bytes) < 0) {
-				fprintf(stderr, "\ntruncate_helper: zero_out_blocks failed for initial data extent\n");
-				return -1;
-			}
+int file_block_count(const a1fs_inode *inode) {
+	int num_blocks = 0;
 
-			// Update the extent size
-			fs->itable[cur_inode].i_extent[i].size += leftover_bytes;
-		} else {
+	for (int i = 0; i <= inode->last_used_extent; i++) {
+		num_blocks += inode->i_extent[i].count;
+	}
+	return num_blocks;
+}
 
-			if (zero_out_blocks(fs, cur_inode, i, 
-								fs->itable[cur_inode].i_extent[i].start, 
-								fs->itable[cur_inode].i_extent[i].count, 
-								&blocks_left_to_zero, 
-								leftover_bytes) < 0) {
-			fprintf(stderr, "\ntruncate_helper: zero_out_blocks failed for subsequent data extents\n");
-			return -1;
-			}
+int map_file_range(fs_ctx *fs, const a1fs_inode *inode, off_t offset, size_t size, a1fs_seg *segs) {
 
-			// Update the extent size
-			fs->itable[cur_inode].i_extent[i].size += leftover_bytes;
-		}
+	// Nothing to map before the start of the file
+	if (offset < 0) {
+		return -1;
 	}
 
-	// Update inode modification time
-	clock_gettime(CLOCK_REALTIME, &curr_time);
-	fs->itable[cur_inode].i_mtime = curr_time;
+	// Nothing to map at or beyond EOF
+	if (offset >= (off_t)inode->size) {
+		return 0;
+	}
 
-	return 0;
-}
+	// Clamp the range to the end of the file
+	if (size > inode->size - offset) {
+		size = inode->size - offset;
+	}
 
-int zero_out_blocks(fs_ctx *fs, int cur_inode, int extent_index, int start, int length, int *blocks_left_to_zero, int leftover_bytes) {
-	
-	// TODO: indirect case
-	// Loop through every block in the current extent
-	// fprintf(stderr, "\nzero_out_blocks: starting at block index %d \n", start);
-	// fprintf(stderr, "\nzero_out_blocks: going through %d blocks \n", length);
-	for( int j = start; j < start + length; j++) {
-		
-		// Get the corresponding data block address
-		unsigned char * db_addr = (unsigned char *)(fs->image + (A1FS_BLOCK_SIZE * j) + (A1FS_BLOCK_SIZE * fs->sb->sb_first_data_block));
-
-		// Only zero out <leftover_bytes> if we are at the leftover block
-		// and if there exists leftover bytes
-		if (*blocks_left_to_zero == 1 && leftover_bytes != 0) {
-			if (memset(db_addr, '\0', leftover_bytes) == NULL) {
-				fprintf(stderr, "zero_out_blocks: memset failed for leftover_bytes\n");
-				return -1;
-			}
-			
-			// fprintf(stderr, "\nzero_out_blocks: just zeroed out %d bytes at %d on db index (rel. to 1st db) %d\n", leftover_bytes, j + fs->sb->sb_first_data_block, j);
+	int num_segs = 0;
 
-			// Update the size of the current extent
-			fs->itable[cur_inode].i_extent[extent_index].size += leftover_bytes;
+	// File offset of the first byte of the current extent
+	off_t extent_offset = 0;
 
-			*blocks_left_to_zero -= 1;
-			break;
-		}
+	// Walk the extents in logical order until the whole range is mapped
+	for (int i = 0; i <= inode->last_used_extent && size > 0; i++) {
+		off_t extent_bytes = (off_t)inode->i_extent[i].count * A1FS_BLOCK_SIZE;
 
-		// Zero out the current block
-		if (memset(db_addr, '\0', A1FS_BLOCK_SIZE) == NULL) {
-			fprintf(stderr, "zero_out_blocks: memset failed for full block of bytes\n");
-			return -1;
+		// Skip extents that end before the range starts
+		if (offset >= extent_offset + extent_bytes) {
+			extent_offset += extent_bytes;
+			continue;
 		}
 
-		// fprintf(stderr, "\nzero_out_blocks: just zeroed out a block at %d on db index (rel. to 1st db) %d\n", j + fs->sb->sb_first_data_block, j);
-
-		// Update the size of the current extent
-		fs->itable[cur_inode].i_extent[extent_index].size -= A1FS_BLOCK_SIZE;
+		// The part of the range that falls into this extent
+		off_t in_extent = offset - extent_offset;
+		size_t len = extent_bytes - in_extent;
+		if (len > size) {
+			len = size;
+		}
+		off_t pos = ((off_t)fs->sb->sb_first_data_block + inode->i_extent[i].start) * A1FS_BLOCK_SIZE + in_extent;
 
-		*blocks_left_to_zero -= 1;
-	}	
-	return 0;
-}
+		// Extend the previous piece if this extent follows it in the image
+		if (num_segs > 0 && segs[num_segs - 1].pos + (off_t)segs[num_segs - 1].len == pos) {
+			segs[num_segs - 1].len += len;
+		} else {
+			segs[num_segs].pos = pos;
+			segs[num_segs].len = len;
+			num_segs++;
+		}
 
-int find_offset_extent(fs_ctx *fs, int inode_num, int *cur_extent_index, int *cur_indirect_extent_index, int *remainingoffset) {
-	
-	(void) cur_indirect_extent_index;
-	
-	if (*remainingoffset == 0) {
-		return 0;
+		offset += len;
+		size -= len;
+		extent_offset += extent_bytes;
 	}
 
-	while(*remainingoffset > 0){
-
-		// // Case that we must check the indirect extent
-		// if (*cur_extent_index == 12) {
-		// 	*cur_indirect_extent_index += 1;
-			
-		// 	// The relative byte at which represents the current indirect extent
-		// 	int indirect_extent_index_in_bytes = 0;
-		// 	while (*remainingoffset > 0) {
-
-		// 		// Index of the indirect block relative to the first data block
-		// 		int indirect_fdb_index = fs->itable[inode_num].i_extent[12].start;
-
-		// 		// The current indirect extent
-		// 		a1fs_extent * cur_indirect_extent = (a1fs_extent *) fs->image
-		// 							+ fs->sb->sb_first_data_block * A1FS_BLOCK_SIZE
-		// 							+ indirect_fdb_index * A1FS_BLOCK_SIZE
-		// 							+ indirect_extent_index_in_bytes;
-
-		// 		// Decrement <remainingoffset> and start checking the next indirect extent
-		// 		if (cur_indirect_extent->size < *remainingoffset){
-		// 			remainingoffset -= cur_indirect_extent->size;
-
-		// 			cur_indirect_extent_index++;
-		// 			indirect_extent_index_in_bytes += sizeof(a1fs_extent);
-
-		// 		// Break when the indirect extent containing the offset byte is found
-		// 		} else{
-		// 			return 0;
-		// 		}
-		// 	}
-		// 	return -1;
-		// }
-
-		// Decrement <remainingoffset> and start checking the next extent
-		if (fs->itable[inode_num].i_extent[*cur_extent_index].size < *remainingoffset){
-			remainingoffset -= fs->itable[inode_num].i_extent[*cur_extent_index].size;
-			
-			*cur_extent_index += 1;
-		// Break when the extent containing the offset byte is found
-		}else{
-			return 0;
-		}
+	// The extents must cover every byte below the file size
+	if (size > 0) {
+		return -1;
 	}
-	return -1;
+
+	return num_segs;
 }
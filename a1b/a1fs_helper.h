@@ -2,6 +2,8 @@
 
 #include "a1fs.h"
 #include "fs_ctx.h"
+#include "csum.h"
+#include "freecache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,21 +11,32 @@
 #include <error.h>
 #include <time.h>
 #include "util.h"
+#include "zero.h"
+
+/** A piece of a file's byte range that is contiguous in the image. */
+typedef struct a1fs_seg {
+	/** Byte offset of the piece from the start of the image. */
+	off_t pos;
+	/** Length of the piece in bytes. */
+	size_t len;
+} a1fs_seg;
 
 /** 
- * Return the inode number of the given path or -1 if not found.
+ * Return the inode number of the given path or -1 if not found. Inodes are
+ * verified against their checksums on the way (see csum.h).
  * 
  * @param fs_context  pointer to the file system context
  * @param path		  path to file or directory
  * @param tog         function toggle, 1 to find parent and 0 for default
- * @return 			  non-negative number on success, negative number otherwise
+ * @return 			  non-negative number on success, -EIO on a checksum
+ *                    mismatch, other negative number otherwise
 */
 int get_inode_num(fs_ctx *fs_context, const char* path, int tog);
 
 /** 
 *  Return inode number of file or directory under the directory 
 *  given by the inode number and the name <token>  
-*  or -1 if not found. 
+*  or -1 if not found, or -EIO if the directory fails verification. 
 *
 *  @param fs_context  pointer to the file system context
 *  @param par_inode  the inode number of the parent directory
@@ -31,6 +44,36 @@ int get_inode_num(fs_ctx *fs_context, const char* path, int tog);
 */ 
 int inode_lookup(fs_ctx *fs_context, int par_inode, char* token);
 
+/**
+ * Find the directory entry with a given name in a directory.
+ *
+ * @param fs_context  pointer to the file system context
+ * @param dir_inode   the inode number of the directory
+ * @param name        the name to look for
+ * @return            pointer to the entry in the image, or NULL if not found
+ */
+a1fs_dentry *find_dentry(fs_ctx *fs_context, int dir_inode, const char *name);
+
+/**
+ * Remove a directory entry from a directory without touching the inode it
+ * points to. The caller must hold the directory's write section.
+ *
+ * @param fs_context  pointer to the file system context
+ * @param dir_inode   the inode number of the directory
+ * @param dentry      the entry to remove, as returned by find_dentry()
+ */
+void clear_dentry(fs_ctx *fs_context, int dir_inode, a1fs_dentry *dentry);
+
+/** 
+ * Copy an inode without blocking writers. The copy is consistent: it never
+ * mixes fields from before and after a concurrent update.
+ * 
+ * @param fs_context  pointer to the file system context
+ * @param inode_num   inode number of the inode to copy
+ * @param inode       pointer to the inode that receives the copy
+*/
+void inode_snapshot(fs_ctx *fs_context, int inode_num, a1fs_inode *inode);
+
 /** 
  * Initialize newly created or added-on data block(s)
  * 
@@ -102,23 +145,46 @@ int add_dentry(fs_ctx *fs_context, int directory_inode_num, int dentry_inode_num
 int make_data_blocks(fs_ctx *fs_context, int inode_index, int num_blocks);
 
 /** 
- * Handle general extension cases of truncate where the file is empty
- * or when the very last data block of a file is filled.
+ * Extend a file with zeroed data blocks.
  * 
  * @param fs                    pointer to the file system context
- * @param cur_inode             inode number of the inode to truncate
- * @param size                  the size to truncate in bytes
+ * @param cur_inode             inode number of the inode to extend
+ * @param size                  the number of bytes to add, rounded up to whole blocks
  * @return                      0 on success, -1 otherwise
 */
 int truncate_helper(fs_ctx *fs, int cur_inode, off_t size);
 
 /** 
- * Zero out data blocks of some given extent.
+ * Zero out <length> data blocks starting at data block <start>.
+ */
+int zero_out_blocks(fs_ctx *fs, int start, int length);
+
+/**
+ * Initialize the block of the inode table that holds inode <ino>, and the
+ * uninitialized ones before it in its group, if mkfs left them for later.
+ * Must be called when an inode is allocated, before it is written.
+ *
+ * @param fs   pointer to the file system context
+ * @param ino  inode number of the newly allocated inode
  */
-int zero_out_blocks(fs_ctx *fs, int cur_inode, int extent_index, int start, int length, int *blocks_left_to_zero, int leftover_bytes);
+void itable_init(fs_ctx *fs, int ino);
 
 /**
- * Finds the extent that contains the corresponding offset byte specified
- * by a read or a write.
+ * Return the number of data blocks in the extents of the inode.
  */
-int find_offset_extent(fs_ctx *fs, int inode_num, int *cur_extent_index, int *cur_indirect_extent_index, int *remainingoffset);
\ No newline at end of file
+int file_block_count(const a1fs_inode *inode);
+
+/** 
+ * Map a byte range of a file onto the image. The range is clamped to the file
+ * size, and pieces of adjacent extents that are contiguous in the image are
+ * merged, so the result has at most A1FS_MAX_EXTENTS pieces.
+ * 
+ * @param fs                    pointer to the file system context
+ * @param inode                 the file's inode (a copy from inode_snapshot() for readers)
+ * @param offset                offset from the beginning of the file
+ * @param size                  number of bytes in the range
+ * @param segs                  array of at least A1FS_MAX_EXTENTS pieces that receives the result
+ * @return                      the number of pieces on success, -1 if the offset is negative
+ *                              or the extents do not cover the range
+*/
+int map_file_range(fs_ctx *fs, const a1fs_inode *inode, off_t offset, size_t size, a1fs_seg *segs);
\ No newline at end of file
@@ -0,0 +1,602 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs behaviour checks.
+ *
+ * The FUSE callbacks are called directly on a scratch image, without mounting
+ * it, and every image is checked with fsck.a1fs afterwards. A crash is a child
+ * process that mounts the image, makes its changes and exits without
+ * unmounting. Run by "make check", next to mkfs.a1fs and fsck.a1fs.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FUSE_USE_VERSION 29
+#include <fuse.h>
+
+// Outside of fuse_main() there is no FUSE context; a1fs.c gets this one
+static struct fuse_context test_ctx;
+
+static struct fuse_context *test_get_context(void)
+{
+	return &test_ctx;
+}
+
+#define fuse_get_context test_get_context
+#define main a1fs_main
+#include "a1fs.c"
+#undef main
+#undef fuse_get_context
+
+
+/** Scratch image, created in the current directory. */
+#define TEST_IMAGE "a1fs_test.img"
+
+/** Size of the scratch images; large enough to get a journal by default. */
+#define TEST_IMAGE_SIZE (8 << 20)
+
+static int failures;
+
+#define CHECK(cond)                                                           \
+	do {                                                                      \
+		if (!(cond)) {                                                        \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++;                                                       \
+		}                                                                     \
+	} while (0)
+
+static fs_ctx test_fs;
+static a1fs_opts test_opts;
+
+
+/** Create a fresh scratch image and format it with mkfs options <args>. */
+static bool format(const char *args)
+{
+	int fd = open(TEST_IMAGE, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0) {
+		perror(TEST_IMAGE);
+		return false;
+	}
+	bool ok = ftruncate(fd, TEST_IMAGE_SIZE) == 0;
+	close(fd);
+
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "./mkfs.a1fs -f %s " TEST_IMAGE " > /dev/null", args);
+	return ok && (system(cmd) == 0);
+}
+
+/**
+ * Mount the scratch image, as a1fs main() does before fuse_main().
+ *
+ * @param backend  storage backend name; NULL for the default.
+ */
+static bool mount_image(const char *backend)
+{
+	memset(&test_fs, 0, sizeof(test_fs));
+	memset(&test_opts, 0, sizeof(test_opts));
+	test_opts.img_path = TEST_IMAGE;
+	test_opts.backend = backend;
+	if (!a1fs_init(&test_fs, &test_opts)) {
+		return false;
+	}
+	test_ctx.private_data = &test_fs;
+	return true;
+}
+
+static void unmount_image(void)
+{
+	a1fs_ops.destroy(&test_fs);
+}
+
+/** Check that fsck.a1fs finds no problems in the scratch image. */
+static bool image_clean(void)
+{
+	return system("./fsck.a1fs -n " TEST_IMAGE " > /dev/null") == 0;
+}
+
+/**
+ * Run <changes> in a child process that mounts the scratch image and exits
+ * without unmounting, after the kernel wrote back the shared mappings.
+ */
+static bool crash_after(void (*changes)(void))
+{
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return false;
+	}
+	if (pid == 0) {
+		int before = failures;
+		if (!mount_image(NULL)) {
+			_exit(1);
+		}
+		changes();
+		msync(test_fs.image, test_fs.size, MS_SYNC);
+		_exit(failures == before ? 0 : 1);
+	}
+	int status;
+	return (waitpid(pid, &status, 0) == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+/** Check that a file holds exactly len bytes of data. */
+static bool file_is(const char *path, const char *data, size_t len)
+{
+	struct stat st;
+	if ((a1fs_ops.getattr(path, &st) != 0) || ((size_t)st.st_size != len)) {
+		return false;
+	}
+	char buf[len + 1];
+	struct fuse_file_info fi = {0};
+	return (a1fs_ops.read(path, buf, len + 1, 0, &fi) == (int)len) && (memcmp(buf, data, len) == 0);
+}
+
+/** Free a vector returned by read_buf(), the way FUSE does after replying. */
+static void free_bufvec(struct fuse_bufvec *bufv)
+{
+	for (size_t i = 0; i < bufv->count; i++) {
+		free(bufv->buf[i].mem);
+	}
+	free(bufv);
+}
+
+/**
+ * Read through read_buf() and copy the result out, as FUSE does.
+ *
+ * @return  number of bytes read; -errno on error.
+ */
+static ssize_t read_through_buf(const char *path, char *buf, size_t size, off_t offset)
+{
+	struct fuse_file_info fi = {0};
+	struct fuse_bufvec *bufv = NULL;
+	int ret = a1fs_ops.read_buf(path, &bufv, size, offset, &fi);
+	if (ret != 0) {
+		return ret;
+	}
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	dst.buf[0].mem = buf;
+	ssize_t copied = fuse_buf_copy(&dst, bufv, 0);
+	free_bufvec(bufv);
+	return copied;
+}
+
+/** Write from memory through write_buf(). */
+static int write_through_buf(const char *path, const char *data, size_t size, off_t offset)
+{
+	struct fuse_file_info fi = {0};
+	struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+	src.buf[0].mem = (void *)data;
+	return a1fs_ops.write_buf(path, &src, offset, &fi);
+}
+
+/** Write through write_buf() from a pipe, as FUSE does when it splices. */
+static int write_through_pipe(const char *path, const char *data, size_t size, off_t offset)
+{
+	int fds[2];
+	if (pipe(fds) != 0) {
+		return -errno;
+	}
+	int ret = -EIO;
+	if (write(fds[1], data, size) == (ssize_t)size) {
+		struct fuse_file_info fi = {0};
+		struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+		src.buf[0].flags = FUSE_BUF_IS_FD;
+		src.buf[0].fd = fds[0];
+		ret = a1fs_ops.write_buf(path, &src, offset, &fi);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	return ret;
+}
+
+/** Create a file that holds len bytes of data. */
+static bool make_file(const char *path, const char *data, size_t len)
+{
+	struct fuse_file_info fi = {0};
+	return (a1fs_ops.create(path, S_IFREG | 0644, &fi) == 0) &&
+	       (a1fs_ops.write(path, data, len, 0, &fi) == (int)len);
+}
+
+/** Issue A1FS_IOC_COPY_RANGE on <dst>. */
+static int copy(const char *dst, const char *src, uint64_t src_off, uint64_t dst_off,
+                uint64_t len)
+{
+	static a1fs_copy_range req;
+	strcpy(req.src_path, src);
+	req.src_off = src_off;
+	req.dst_off = dst_off;
+	req.len = len;
+	struct fuse_file_info fi = {0};
+	return a1fs_ops.ioctl(dst, A1FS_IOC_COPY_RANGE, NULL, &fi, 0, &req);
+}
+
+/** rename() with RENAME_EXCHANGE, which FUSE 2.9 has no callback for. */
+static int exchange(const char *from, const char *to)
+{
+	journal_begin(&test_fs);
+	int ret = rename_dentry(&test_fs, from, to, RENAME_EXCHANGE);
+	journal_end(&test_fs);
+	return ret;
+}
+
+
+static void test_read_write(void)
+{
+	static const char *backends[] = { "mmap", "pread", "direct" };
+	static char data[3 * A1FS_BLOCK_SIZE + 1000], buf[sizeof(data) + 100];
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = 'a' + i % 26;
+	}
+
+	for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+		int before = failures;
+		if (!format("") || !mount_image(backends[b])) {
+			fprintf(stderr, "backend %s:\n", backends[b]);
+			CHECK(!"can't set up the image");
+			continue;
+		}
+
+		// Two files written in turn, so that their extents interleave
+		struct fuse_file_info fi = {0};
+		CHECK(a1fs_ops.create("/f", S_IFREG | 0644, &fi) == 0);
+		CHECK(a1fs_ops.create("/g", S_IFREG | 0644, &fi) == 0);
+		for (size_t off = 0; off < sizeof(data); off += 5000) {
+			size_t len = sizeof(data) - off < 5000 ? sizeof(data) - off : 5000;
+			CHECK(write_through_buf("/f", data + off, len, off) == (int)len);
+			CHECK(a1fs_ops.write("/g", data + off, len, off, &fi) == (int)len);
+		}
+
+		// Whole files, a range across extents, and at and past EOF
+		memset(buf, 0, sizeof(buf));
+		CHECK(read_through_buf("/f", buf, sizeof(buf), 0) == sizeof(data));
+		CHECK(memcmp(buf, data, sizeof(data)) == 0);
+		CHECK(read_through_buf("/g", buf, 6000, 3000) == 6000);
+		CHECK(memcmp(buf, data + 3000, 6000) == 0);
+		CHECK(read_through_buf("/g", buf, 100, sizeof(data)) == 0);
+		CHECK(read_through_buf("/g", buf, 100, sizeof(data) + 100) == 0);
+		CHECK(file_is("/f", data, sizeof(data)) && file_is("/g", data, sizeof(data)));
+
+		// Overwriting in place, and leaving a zeroed hole past EOF
+		CHECK(write_through_buf("/g", "XYZ", 3, 4095) == 3);
+		CHECK(write_through_buf("/g", "end", 3, sizeof(data) + 5000) == 3);
+		CHECK(read_through_buf("/g", buf, sizeof(buf), 4094) == (ssize_t)sizeof(buf));
+		CHECK((buf[0] == data[4094]) && (memcmp(buf + 1, "XYZ", 3) == 0) && (buf[4] == data[4098]));
+		CHECK(read_through_buf("/g", buf, 5003, sizeof(data)) == 5003);
+		bool zero = true;
+		for (size_t i = 0; i < 5000; i++) {
+			zero = zero && (buf[i] == 0);
+		}
+		CHECK(zero && (memcmp(buf + 5000, "end", 3) == 0));
+
+		// The data is still there after a remount
+		unmount_image();
+		if (!mount_image(backends[b])) {
+			CHECK(!"can't mount the image again");
+			continue;
+		}
+		CHECK(read_through_buf("/f", buf, sizeof(buf), 0) == sizeof(data));
+		CHECK(memcmp(buf, data, sizeof(data)) == 0);
+		unmount_image();
+		CHECK(image_clean());
+
+		if (failures != before) {
+			fprintf(stderr, "backend %s failed\n", backends[b]);
+		}
+	}
+}
+
+static void test_splice(void)
+{
+	if (!format("") || !mount_image("mmap")) {
+		CHECK(!"can't set up the image");
+		return;
+	}
+
+	// Splicing is asked for where the kernel supports it
+	struct fuse_conn_info conn = {0};
+	conn.capable = ~0u;
+	CHECK(a1fs_ops.init(&conn) == &test_fs);
+	CHECK((conn.want & FUSE_CAP_SPLICE_WRITE) && (conn.want & FUSE_CAP_SPLICE_MOVE) &&
+	      (conn.want & FUSE_CAP_SPLICE_READ));
+
+	// What FUSE splices from: the pieces of the image file holding the data
+	static char data[2 * A1FS_BLOCK_SIZE];
+	memset(data, 's', sizeof(data));
+	struct fuse_file_info fi = {0};
+	CHECK(a1fs_ops.create("/f", S_IFREG | 0644, &fi) == 0);
+	CHECK(write_through_buf("/f", data, sizeof(data), 0) == sizeof(data));
+	struct fuse_bufvec *bufv = NULL;
+	CHECK(a1fs_ops.read_buf("/f", &bufv, sizeof(data), 0, &fi) == 0);
+	if (bufv != NULL) {
+		size_t total = 0;
+		for (size_t i = 0; i < bufv->count; i++) {
+			CHECK((bufv->buf[i].flags & FUSE_BUF_IS_FD) && (bufv->buf[i].fd == test_fs.fd));
+			total += bufv->buf[i].size;
+		}
+		CHECK(total == sizeof(data));
+		free_bufvec(bufv);
+	}
+
+	// Request data FUSE spliced into a pipe goes on into the image
+	memset(data, 'p', sizeof(data));
+	CHECK(write_through_pipe("/f", data, sizeof(data), 1000) == sizeof(data));
+	static char expect[sizeof(data) + 1000];
+	memset(expect, 's', 1000);
+	memcpy(expect + 1000, data, sizeof(data));
+	CHECK(file_is("/f", expect, sizeof(expect)));
+
+	// and only there; the pread backend takes spliced data too
+	unmount_image();
+	if (!mount_image("pread")) {
+		CHECK(!"can't mount the image again");
+		return;
+	}
+	conn = (struct fuse_conn_info){ .capable = FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_READ };
+	CHECK(a1fs_ops.init(&conn) == &test_fs);
+	CHECK(conn.want == (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_READ));
+	CHECK(write_through_pipe("/f", "pipe", 4, 0) == 4);
+	memcpy(expect, "pipe", 4);
+	CHECK(file_is("/f", expect, sizeof(expect)));
+
+	unmount_image();
+	CHECK(image_clean());
+}
+
+static void test_copy_range(void)
+{
+	if (!format("") || !mount_image(NULL)) {
+		CHECK(!"can't set up the image");
+		return;
+	}
+
+	static char data[20000];
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = 'a' + i % 26;
+	}
+	CHECK(make_file("/src", data, sizeof(data)));
+	CHECK(make_file("/dst", "", 0));
+	CHECK(a1fs_ops.mkdir("/dir", 0755) == 0);
+
+	// Only what the source has is copied, and the destination is extended
+	CHECK(copy("/dst", "/src", 100, 3000, 100000) == sizeof(data) - 100);
+	static char expect[3000 + sizeof(data) - 100];
+	memcpy(expect + 3000, data + 100, sizeof(data) - 100);
+	CHECK(file_is("/dst", expect, sizeof(expect)));
+	CHECK(copy("/dst", "/src", sizeof(data), 0, 10) == 0);
+	CHECK(copy("/src", "/src", 0, 10000, 5000) == 5000);
+	memcpy(data + 10000, data, 5000);
+	CHECK(file_is("/src", data, sizeof(data)));
+
+	// Bad offsets, overlapping ranges and the wrong kinds of files
+	CHECK(copy("/dst", "/src", UINT64_MAX, 0, 10) == -EINVAL);
+	CHECK(copy("/dst", "/src", 0, UINT64_MAX, 10) == -EINVAL);
+	CHECK(copy("/dst", "/src", INT64_MAX, 0, 1) == -EINVAL);
+	CHECK(copy("/dst", "/src", 0, (uint64_t)INT64_MAX - 5, 10) == -EINVAL);
+	CHECK(copy("/src", "/src", 0, 100, 200) == -EINVAL);
+	CHECK(copy("/dst", "/missing", 0, 0, 10) == -ENOENT);
+	CHECK(copy("/dst", "/dir", 0, 0, 10) == -EISDIR);
+	CHECK(copy("/dir", "/src", 0, 0, 10) == -EISDIR);
+	CHECK(file_is("/dst", expect, sizeof(expect)));
+
+	unmount_image();
+	CHECK(image_clean());
+}
+
+static void test_rename(void)
+{
+	if (!format("") || !mount_image(NULL)) {
+		CHECK(!"can't set up the image");
+		return;
+	}
+	struct stat st;
+	struct statvfs sv;
+
+	CHECK(a1fs_ops.mkdir("/a", 0755) == 0);
+	CHECK(a1fs_ops.mkdir("/b", 0755) == 0);
+	CHECK(make_file("/a/x", "hello", 5));
+	CHECK(make_file("/b/y", "abc", 3));
+
+	// Moving within and across directories
+	CHECK(a1fs_ops.rename("/a/x", "/a/z") == 0);
+	CHECK((a1fs_ops.getattr("/a/x", &st) == -ENOENT) && file_is("/a/z", "hello", 5));
+	CHECK(a1fs_ops.rename("/a/z", "/b/x") == 0);
+	CHECK((a1fs_ops.getattr("/a/z", &st) == -ENOENT) && file_is("/b/x", "hello", 5));
+
+	// Replacing a file frees the old one
+	a1fs_ops.statfs("/", &sv);
+	fsfilcnt_t ffree = sv.f_ffree;
+	CHECK(a1fs_ops.rename("/b/y", "/b/x") == 0);
+	CHECK((a1fs_ops.getattr("/b/y", &st) == -ENOENT) && file_is("/b/x", "abc", 3));
+	a1fs_ops.statfs("/", &sv);
+	CHECK(sv.f_ffree == ffree + 1);
+
+	// Replacing a directory only if it is empty, and only with a directory
+	CHECK(a1fs_ops.mkdir("/c", 0755) == 0);
+	CHECK(a1fs_ops.rename("/b/x", "/c") == -EISDIR);
+	CHECK(a1fs_ops.rename("/c", "/b/x") == -ENOTDIR);
+	CHECK(a1fs_ops.rename("/a", "/b") == -ENOTEMPTY);
+	CHECK(a1fs_ops.rename("/a", "/c") == 0);
+	CHECK((a1fs_ops.getattr("/a", &st) == -ENOENT) && (a1fs_ops.getattr("/c", &st) == 0));
+
+	// Swapping two files, and a file with a directory
+	CHECK(make_file("/c/w", "world", 5));
+	CHECK(exchange("/c/w", "/b/x") == 0);
+	CHECK(file_is("/c/w", "abc", 3) && file_is("/b/x", "world", 5));
+	CHECK(a1fs_ops.mkdir("/b/d", 0755) == 0);
+	CHECK(exchange("/b/d", "/c/w") == 0);
+	CHECK((a1fs_ops.getattr("/b/d", &st) == 0) && S_ISREG(st.st_mode));
+	CHECK((a1fs_ops.getattr("/c/w", &st) == 0) && S_ISDIR(st.st_mode));
+	CHECK(exchange("/c/w", "/c/nothing") == -ENOENT);
+
+	// A directory can't end up inside itself, whichever side it is on
+	CHECK(a1fs_ops.mkdir("/c/w/sub", 0755) == 0);
+	CHECK(a1fs_ops.rename("/c", "/c/w/sub/c") == -EINVAL);
+	CHECK(exchange("/c", "/c/w/sub") == -EINVAL);
+	CHECK(exchange("/c/w/sub", "/c") == -EINVAL);
+	CHECK((a1fs_ops.getattr("/c/w/sub", &st) == 0) && S_ISDIR(st.st_mode));
+
+	unmount_image();
+	CHECK(image_clean());
+}
+
+static void test_fsync(void)
+{
+	if (!format("") || !mount_image(NULL)) {
+		CHECK(!"can't set up the image");
+		return;
+	}
+
+	struct fuse_file_info fi = {0};
+	CHECK(make_file("/f", "synced", 6));
+	CHECK(a1fs_ops.fsync("/f", 1, &fi) == 0);
+	CHECK(a1fs_ops.fsync("/f", 0, &fi) == 0);
+	CHECK(a1fs_ops.fsync("/missing", 0, &fi) == -ENOENT);
+
+	// The new inode is committed to the journal
+	a1fs_journal_header hdr;
+	off_t pos = (off_t)test_fs.sb->sb_journal_start * A1FS_BLOCK_SIZE;
+	CHECK(pread(test_fs.fd, &hdr, sizeof(hdr), pos) == sizeof(hdr));
+	CHECK((hdr.magic == A1FS_JOURNAL_MAGIC) && !hdr.clean);
+
+	unmount_image();
+	CHECK(image_clean());
+}
+
+static void make_synced_files(void)
+{
+	struct fuse_file_info fi = {0};
+	CHECK(a1fs_ops.mkdir("/d", 0755) == 0);
+	CHECK(make_file("/d/f", "replayed", 8));
+	CHECK(a1fs_ops.fsync("/d/f", 0, &fi) == 0);
+}
+
+static void test_journal_replay(void)
+{
+	if (!format("")) {
+		CHECK(!"can't set up the image");
+		return;
+	}
+
+	// Keep the metadata region as mkfs left it
+	int fd = open(TEST_IMAGE, O_RDWR);
+	a1fs_superblock sb;
+	CHECK((fd >= 0) && (pread(fd, &sb, sizeof(sb), 0) == sizeof(sb)));
+	CHECK(sb.sb_journal_blocks > 0);
+	size_t meta_len = (size_t)sb.sb_journal_start * A1FS_BLOCK_SIZE;
+	unsigned char *meta = malloc(meta_len);
+	CHECK((meta != NULL) && (pread(fd, meta, meta_len, 0) == (ssize_t)meta_len));
+
+	CHECK(crash_after(make_synced_files));
+
+	// None of the in-place metadata writes reached the disk, only the journal
+	CHECK(pwrite(fd, meta, meta_len, 0) == (ssize_t)meta_len);
+	free(meta);
+	close(fd);
+
+	if (!mount_image(NULL)) {
+		CHECK(!"can't mount after the crash");
+		return;
+	}
+	struct stat st;
+	CHECK((a1fs_ops.getattr("/d", &st) == 0) && S_ISDIR(st.st_mode));
+	CHECK(file_is("/d/f", "replayed", 8));
+	unmount_image();
+	CHECK(image_clean());
+}
+
+static void make_unsynced_files(void)
+{
+	CHECK(a1fs_ops.mkdir("/d", 0755) == 0);
+	CHECK(make_file("/d/f", "unjournaled", 11));
+	CHECK(a1fs_ops.mkdir("/e", 0755) == 0);
+	CHECK(a1fs_ops.rmdir("/e") == 0);
+}
+
+static void test_unjournaled_crash(void)
+{
+	if (!format("-j 0")) {
+		CHECK(!"can't set up the image");
+		return;
+	}
+	CHECK(crash_after(make_unsynced_files));
+
+	if (!mount_image(NULL)) {
+		CHECK(!"can't mount after the crash");
+		return;
+	}
+	CHECK(file_is("/d/f", "unjournaled", 11));
+	CHECK(make_file("/g", "more", 4));
+	unmount_image();
+	CHECK(image_clean());
+}
+
+static void rename_unsynced(void)
+{
+	// Only the directory block reaches the image, ahead of any commit
+	CHECK(a1fs_ops.rename("/f", "/g") == 0);
+}
+
+static void test_dir_block_crash(void)
+{
+	if (!format("") || !mount_image(NULL)) {
+		CHECK(!"can't set up the image");
+		return;
+	}
+	CHECK(make_file("/f", "renamed", 7));
+	unmount_image();
+	CHECK(crash_after(rename_unsynced));
+
+	if (!mount_image(NULL)) {
+		CHECK(!"can't mount after the crash");
+		return;
+	}
+	struct stat st;
+	CHECK(a1fs_ops.getattr("/f", &st) == -ENOENT);
+	CHECK(file_is("/g", "renamed", 7));
+	unmount_image();
+	CHECK(image_clean());
+}
+
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		void (*run)(void);
+	} tests[] = {
+		{ "read_write"       , test_read_write        },
+		{ "splice"           , test_splice            },
+		{ "copy_range"       , test_copy_range        },
+		{ "rename"           , test_rename            },
+		{ "fsync"            , test_fsync             },
+		{ "journal_replay"   , test_journal_replay    },
+		{ "unjournaled_crash", test_unjournaled_crash },
+		{ "dir_block_crash"  , test_dir_block_crash   },
+	};
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		int before = failures;
+		tests[i].run();
+		printf("%-20s %s\n", tests[i].name, failures == before ? "ok" : "FAILED");
+	}
+	unlink(TEST_IMAGE);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Storage backend selection and the mmap backend.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+
+static bool mmap_init(fs_ctx *fs)
+{
+	(void)fs;// unused
+	return true;
+}
+
+static void mmap_destroy(fs_ctx *fs)
+{
+	(void)fs;// unused
+}
+
+static int mmap_read(fs_ctx *fs, void *buf, size_t len, off_t pos)
+{
+	memcpy(buf, fs->image + pos, len);
+	return 0;
+}
+
+static int mmap_write(fs_ctx *fs, const void *buf, size_t len, off_t pos)
+{
+	memcpy(fs->image + pos, buf, len);
+	return 0;
+}
+
+static int mmap_flush(fs_ctx *fs)
+{
+	(void)fs;// unused
+	return 0;
+}
+
+static void mmap_prefetch(fs_ctx *fs, off_t pos, size_t len)
+{
+	// madvise() needs a page aligned address
+	off_t page = sysconf(_SC_PAGESIZE);
+	off_t start = pos - pos % page;
+	madvise(fs->image + start, len + (pos - start), MADV_WILLNEED);
+}
+
+void backend_fadvise_prefetch(fs_ctx *fs, off_t pos, size_t len)
+{
+	posix_fadvise(fs->fd, pos, len, POSIX_FADV_WILLNEED);
+}
+
+const a1fs_backend mmap_backend = {
+	.name       = "mmap",
+	.zero_copy  = true,
+	.init       = mmap_init,
+	.destroy    = mmap_destroy,
+	.read       = mmap_read,
+	.write      = mmap_write,
+	.read_segs  = NULL,
+	.write_segs = NULL,
+	.flush      = mmap_flush,
+	.prefetch   = mmap_prefetch,
+	.sync_range = NULL,
+	.drop_range = NULL,
+};
+
+
+/** All backends; the first one is the default. */
+static const a1fs_backend *backends[] = {
+	&mmap_backend,
+	&pread_backend,
+	&direct_backend,
+#ifdef A1FS_URING
+	&uring_backend,
+#endif
+};
+
+const a1fs_backend *backend_find(const char *name)
+{
+	if (name == NULL) {
+		return backends[0];
+	}
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (strcmp(backends[i]->name, name) == 0) {
+			return backends[i];
+		}
+	}
+	return NULL;
+}
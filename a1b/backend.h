@@ -0,0 +1,161 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Storage backend header file.
+ *
+ * File data is read and written through a storage backend, selected with the
+ * backend=NAME mount option. Metadata (superblock, bitmaps, inode table) and
+ * directory blocks are always accessed through the image mapping.
+ *
+ * Positions are byte offsets from the start of the image, as in a1fs_seg.
+ *
+ * Code that changes file data through the mapping instead of the backend must
+ * call backend_sync() on the range first, so that the backend writes back and
+ * forgets what it cached there. Freed data blocks must be passed to
+ * backend_drop() so that nothing cached for them is written back later.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "a1fs_helper.h"
+#include "fs_ctx.h"
+
+
+/** Storage backend operations. */
+typedef struct a1fs_backend {
+	/** Name used in the backend mount option. */
+	const char *name;
+	/** Data can be spliced straight from and to the image file descriptor. */
+	bool zero_copy;
+
+	/** Set up the backend for a mounted image; false on failure. */
+	bool (*init)(fs_ctx *fs);
+	/** Write back everything and release the backend's resources. */
+	void (*destroy)(fs_ctx *fs);
+
+	/** Read len bytes at image position pos; 0 on success, -errno on error. */
+	int (*read)(fs_ctx *fs, void *buf, size_t len, off_t pos);
+	/** Write len bytes at image position pos; 0 on success, -errno on error. */
+	int (*write)(fs_ctx *fs, const void *buf, size_t len, off_t pos);
+	/**
+	 * Read consecutive buffer pieces from a list of image ranges at once;
+	 * 0 on success, -errno on error. NULL to read the ranges one by one.
+	 */
+	int (*read_segs)(fs_ctx *fs, void *buf, const a1fs_seg *segs, int num_segs);
+	/** Write a list of image ranges at once; NULL to write them one by one. */
+	int (*write_segs)(fs_ctx *fs, const void *buf, const a1fs_seg *segs, int num_segs);
+	/** Write back all modified data; 0 on success, -errno on error. */
+	int (*flush)(fs_ctx *fs);
+
+	/** Hint that a range will be read soon; NULL to ignore hints. */
+	void (*prefetch)(fs_ctx *fs, off_t pos, size_t len);
+	/** Write back and forget cached data in a range; NULL if nothing cached. */
+	void (*sync_range)(fs_ctx *fs, off_t pos, size_t len);
+	/** Forget cached data in a range without writing it; NULL if nothing cached. */
+	void (*drop_range)(fs_ctx *fs, off_t pos, size_t len);
+
+} a1fs_backend;
+
+/** Reads and writes go straight to the image mapping. */
+extern const a1fs_backend mmap_backend;
+/** pread()/pwrite() on the image file with a bounded block cache. */
+extern const a1fs_backend pread_backend;
+/** O_DIRECT I/O on the image file, bypassing the page cache. */
+extern const a1fs_backend direct_backend;
+#ifdef A1FS_URING
+/** Batched asynchronous I/O on the image file with io_uring. */
+extern const a1fs_backend uring_backend;
+#endif
+
+
+/** Prefetch through the page cache of the image file descriptor. */
+void backend_fadvise_prefetch(fs_ctx *fs, off_t pos, size_t len);
+
+/**
+ * Find a backend by name.
+ *
+ * @param name  backend name; NULL for the default.
+ * @return      the backend; NULL if there is none with that name.
+ */
+const a1fs_backend *backend_find(const char *name);
+
+/** Read file data through the backend. */
+static inline int backend_read(fs_ctx *fs, void *buf, size_t len, off_t pos)
+{
+	return fs->backend->read(fs, buf, len, pos);
+}
+
+/** Write file data through the backend. */
+static inline int backend_write(fs_ctx *fs, const void *buf, size_t len, off_t pos)
+{
+	return fs->backend->write(fs, buf, len, pos);
+}
+
+/** Read the pieces of a file range, in order, into buf. */
+static inline int backend_read_segs(fs_ctx *fs, void *buf, const a1fs_seg *segs, int num_segs)
+{
+	if (fs->backend->read_segs != NULL) {
+		return fs->backend->read_segs(fs, buf, segs, num_segs);
+	}
+	for (int i = 0; i < num_segs; i++) {
+		int ret = fs->backend->read(fs, buf, segs[i].len, segs[i].pos);
+		if (ret != 0) return ret;
+		buf += segs[i].len;
+	}
+	return 0;
+}
+
+/** Write buf, in order, to the pieces of a file range. */
+static inline int backend_write_segs(fs_ctx *fs, const void *buf, const a1fs_seg *segs, int num_segs)
+{
+	if (fs->backend->write_segs != NULL) {
+		return fs->backend->write_segs(fs, buf, segs, num_segs);
+	}
+	for (int i = 0; i < num_segs; i++) {
+		int ret = fs->backend->write(fs, buf, segs[i].len, segs[i].pos);
+		if (ret != 0) return ret;
+		buf += segs[i].len;
+	}
+	return 0;
+}
+
+/** Start reading a range of the image that is about to be needed. */
+static inline void backend_prefetch(fs_ctx *fs, off_t pos, size_t len)
+{
+	if (fs->backend->prefetch != NULL) {
+		fs->backend->prefetch(fs, pos, len);
+	}
+}
+
+/** Prepare a range of the image to be changed through the mapping. */
+static inline void backend_sync(fs_ctx *fs, off_t pos, size_t len)
+{
+	if (fs->backend->sync_range != NULL) {
+		fs->backend->sync_range(fs, pos, len);
+	}
+}
+
+/** Forget cached data of freed data blocks. */
+static inline void backend_drop(fs_ctx *fs, int start, int count)
+{
+	if (fs->backend->drop_range != NULL) {
+		fs->backend->drop_range(fs,
+			(off_t)(fs->sb->sb_first_data_block + start) * A1FS_BLOCK_SIZE,
+			(size_t)count * A1FS_BLOCK_SIZE);
+	}
+}
@@ -0,0 +1,439 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - pread/pwrite backend with a block cache.
+ *
+ * File data blocks are cached in a fixed amount of memory (cache_size mount
+ * option), split into shards with a lock each so that background threads
+ * dropping freed blocks don't serialize with reads and writes. Consecutive
+ * image blocks are grouped into runs of BCACHE_RUN that go to the same shard,
+ * so that they can be written back together. Each shard evicts with the clock
+ * algorithm. Modified blocks are written back in batches, sorted by position
+ * and with runs of consecutive blocks written by a single pwritev(): whenever
+ * half of a shard is dirty, when a dirty block has to be evicted, and on
+ * flush. I/O errors are returned as EIO instead of the SIGBUS
+ * a failed access to the mapping would raise.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+
+/** Number of cache shards. */
+#define BCACHE_SHARDS 16
+
+/** Number of consecutive image blocks that map to the same shard. */
+#define BCACHE_RUN 64
+
+/** Default cache size in MiB. */
+#define BCACHE_DEFAULT_MB 64
+
+
+/** Cached block. */
+typedef struct bc_entry {
+	/** Image block number; -1 if the entry is empty. */
+	int64_t block;
+	/** Next entry in the same hash bucket; -1 at the end. */
+	int next;
+	/** Used since the clock hand last passed. */
+	bool ref;
+	/** Modified since it was read or written back. */
+	bool dirty;
+} bc_entry;
+
+/** Independently locked part of the cache. */
+typedef struct bc_shard {
+	pthread_mutex_t lock;
+	/** Number of entries (and buckets). */
+	int nentries;
+	/** First entry of each hash bucket; -1 if empty. */
+	int *buckets;
+	bc_entry *entries;
+	/** Block data, A1FS_BLOCK_SIZE bytes per entry. */
+	unsigned char *data;
+	/** Clock hand. */
+	int hand;
+	/** Number of dirty entries. */
+	int ndirty;
+} bc_shard;
+
+/** The whole cache. */
+typedef struct bcache {
+	bc_shard shards[BCACHE_SHARDS];
+} bcache;
+
+
+static bc_shard *shard_of(fs_ctx *fs, int64_t block)
+{
+	return &((bcache*)fs->backend_data)->shards[(block / BCACHE_RUN) % BCACHE_SHARDS];
+}
+
+static int bucket_of(bc_shard *sh, int64_t block)
+{
+	return block % sh->nentries;
+}
+
+static unsigned char *slot_data(bc_shard *sh, int slot)
+{
+	return sh->data + (size_t)slot * A1FS_BLOCK_SIZE;
+}
+
+/** Find the entry caching a block; -1 if not cached. */
+static int lookup(bc_shard *sh, int64_t block)
+{
+	for (int i = sh->buckets[bucket_of(sh, block)]; i >= 0; i = sh->entries[i].next) {
+		if (sh->entries[i].block == block) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** Make an entry empty, discarding its data. */
+static void forget(bc_shard *sh, int slot)
+{
+	bc_entry *e = &sh->entries[slot];
+	int *link = &sh->buckets[bucket_of(sh, e->block)];
+	while (*link != slot) {
+		link = &sh->entries[*link].next;
+	}
+	*link = e->next;
+
+	if (e->dirty) {
+		sh->ndirty--;
+	}
+	e->block = -1;
+	e->next = -1;
+	e->ref = false;
+	e->dirty = false;
+}
+
+static int cmp_by_block(const void *a, const void *b, void *arg)
+{
+	bc_entry *entries = arg;
+	int64_t x = entries[*(const int*)a].block, y = entries[*(const int*)b].block;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Write back all dirty entries of a shard, merging consecutive blocks into
+ * single writes. The caller holds the shard's lock.
+ *
+ * @return  0 on success; -EIO on error (the entries that failed stay dirty).
+ */
+static int writeback(fs_ctx *fs, bc_shard *sh)
+{
+	if (sh->ndirty == 0) {
+		return 0;
+	}
+
+	int *dirty = malloc(sh->ndirty * sizeof(int));
+	if (dirty == NULL) {
+		return -ENOMEM;
+	}
+	int n = 0;
+	for (int i = 0; i < sh->nentries; i++) {
+		if (sh->entries[i].dirty) {
+			dirty[n++] = i;
+		}
+	}
+	qsort_r(dirty, n, sizeof(int), cmp_by_block, sh->entries);
+
+	// Write each run of adjacent blocks with a single call
+	int ret = 0;
+	struct iovec iov[BCACHE_RUN];
+	for (int i = 0; i < n; ) {
+		int run = 0;
+		int64_t first = sh->entries[dirty[i]].block;
+		while ((i + run < n) && (run < (int)(sizeof(iov) / sizeof(iov[0]))) &&
+		       (sh->entries[dirty[i + run]].block == first + run))
+		{
+			iov[run].iov_base = slot_data(sh, dirty[i + run]);
+			iov[run].iov_len = A1FS_BLOCK_SIZE;
+			run++;
+		}
+
+		ssize_t len = (ssize_t)run * A1FS_BLOCK_SIZE;
+		if (pwritev(fs->fd, iov, run, first * A1FS_BLOCK_SIZE) != len) {
+			perror("a1fs: pread backend: pwritev");
+			ret = -EIO;
+		} else {
+			for (int j = 0; j < run; j++) {
+				sh->entries[dirty[i + j]].dirty = false;
+			}
+			sh->ndirty -= run;
+		}
+		i += run;
+	}
+
+	free(dirty);
+	return ret;
+}
+
+/**
+ * Get the entry for a block, evicting another block with the clock algorithm
+ * if it is not cached. The caller holds the shard's lock.
+ *
+ * @param fill  read the block from the image if it is not cached; can be
+ *              false if the caller overwrites the whole block.
+ * @return      entry index; -errno on error.
+ */
+static int get_entry(fs_ctx *fs, bc_shard *sh, int64_t block, bool fill)
+{
+	int slot = lookup(sh, block);
+	if (slot >= 0) {
+		sh->entries[slot].ref = true;
+		return slot;
+	}
+
+	// Advance the hand past recently used entries
+	while (sh->entries[sh->hand].ref) {
+		sh->entries[sh->hand].ref = false;
+		sh->hand = (sh->hand + 1) % sh->nentries;
+	}
+	slot = sh->hand;
+	sh->hand = (sh->hand + 1) % sh->nentries;
+
+	bc_entry *e = &sh->entries[slot];
+	if (e->dirty) {
+		// Write back the whole shard while at it
+		int ret = writeback(fs, sh);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	if (e->block >= 0) {
+		forget(sh, slot);
+	}
+
+	if (fill && (pread(fs->fd, slot_data(sh, slot), A1FS_BLOCK_SIZE, block * A1FS_BLOCK_SIZE) != A1FS_BLOCK_SIZE)) {
+		perror("a1fs: pread backend: pread");
+		return -EIO;
+	}
+
+	int b = bucket_of(sh, block);
+	e->block = block;
+	e->next = sh->buckets[b];
+	e->ref = true;
+	sh->buckets[b] = slot;
+	return slot;
+}
+
+static int bcache_read(fs_ctx *fs, void *buf, size_t len, off_t pos)
+{
+	while (len > 0) {
+		int64_t block = pos / A1FS_BLOCK_SIZE;
+		size_t off = pos % A1FS_BLOCK_SIZE;
+		size_t n = A1FS_BLOCK_SIZE - off < len ? A1FS_BLOCK_SIZE - off : len;
+
+		bc_shard *sh = shard_of(fs, block);
+		pthread_mutex_lock(&sh->lock);
+		int slot = get_entry(fs, sh, block, true);
+		if (slot < 0) {
+			pthread_mutex_unlock(&sh->lock);
+			return slot;
+		}
+		memcpy(buf, slot_data(sh, slot) + off, n);
+		pthread_mutex_unlock(&sh->lock);
+
+		buf = (unsigned char*)buf + n;
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int bcache_write(fs_ctx *fs, const void *buf, size_t len, off_t pos)
+{
+	while (len > 0) {
+		int64_t block = pos / A1FS_BLOCK_SIZE;
+		size_t off = pos % A1FS_BLOCK_SIZE;
+		size_t n = A1FS_BLOCK_SIZE - off < len ? A1FS_BLOCK_SIZE - off : len;
+
+		bc_shard *sh = shard_of(fs, block);
+		pthread_mutex_lock(&sh->lock);
+		int slot = get_entry(fs, sh, block, n < A1FS_BLOCK_SIZE);
+		if (slot < 0) {
+			pthread_mutex_unlock(&sh->lock);
+			return slot;
+		}
+		memcpy(slot_data(sh, slot) + off, buf, n);
+		if (!sh->entries[slot].dirty) {
+			sh->entries[slot].dirty = true;
+			sh->ndirty++;
+		}
+
+		// Don't let dirty data pile up
+		int ret = 0;
+		if (sh->ndirty > sh->nentries / 2) {
+			ret = writeback(fs, sh);
+		}
+		pthread_mutex_unlock(&sh->lock);
+		if (ret != 0) {
+			return ret;
+		}
+
+		buf = (const unsigned char*)buf + n;
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int bcache_flush(fs_ctx *fs)
+{
+	int ret = 0;
+	for (int i = 0; i < BCACHE_SHARDS; i++) {
+		bc_shard *sh = &((bcache*)fs->backend_data)->shards[i];
+		pthread_mutex_lock(&sh->lock);
+		if (writeback(fs, sh) != 0) {
+			ret = -EIO;
+		}
+		pthread_mutex_unlock(&sh->lock);
+	}
+	return ret;
+}
+
+/** Forget a cached block, writing it back first if asked to and dirty. */
+static void forget_block(fs_ctx *fs, bc_shard *sh, int slot, bool write)
+{
+	bc_entry *e = &sh->entries[slot];
+	if (write && e->dirty &&
+	    (pwrite(fs->fd, slot_data(sh, slot), A1FS_BLOCK_SIZE, e->block * A1FS_BLOCK_SIZE) != A1FS_BLOCK_SIZE))
+	{
+		perror("a1fs: pread backend: pwrite");
+	}
+	forget(sh, slot);
+}
+
+/** Forget the cached blocks in a range, writing back dirty ones if asked to. */
+static void forget_range(fs_ctx *fs, off_t pos, size_t len, bool write)
+{
+	bcache *bc = fs->backend_data;
+	int64_t first = pos / A1FS_BLOCK_SIZE;
+	int64_t end = (pos + len + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+
+	// Look up each block of a small range
+	if (end - first <= bc->shards[0].nentries) {
+		for (int64_t b = first; b < end; b++) {
+			bc_shard *sh = shard_of(fs, b);
+			pthread_mutex_lock(&sh->lock);
+			int slot = lookup(sh, b);
+			if (slot >= 0) {
+				forget_block(fs, sh, slot, write);
+			}
+			pthread_mutex_unlock(&sh->lock);
+		}
+		return;
+	}
+
+	// Scan the whole cache for a large one
+	for (int i = 0; i < BCACHE_SHARDS; i++) {
+		bc_shard *sh = &bc->shards[i];
+		pthread_mutex_lock(&sh->lock);
+		for (int slot = 0; slot < sh->nentries; slot++) {
+			int64_t b = sh->entries[slot].block;
+			if ((b >= first) && (b < end)) {
+				forget_block(fs, sh, slot, write);
+			}
+		}
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+static void bcache_sync_range(fs_ctx *fs, off_t pos, size_t len)
+{
+	forget_range(fs, pos, len, true);
+}
+
+static void bcache_drop_range(fs_ctx *fs, off_t pos, size_t len)
+{
+	forget_range(fs, pos, len, false);
+}
+
+static void bcache_destroy(fs_ctx *fs)
+{
+	bcache *bc = fs->backend_data;
+	if (bc == NULL) {
+		return;
+	}
+	bcache_flush(fs);
+
+	for (int i = 0; i < BCACHE_SHARDS; i++) {
+		bc_shard *sh = &bc->shards[i];
+		pthread_mutex_destroy(&sh->lock);
+		free(sh->buckets);
+		free(sh->entries);
+		free(sh->data);
+	}
+	free(bc);
+	fs->backend_data = NULL;
+}
+
+static bool bcache_init(fs_ctx *fs)
+{
+	unsigned long mb = fs->opts->cache_size ? fs->opts->cache_size : BCACHE_DEFAULT_MB;
+	size_t nblocks = mb * 1024 * 1024 / A1FS_BLOCK_SIZE;
+	int per_shard = nblocks / BCACHE_SHARDS > 0 ? nblocks / BCACHE_SHARDS : 1;
+
+	bcache *bc = calloc(1, sizeof(*bc));
+	if (bc == NULL) {
+		return false;
+	}
+	fs->backend_data = bc;
+
+	for (int i = 0; i < BCACHE_SHARDS; i++) {
+		bc_shard *sh = &bc->shards[i];
+		pthread_mutex_init(&sh->lock, NULL);
+		sh->nentries = per_shard;
+		sh->buckets = malloc(per_shard * sizeof(int));
+		sh->entries = malloc(per_shard * sizeof(bc_entry));
+		sh->data = malloc((size_t)per_shard * A1FS_BLOCK_SIZE);
+		if ((sh->buckets == NULL) || (sh->entries == NULL) || (sh->data == NULL)) {
+			fprintf(stderr, "a1fs: pread backend: cannot allocate %lu MiB of cache\n", mb);
+			bcache_destroy(fs);
+			return false;
+		}
+		for (int j = 0; j < per_shard; j++) {
+			sh->buckets[j] = -1;
+			sh->entries[j] = (bc_entry){ .block = -1, .next = -1 };
+		}
+	}
+	return true;
+}
+
+const a1fs_backend pread_backend = {
+	.name       = "pread",
+	.zero_copy  = false,
+	.init       = bcache_init,
+	.destroy    = bcache_destroy,
+	.read       = bcache_read,
+	.write      = bcache_write,
+	.read_segs  = NULL,
+	.write_segs = NULL,
+	.flush      = bcache_flush,
+	.prefetch   = backend_fadvise_prefetch,
+	.sync_range = bcache_sync_range,
+	.drop_range = bcache_drop_range,
+};
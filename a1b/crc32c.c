@@ -0,0 +1,154 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - CRC32C implementation.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+
+/** CRC32C polynomial, bit-reversed. */
+#define CRC32C_POLY 0x82F63B78u
+
+typedef uint32_t (*crc_fn)(uint32_t crc, const unsigned char *p, size_t len);
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static crc_fn impl;
+static const char *impl_name;
+
+/** Tables for processing 8 bytes at a time ("slicing by 8"). */
+static uint32_t table[8][256];
+
+
+static void make_table(void)
+{
+	for (int i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = (c >> 1) ^ (CRC32C_POLY & -(c & 1));
+		}
+		table[0][i] = c;
+	}
+	for (int i = 0; i < 256; i++) {
+		for (int t = 1; t < 8; t++) {
+			table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+		}
+	}
+}
+
+static uint32_t crc_table(uint32_t crc, const unsigned char *p, size_t len)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for (; (len > 0) && ((uintptr_t)p & 7); len--) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		w ^= crc;
+		crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+		      table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+		      table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+		      table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+	}
+#endif
+	for (; len > 0; len--) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	for (; (len > 0) && ((uintptr_t)p & 7); len--) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	uint64_t c = crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		c = _mm_crc32_u64(c, w);
+	}
+	crc = c;
+	for (; len > 0; len--) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	for (; (len > 0) && ((uintptr_t)p & 7); len--) {
+		crc = __crc32cb(crc, *p++);
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		crc = __crc32cd(crc, w);
+	}
+	for (; len > 0; len--) {
+		crc = __crc32cb(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+static void select_impl(void)
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		impl = crc_hw;
+		impl_name = "sse4.2";
+		return;
+	}
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		impl = crc_hw;
+		impl_name = "armv8";
+		return;
+	}
+#endif
+	make_table();
+	impl = crc_table;
+	impl_name = "table";
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&once, select_impl);
+	return ~impl(~crc, buf, len);
+}
+
+const char *crc32c_impl(void)
+{
+	pthread_once(&once, select_impl);
+	return impl_name;
+}
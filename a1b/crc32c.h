@@ -0,0 +1,43 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - CRC32C header file.
+ *
+ * CRC32C (Castagnoli) uses the SSE4.2 crc32 instruction on x86-64 and the
+ * ARMv8 CRC32 extension on arm64 if the CPU has them, and a table-driven
+ * implementation otherwise. The choice is made on the first call.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Compute the CRC32C of a buffer, continuing from a previous value, so that
+ * crc32c(crc32c(0, a, m), b, n) is the CRC32C of a followed by b.
+ *
+ * @param crc  CRC32C of the preceding data; 0 to start.
+ * @param buf  data.
+ * @param len  data size in bytes.
+ * @return     CRC32C of the data so far.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * Name of the implementation in use: "sse4.2", "armv8" or "table".
+ */
+const char *crc32c_impl(void);
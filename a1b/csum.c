@@ -0,0 +1,268 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Metadata checksums implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crc32c.h"
+#include "csum.h"
+#include "util.h"
+
+
+uint32_t csum_super(const a1fs_superblock *sb)
+{
+	a1fs_superblock copy = *sb;
+	copy.sb_checksum = 0;
+	return crc32c(0, &copy, sizeof(copy));
+}
+
+uint32_t csum_bitmap_block(const void *data, a1fs_blk_t block)
+{
+	// Seeded with the block number, so that blocks written to the wrong place
+	// don't cancel out in the XOR
+	return crc32c(crc32c(0, &block, sizeof(block)), data, A1FS_BLOCK_SIZE);
+}
+
+uint32_t csum_bitmaps(const void *image, const a1fs_superblock *sb)
+{
+	uint32_t csum = 0;
+	for (a1fs_blk_t b = sb->sb_inode_bitmap; b < sb->sb_inode_table; b++) {
+		csum ^= csum_bitmap_block(image + (size_t)b * A1FS_BLOCK_SIZE, b);
+	}
+	return csum;
+}
+
+uint32_t csum_inode(const a1fs_inode *inode, int ino)
+{
+	a1fs_inode copy = *inode;
+	copy.i_checksum = 0;
+	return crc32c(crc32c(0, &ino, sizeof(ino)), &copy, sizeof(copy));
+}
+
+uint32_t csum_dir_extent(const void *image, const a1fs_superblock *sb, int ino,
+                         const a1fs_extent *ext)
+{
+	uint32_t csum = crc32c(0, &ino, sizeof(ino));
+	csum = crc32c(csum, &ext->start, sizeof(ext->start));
+	return crc32c(csum, image + ((size_t)sb->sb_first_data_block + ext->start) * A1FS_BLOCK_SIZE,
+	              (size_t)ext->count * A1FS_BLOCK_SIZE);
+}
+
+
+/** Check that an extent of a directory lies within the data region. */
+static bool extent_valid(const fs_ctx *fs, const a1fs_extent *ext)
+{
+	size_t ndata = fs->size / A1FS_BLOCK_SIZE - fs->sb->sb_first_data_block;
+	return (ext->count >= 0) && ((size_t)ext->start + ext->count <= ndata);
+}
+
+/** Number of extents of a directory that carry checksums. */
+static int dir_extents(const a1fs_inode *inode)
+{
+	if (!S_ISDIR(inode->mode) || (inode->last_used_extent < 0)) {
+		return 0;
+	}
+	return (inode->last_used_extent < A1FS_MAX_EXTENTS) ? inode->last_used_extent + 1
+	                                                   : A1FS_MAX_EXTENTS;
+}
+
+/**
+ * Recompute the checksums of the superblock, the bitmaps and every inode, and
+ * the inode counters, which may be off as well. The free blocks are counted by
+ * freecache_open().
+ */
+static void recompute(fs_ctx *fs)
+{
+	a1fs_superblock *sb = fs->sb;
+	int64_t used = 0, dirs = 0;
+	for (int ino = 0; ino < sb->sb_inodes_count; ino++) {
+		if (check_bit_usage(fs->inode_bits, ino)) {
+			csum_update_inode(fs, ino);
+			used++;
+			dirs += S_ISDIR(fs->itable[ino].mode) ? 1 : 0;
+		}
+	}
+	sb->sb_free_inodes_count = sb->sb_inodes_count - used;
+	sb->sb_used_dirs_count = dirs;
+	csum_update_super(fs);
+}
+
+/** Check the blocks of a directory against the checksums in its inode. */
+static bool dir_intact(const fs_ctx *fs, const a1fs_inode *inode, int ino)
+{
+	for (int e = 0; e < dir_extents(inode); e++) {
+		if (!extent_valid(fs, &inode->i_extent[e]) ||
+		    (csum_dir_extent(fs->image, fs->sb, ino, &inode->i_extent[e]) !=
+		     inode->i_dir_checksum[e]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Recompute the checksums of directory blocks that the kernel wrote back ahead
+ * of the commit covering them. The inodes themselves come from the journal and
+ * are still verified on lookup.
+ */
+static void recompute_dirs(fs_ctx *fs)
+{
+	for (int ino = 0; ino < fs->sb->sb_inodes_count; ino++) {
+		a1fs_inode *inode = &fs->itable[ino];
+		if (check_bit_usage(fs->inode_bits, ino) &&
+		    (csum_inode(inode, ino) == inode->i_checksum) && !dir_intact(fs, inode, ino))
+		{
+			fprintf(stderr, "a1fs: inode %d: directory checksum mismatch after a crash; "
+			        "recomputing it, run fsck.a1fs to check it\n", ino);
+			csum_update_inode(fs, ino);
+		}
+	}
+}
+
+/** Set or clear sb_mounted, and wait until it is on disk. */
+static bool set_mounted(fs_ctx *fs, bool mounted)
+{
+	fs->sb->sb_mounted = mounted;
+	fs->sb->sb_checksum = csum_super(fs->sb);
+	if (msync(fs->image, A1FS_BLOCK_SIZE, MS_SYNC) != 0) {
+		perror("a1fs: msync");
+		return false;
+	}
+	return true;
+}
+
+bool csum_open(fs_ctx *fs)
+{
+	a1fs_superblock *sb = fs->sb;
+	bool unclean = (fs->journal == NULL) && sb->sb_mounted;
+	if (unclean) {
+		fprintf(stderr, "a1fs: the file system was not unmounted cleanly; "
+		        "recomputing checksums, run fsck.a1fs to check it\n");
+	} else if (csum_super(sb) != sb->sb_checksum) {
+		fprintf(stderr, "a1fs: superblock checksum mismatch\n");
+		return false;
+	} else if (csum_bitmaps(fs->image, sb) != sb->sb_bitmap_checksum) {
+		fprintf(stderr, "a1fs: bitmap checksum mismatch\n");
+		return false;
+	}
+
+	fs->csum_state = calloc(sb->sb_inodes_count, sizeof(*fs->csum_state));
+	if (fs->csum_state == NULL) {
+		return false;
+	}
+	pthread_mutex_init(&fs->csum_lock, NULL);
+
+	if (fs->journal == NULL) {
+		if (unclean) {
+			recompute(fs);
+		}
+		// Must be on disk before anything the checksums don't cover yet
+		if (!set_mounted(fs, true)) {
+			pthread_mutex_destroy(&fs->csum_lock);
+			free(fs->csum_state);
+			fs->csum_state = NULL;
+			return false;
+		}
+	} else {
+		if (sb->sb_mounted) {
+			recompute_dirs(fs);
+		}
+		// Committed by journal_commit_mount()
+		sb->sb_mounted = 1;
+	}
+	return true;
+}
+
+void csum_close(fs_ctx *fs)
+{
+	if (fs->csum_state == NULL) {
+		return;
+	}
+
+	// With a journal, the final commit takes care of this
+	if (fs->journal == NULL) {
+		for (int ino = 0; ino < fs->sb->sb_inodes_count; ino++) {
+			if ((fs->csum_state[ino] == CSUM_OK) && check_bit_usage(fs->inode_bits, ino)) {
+				csum_update_inode(fs, ino);
+			}
+		}
+		csum_update_super(fs);
+
+		// The image only counts as cleanly unmounted once everything the
+		// checksums cover is on disk
+		if (msync(fs->image, fs->size, MS_SYNC) == 0) {
+			set_mounted(fs, false);
+		} else {
+			perror("a1fs: msync");
+		}
+	}
+
+	pthread_mutex_destroy(&fs->csum_lock);
+	free(fs->csum_state);
+	fs->csum_state = NULL;
+}
+
+bool csum_verify_slow(fs_ctx *fs, int ino)
+{
+	pthread_mutex_lock(&fs->csum_lock);
+
+	// Verified by someone else meanwhile, or known to be bad
+	unsigned char state = fs->csum_state[ino];
+	if (state == CSUM_UNKNOWN) {
+		a1fs_inode inode = fs->itable[ino];
+		bool ok = (csum_inode(&inode, ino) == inode.i_checksum) && dir_intact(fs, &inode, ino);
+		if (!ok) {
+			fprintf(stderr, "a1fs: inode %d: checksum mismatch\n", ino);
+		}
+		state = ok ? CSUM_OK : CSUM_BAD;
+		__atomic_store_n(&fs->csum_state[ino], state, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&fs->csum_lock);
+	return state == CSUM_OK;
+}
+
+void csum_update_inode(fs_ctx *fs, int ino)
+{
+	a1fs_inode *inode = &fs->itable[ino];
+	for (int e = 0; e < dir_extents(inode); e++) {
+		if (!extent_valid(fs, &inode->i_extent[e])) {
+			continue;
+		}
+		// Left alone if unchanged, so that the page is not dirtied for nothing
+		uint32_t csum = csum_dir_extent(fs->image, fs->sb, ino, &inode->i_extent[e]);
+		if (inode->i_dir_checksum[e] != csum) {
+			inode->i_dir_checksum[e] = csum;
+		}
+	}
+
+	uint32_t csum = csum_inode(inode, ino);
+	if (inode->i_checksum != csum) {
+		inode->i_checksum = csum;
+	}
+}
+
+void csum_update_super(fs_ctx *fs)
+{
+	fs->sb->sb_bitmap_checksum = csum_bitmaps(fs->image, fs->sb);
+	fs->sb->sb_checksum = csum_super(fs->sb);
+}
@@ -0,0 +1,141 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Metadata checksums header file.
+ *
+ * The superblock, both bitmaps, every inode and every directory block are
+ * covered by CRC32C checksums (see a1fs.h for where they are stored):
+ *
+ * - The superblock and the bitmaps are verified at mount.
+ * - An inode is verified, together with the blocks of a directory, the first
+ *   time a path lookup reaches it. After that, it is only changed by callbacks
+ *   that have looked it up, so its checksum can be brought up to date when it
+ *   is written out rather than on every change.
+ * - With a journal, a commit updates the checksums of the inodes and bitmap
+ *   blocks that differ from the image, and of the changed directory blocks.
+ *   Without one, they are updated for the inodes written back by fsync() and
+ *   for everything verified or created since mount at unmount.
+ *
+ * A mismatch fails the mount or the lookup with EIO.
+ *
+ * Without a journal, nothing keeps the checksums on disk up to date until
+ * unmount, so sb_mounted is set for as long as the image is mounted. If it is
+ * still set at the next mount, the shutdown was not clean: the checksums are
+ * recomputed rather than verified, and fsck.a1fs is the way to check the image.
+ *
+ * With a journal, directory entries are written in place (see journal.h), and
+ * the kernel may write a directory block back before the commit that updates
+ * the checksum of its extent. So sb_mounted is set by the first commit and
+ * cleared by the final one as well, and after a crash the checksums of the
+ * directory blocks that no longer match are recomputed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+
+
+/** Verification state of an inode (fs->csum_state). */
+enum {
+	CSUM_UNKNOWN = 0,
+	CSUM_OK,
+	CSUM_BAD,
+};
+
+
+/** Checksum of a superblock. */
+uint32_t csum_super(const a1fs_superblock *sb);
+
+/** Checksum of an image block of a bitmap, folded into sb_bitmap_checksum. */
+uint32_t csum_bitmap_block(const void *data, a1fs_blk_t block);
+
+/** sb_bitmap_checksum of an image. */
+uint32_t csum_bitmaps(const void *image, const a1fs_superblock *sb);
+
+/** Checksum of inode number <ino>. */
+uint32_t csum_inode(const a1fs_inode *inode, int ino);
+
+/** Checksum of the blocks of extent <ext> of directory inode <ino>. */
+uint32_t csum_dir_extent(const void *image, const a1fs_superblock *sb, int ino,
+                         const a1fs_extent *ext);
+
+/**
+ * Verify the superblock and the bitmaps, and set up the inode states. If the
+ * image was not unmounted cleanly, recompute the checksums, or with a journal
+ * only those of directory blocks that don't match. Mark the image as mounted;
+ * with a journal, that takes a commit. Must be called after journal_open().
+ *
+ * @param fs  file system context.
+ * @return    true on success; false on a mismatch, an I/O error or if out of
+ *            memory.
+ */
+bool csum_open(fs_ctx *fs);
+
+/**
+ * Bring the checksums up to date if there is no journal, make them durable and
+ * mark the image as cleanly unmounted, and free the inode states. Called at
+ * unmount once nothing changes the metadata any more, before the superblock is
+ * written back.
+ *
+ * @param fs  file system context.
+ */
+void csum_close(fs_ctx *fs);
+
+/** Verify an inode on its first lookup; see csum_verify_inode(). */
+bool csum_verify_slow(fs_ctx *fs, int ino);
+
+/**
+ * Verify an inode, and the blocks of a directory, unless that was done before.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number.
+ * @return     true if the inode is intact.
+ */
+static inline bool csum_verify_inode(fs_ctx *fs, int ino)
+{
+	if (__atomic_load_n(&fs->csum_state[ino], __ATOMIC_ACQUIRE) == CSUM_OK) {
+		return true;
+	}
+	return csum_verify_slow(fs, ino);
+}
+
+/**
+ * Mark a newly allocated inode as verified.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number.
+ */
+static inline void csum_inode_new(fs_ctx *fs, int ino)
+{
+	__atomic_store_n(&fs->csum_state[ino], CSUM_OK, __ATOMIC_RELEASE);
+}
+
+/**
+ * Update the checksum of an inode, and of the blocks of a directory.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number.
+ */
+void csum_update_inode(fs_ctx *fs, int ino);
+
+/**
+ * Update the bitmap checksum and the superblock checksum.
+ *
+ * @param fs  file system context.
+ */
+void csum_update_super(fs_ctx *fs);
@@ -0,0 +1,235 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - O_DIRECT backend.
+ *
+ * File data bypasses the host page cache: the image is opened a second time
+ * with O_DIRECT, and every read or write of a piece of an extent is done with
+ * as few block-aligned I/Os as the buffer size allows. Direct I/O needs
+ * aligned memory, so data is staged through a small pool of aligned buffers.
+ * Writes that don't cover whole blocks read the partial first and last blocks
+ * before writing them back.
+ *
+ * The superblock, bitmaps, inode table and directory blocks are still
+ * accessed through the image mapping, which is the only part of the image
+ * left in the page cache. The kernel writes back dirty mapped pages before a
+ * direct I/O to the same range and invalidates them after a direct write, so
+ * the two views stay consistent.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+
+/** Number of buffers in the pool. */
+#define DIRECT_BUFS 8
+
+/** Size of each buffer; the largest single I/O. */
+#define DIRECT_BUF_SIZE (1024 * 1024)
+
+
+/** Backend state. */
+typedef struct direct_ctx {
+	/** Image file descriptor opened with O_DIRECT. */
+	int fd;
+
+	/** Protects the free list. */
+	pthread_mutex_t lock;
+	/** Signalled when a buffer is returned. */
+	pthread_cond_t cond;
+	/** Buffers not in use. */
+	void *free_bufs[DIRECT_BUFS];
+	int nfree;
+	/** All buffers, for freeing them. */
+	void *bufs[DIRECT_BUFS];
+
+} direct_ctx;
+
+
+static void *get_buf(direct_ctx *dc)
+{
+	pthread_mutex_lock(&dc->lock);
+	while (dc->nfree == 0) {
+		pthread_cond_wait(&dc->cond, &dc->lock);
+	}
+	void *buf = dc->free_bufs[--dc->nfree];
+	pthread_mutex_unlock(&dc->lock);
+	return buf;
+}
+
+static void put_buf(direct_ctx *dc, void *buf)
+{
+	pthread_mutex_lock(&dc->lock);
+	dc->free_bufs[dc->nfree++] = buf;
+	pthread_cond_signal(&dc->cond);
+	pthread_mutex_unlock(&dc->lock);
+}
+
+/** Transfer a whole aligned range; 0 on success, -errno on error. */
+static int do_io(int fd, void *buf, size_t len, off_t pos, bool write)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = write ? pwrite(fd, buf + done, len - done, pos + done)
+		                  : pread(fd, buf + done, len - done, pos + done);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		if (n == 0) {
+			return -EIO;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static int direct_read(fs_ctx *fs, void *buf, size_t len, off_t pos)
+{
+	direct_ctx *dc = fs->backend_data;
+	void *dbuf = get_buf(dc);
+	int ret = 0;
+
+	while (len > 0) {
+		// Aligned range around the next piece that fits in the buffer
+		off_t start = pos - pos % A1FS_BLOCK_SIZE;
+		size_t skip = pos - start;
+		size_t n = len < DIRECT_BUF_SIZE - skip ? len : DIRECT_BUF_SIZE - skip;
+		size_t io_len = (skip + n + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE * A1FS_BLOCK_SIZE;
+
+		ret = do_io(dc->fd, dbuf, io_len, start, false);
+		if (ret != 0) break;
+		memcpy(buf, dbuf + skip, n);
+
+		buf += n;
+		pos += n;
+		len -= n;
+	}
+
+	put_buf(dc, dbuf);
+	return ret;
+}
+
+static int direct_write(fs_ctx *fs, const void *buf, size_t len, off_t pos)
+{
+	direct_ctx *dc = fs->backend_data;
+	void *dbuf = get_buf(dc);
+	int ret = 0;
+
+	while (len > 0) {
+		off_t start = pos - pos % A1FS_BLOCK_SIZE;
+		size_t skip = pos - start;
+		size_t n = len < DIRECT_BUF_SIZE - skip ? len : DIRECT_BUF_SIZE - skip;
+		size_t io_len = (skip + n + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE * A1FS_BLOCK_SIZE;
+
+		// Keep the rest of partially written blocks
+		if (skip != 0) {
+			ret = do_io(dc->fd, dbuf, A1FS_BLOCK_SIZE, start, false);
+			if (ret != 0) break;
+		}
+		if (((skip + n) % A1FS_BLOCK_SIZE != 0) &&
+		    ((skip == 0) || (io_len > A1FS_BLOCK_SIZE)))
+		{
+			size_t last = io_len - A1FS_BLOCK_SIZE;
+			ret = do_io(dc->fd, dbuf + last, A1FS_BLOCK_SIZE, start + last, false);
+			if (ret != 0) break;
+		}
+		memcpy(dbuf + skip, buf, n);
+		ret = do_io(dc->fd, dbuf, io_len, start, true);
+		if (ret != 0) break;
+
+		buf += n;
+		pos += n;
+		len -= n;
+	}
+
+	put_buf(dc, dbuf);
+	return ret;
+}
+
+static int direct_flush(fs_ctx *fs)
+{
+	(void)fs;// unused
+	// Nothing is cached; completed direct writes are already on the device
+	return 0;
+}
+
+static void direct_destroy(fs_ctx *fs)
+{
+	direct_ctx *dc = fs->backend_data;
+	if (dc == NULL) return;
+
+	for (int i = 0; i < DIRECT_BUFS; i++) {
+		free(dc->bufs[i]);
+	}
+	if (dc->fd >= 0) {
+		close(dc->fd);
+	}
+	pthread_cond_destroy(&dc->cond);
+	pthread_mutex_destroy(&dc->lock);
+	free(dc);
+	fs->backend_data = NULL;
+}
+
+static bool direct_init(fs_ctx *fs)
+{
+	direct_ctx *dc = calloc(1, sizeof(*dc));
+	if (dc == NULL) {
+		return false;
+	}
+	fs->backend_data = dc;
+	pthread_mutex_init(&dc->lock, NULL);
+	pthread_cond_init(&dc->cond, NULL);
+
+	dc->fd = open(fs->opts->img_path, O_RDWR | O_DIRECT);
+	if (dc->fd < 0) {
+		perror("a1fs: direct backend: open");
+		direct_destroy(fs);
+		return false;
+	}
+
+	for (int i = 0; i < DIRECT_BUFS; i++) {
+		if (posix_memalign(&dc->bufs[i], A1FS_BLOCK_SIZE, DIRECT_BUF_SIZE) != 0) {
+			fprintf(stderr, "a1fs: direct backend: cannot allocate buffers\n");
+			direct_destroy(fs);
+			return false;
+		}
+		dc->free_bufs[dc->nfree++] = dc->bufs[i];
+	}
+	return true;
+}
+
+const a1fs_backend direct_backend = {
+	.name       = "direct",
+	.zero_copy  = false,
+	.init       = direct_init,
+	.destroy    = direct_destroy,
+	.read       = direct_read,
+	.write      = direct_write,
+	.read_segs  = NULL,
+	.write_segs = NULL,
+	.flush      = direct_flush,
+	.prefetch   = NULL,
+	.sync_range = NULL,
+	.drop_range = NULL,
+};
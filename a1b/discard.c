@@ -0,0 +1,243 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Online discard implementation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "discard.h"
+#include "journal.h"
+#include "util.h"
+#include "zero.h"
+
+
+/** Maximum number of blocks looked at while holding fs->lock. */
+#define DISCARD_CHUNK 4096
+
+
+/** Number of data blocks in the file system. */
+static int num_data_blocks(const fs_ctx *fs)
+{
+	return fs->size / A1FS_BLOCK_SIZE - fs->sb->sb_first_data_block;
+}
+
+/** Check if a data block is free, both in memory and as of the last commit. */
+static bool is_free(const fs_ctx *fs, int block)
+{
+	return !check_bit_usage(fs->block_bits, block) && journal_block_free(fs, block);
+}
+
+/**
+ * Punch holes in the image for the blocks in [start, start + count) that are
+ * free. The caller holds fs->lock, so none of them can be allocated meanwhile.
+ */
+static void discard_free_blocks(fs_ctx *fs, int start, int count)
+{
+	int b = start;
+	while (b < start + count) {
+		if (!is_free(fs, b)) {
+			b++;
+			continue;
+		}
+		int run = b;
+		while ((b < start + count) && is_free(fs, b)) {
+			b++;
+		}
+
+		off_t off = (off_t)(fs->sb->sb_first_data_block + run) * A1FS_BLOCK_SIZE;
+		if (fallocate(fs->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+		              (size_t)(b - run) * A1FS_BLOCK_SIZE) != 0)
+		{
+			if (!fs->discard_failed) {
+				perror("a1fs: discard");
+				fs->discard_failed = true;
+			}
+			return;
+		}
+		// Holes read as zeros
+		zero_mark(fs, run, b - run);
+	}
+}
+
+/** Discard a range of blocks, a chunk at a time. */
+static void discard_range(fs_ctx *fs, int start, int count)
+{
+	for (int i = start; i < start + count; i += DISCARD_CHUNK) {
+		int n = start + count - i < DISCARD_CHUNK ? start + count - i : DISCARD_CHUNK;
+		pthread_mutex_lock(&fs->lock);
+		discard_free_blocks(fs, i, n);
+		pthread_mutex_unlock(&fs->lock);
+	}
+}
+
+static int extent_cmp(const void *a, const void *b)
+{
+	const a1fs_extent *x = a, *y = b;
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+/** Sort queued extents and merge the ones that overlap or touch. */
+static int coalesce(a1fs_extent *exts, int n)
+{
+	if (n == 0) {
+		return 0;
+	}
+	qsort(exts, n, sizeof(*exts), extent_cmp);
+
+	int out = 0;
+	for (int i = 1; i < n; i++) {
+		a1fs_blk_t end = exts[out].start + exts[out].count;
+		if (exts[i].start <= end) {
+			a1fs_blk_t i_end = exts[i].start + exts[i].count;
+			if (i_end > end) {
+				exts[out].count = i_end - exts[out].start;
+			}
+		} else {
+			exts[++out] = exts[i];
+		}
+	}
+	return out + 1;
+}
+
+void discard_queue(fs_ctx *fs, int start, int count)
+{
+	if (!fs->discard_running) {
+		return;
+	}
+
+	pthread_mutex_lock(&fs->discard_lock);
+	a1fs_extent *last = fs->discard_len > 0 ? &fs->discard_q[fs->discard_len - 1] : NULL;
+
+	// Blocks are often freed one at a time, going backwards or forwards
+	if ((last != NULL) && ((a1fs_blk_t)(start + count) == last->start)) {
+		last->start = start;
+		last->count += count;
+	} else if ((last != NULL) && ((a1fs_blk_t)start == last->start + last->count)) {
+		last->count += count;
+	} else if (fs->discard_len < A1FS_DISCARD_QUEUE) {
+		fs->discard_q[fs->discard_len].start = start;
+		fs->discard_q[fs->discard_len].count = count;
+		fs->discard_len++;
+	} else {
+		fs->discard_overflow = true;
+	}
+
+	pthread_cond_signal(&fs->discard_cond);
+	pthread_mutex_unlock(&fs->discard_lock);
+}
+
+/** Worker thread: discard the queued extents a batch at a time. */
+static void *discard_worker(void *arg)
+{
+	fs_ctx *fs = (fs_ctx*)arg;
+	static a1fs_extent batch[A1FS_DISCARD_QUEUE];
+
+	pthread_mutex_lock(&fs->discard_lock);
+	while (!fs->discard_stop) {
+		if ((fs->discard_len == 0) && !fs->discard_overflow) {
+			pthread_cond_wait(&fs->discard_cond, &fs->discard_lock);
+			continue;
+		}
+
+		// Let more extents pile up so that they can be merged
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += (A1FS_DISCARD_DELAY_MS % 1000) * 1000000L;
+		until.tv_sec += A1FS_DISCARD_DELAY_MS / 1000 + until.tv_nsec / 1000000000L;
+		until.tv_nsec %= 1000000000L;
+		while (!fs->discard_stop &&
+		       (pthread_cond_timedwait(&fs->discard_cond, &fs->discard_lock, &until) != ETIMEDOUT));
+		if (fs->discard_stop) {
+			break;
+		}
+
+		int n = fs->discard_len;
+		bool overflow = fs->discard_overflow;
+		memcpy(batch, fs->discard_q, n * sizeof(*batch));
+		fs->discard_len = 0;
+		fs->discard_overflow = false;
+		pthread_mutex_unlock(&fs->discard_lock);
+
+		// Blocks are only discarded once they are free on disk too
+		int ret = journal_commit(fs);
+		if (ret != 0) {
+			fprintf(stderr, "a1fs: discard: journal commit failed: %s\n", strerror(-ret));
+		}
+
+		if (overflow) {
+			discard_range(fs, 0, num_data_blocks(fs));
+		} else {
+			n = coalesce(batch, n);
+			for (int i = 0; i < n; i++) {
+				discard_range(fs, batch[i].start, batch[i].count);
+			}
+		}
+
+		pthread_mutex_lock(&fs->discard_lock);
+	}
+	pthread_mutex_unlock(&fs->discard_lock);
+
+	return NULL;
+}
+
+bool discard_start(fs_ctx *fs)
+{
+	if (!fs->opts->discard) {
+		return true;
+	}
+
+	fs->discard_q = malloc(A1FS_DISCARD_QUEUE * sizeof(*fs->discard_q));
+	if (fs->discard_q == NULL) {
+		fprintf(stderr, "discard_start: out of memory\n");
+		return false;
+	}
+	fs->discard_len = 0;
+	fs->discard_overflow = false;
+	fs->discard_stop = false;
+
+	int err = pthread_create(&fs->discard_thread, NULL, discard_worker, fs);
+	if (err != 0) {
+		fprintf(stderr, "discard_start: pthread_create: %s\n", strerror(err));
+		free(fs->discard_q);
+		fs->discard_q = NULL;
+		return false;
+	}
+	fs->discard_running = true;
+	return true;
+}
+
+void discard_stop(fs_ctx *fs)
+{
+	if (!fs->discard_running) {
+		return;
+	}
+
+	pthread_mutex_lock(&fs->discard_lock);
+	fs->discard_stop = true;
+	pthread_cond_signal(&fs->discard_cond);
+	pthread_mutex_unlock(&fs->discard_lock);
+
+	pthread_join(fs->discard_thread, NULL);
+	fs->discard_running = false;
+	free(fs->discard_q);
+	fs->discard_q = NULL;
+}
@@ -0,0 +1,62 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Online discard header file.
+ *
+ * With the discard mount option, freed data blocks are queued, and a worker
+ * thread periodically sorts and coalesces the queue and punches holes in the
+ * image for the blocks that are still free, so that the host file system can
+ * reuse the space. If the queue overflows, the worker discards all free space
+ * instead. See fstrim.c for doing the same offline.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "fs_ctx.h"
+
+
+/** Maximum number of queued extents before falling back to a full sweep. */
+#define A1FS_DISCARD_QUEUE 1024
+
+/** How long freed extents are collected before they are discarded. */
+#define A1FS_DISCARD_DELAY_MS 1000
+
+
+/**
+ * Start the discard worker thread, if enabled with the discard mount option.
+ *
+ * @param fs  file system context.
+ * @return    true on success or if disabled; false on failure.
+ */
+bool discard_start(fs_ctx *fs);
+
+/**
+ * Stop the discard worker thread. Extents still queued are dropped; they can
+ * be discarded offline with fstrim.a1fs.
+ *
+ * @param fs  file system context.
+ */
+void discard_stop(fs_ctx *fs);
+
+/**
+ * Queue freed data blocks for discard. Does nothing if discard is off.
+ *
+ * @param fs     file system context.
+ * @param start  first freed data block.
+ * @param count  number of blocks.
+ */
+void discard_queue(fs_ctx *fs, int start, int count);
@@ -0,0 +1,316 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Free-space cache implementation.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freecache.h"
+#include "sbcount.h"
+#include "util.h"
+
+
+/** Minimum number of chunks per rebuild thread; fewer aren't worth a thread. */
+#define FSC_CHUNKS_PER_THREAD 256
+
+
+/** Number of data blocks in the file system. */
+static int num_data_blocks(const fs_ctx *fs)
+{
+	return fs->size / A1FS_BLOCK_SIZE - fs->sb->sb_first_data_block;
+}
+
+/** Number of data blocks in a chunk; only the last one can be short. */
+static int chunk_size(const fs_ctx *fs, int chunk)
+{
+	int left = num_data_blocks(fs) - chunk * A1FS_FSC_CHUNK;
+	return left < A1FS_FSC_CHUNK ? left : A1FS_FSC_CHUNK;
+}
+
+/** Count the free blocks of a chunk in the block bitmap. */
+static uint32_t count_free(const fs_ctx *fs, int chunk)
+{
+	int first = chunk * A1FS_FSC_CHUNK;
+	int n = chunk_size(fs, chunk);
+	int used = 0;
+	int i = 0;
+
+	// Chunks start on a byte boundary, so whole words can be counted
+	for (; i + 64 <= n; i += 64) {
+		uint64_t word;
+		memcpy(&word, fs->block_bits + (first + i) / 8, sizeof(word));
+		used += __builtin_popcountll(word);
+	}
+	// The bits past the last data block are not necessarily clear
+	for (; i < n; i++) {
+		used += check_bit_usage(fs->block_bits, first + i);
+	}
+	return n - used;
+}
+
+
+/** Chunks counted by one rebuild thread. */
+typedef struct rebuild_range {
+	fs_ctx *fs;
+	int first, last;
+	pthread_t thread;
+} rebuild_range;
+
+static void *rebuild_worker(void *arg)
+{
+	rebuild_range *r = arg;
+	for (int c = r->first; c < r->last; c++) {
+		r->fs->fsc_free[c] = count_free(r->fs, c);
+	}
+	return NULL;
+}
+
+/**
+ * Count the free blocks of every chunk from the bitmap, splitting the chunks
+ * between threads.
+ *
+ * @return  number of threads used.
+ */
+static int rebuild(fs_ctx *fs)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads = (fs->fsc_nchunks + FSC_CHUNKS_PER_THREAD - 1) / FSC_CHUNKS_PER_THREAD;
+	if (nthreads > ncpus) nthreads = ncpus;
+	if (nthreads > A1FS_FSC_THREADS) nthreads = A1FS_FSC_THREADS;
+	if (nthreads < 1) nthreads = 1;
+
+	rebuild_range ranges[A1FS_FSC_THREADS];
+	int started = 0;
+	for (int t = 0; t < nthreads; t++) {
+		ranges[t].fs = fs;
+		ranges[t].first = (long)fs->fsc_nchunks * t / nthreads;
+		ranges[t].last = (long)fs->fsc_nchunks * (t + 1) / nthreads;
+	}
+	// The calling thread takes the first range itself
+	for (int t = 1; t < nthreads; t++) {
+		if (pthread_create(&ranges[t].thread, NULL, rebuild_worker, &ranges[t]) != 0) {
+			break;
+		}
+		started++;
+	}
+	rebuild_worker(&ranges[0]);
+	for (int t = 1; t <= started; t++) {
+		pthread_join(ranges[t].thread, NULL);
+	}
+	// Ranges that didn't get a thread
+	for (int t = started + 1; t < nthreads; t++) {
+		rebuild_worker(&ranges[t]);
+	}
+	return started + 1;
+}
+
+/** Size of the on-disk cache in bytes, or 0 if it doesn't fit its blocks. */
+static size_t cache_len(const fs_ctx *fs)
+{
+	size_t len = sizeof(a1fs_fsc_header) + fs->fsc_nchunks * sizeof(uint32_t);
+	return len <= (size_t)fs->sb->sb_fsc_blocks * A1FS_BLOCK_SIZE ? len : 0;
+}
+
+/** Load the counts from the on-disk cache if it is valid. */
+static bool load(fs_ctx *fs)
+{
+	a1fs_superblock *sb = fs->sb;
+	if ((sb->sb_fsc_gen == 0) || (cache_len(fs) == 0)) {
+		return false;
+	}
+
+	const a1fs_fsc_header *hdr = fs->image + (size_t)sb->sb_fsc_start * A1FS_BLOCK_SIZE;
+	if ((hdr->magic != A1FS_FSC_MAGIC) || (hdr->gen != sb->sb_fsc_gen) ||
+	    (hdr->nchunks != (uint32_t)fs->fsc_nchunks))
+	{
+		return false;
+	}
+
+	// Cheap sanity check, in case something else changed the image meanwhile
+	const uint32_t *counts = (const uint32_t *)(hdr + 1);
+	int64_t total = 0;
+	for (int c = 0; c < fs->fsc_nchunks; c++) {
+		if (counts[c] > (uint32_t)chunk_size(fs, c)) {
+			return false;
+		}
+		total += counts[c];
+	}
+	if (total != sb->sb_free_blocks_count) {
+		return false;
+	}
+	memcpy(fs->fsc_free, counts, fs->fsc_nchunks * sizeof(uint32_t));
+	return true;
+}
+
+/** Write the cache header with generation <gen>, or the whole cache. */
+static int store(fs_ctx *fs, uint64_t gen, bool counts)
+{
+	size_t len = counts ? cache_len(fs) : sizeof(a1fs_fsc_header);
+	unsigned char *buf = malloc(len);
+	if (buf == NULL) {
+		return -ENOMEM;
+	}
+
+	a1fs_fsc_header *hdr = (a1fs_fsc_header *)buf;
+	hdr->magic = A1FS_FSC_MAGIC;
+	hdr->nchunks = fs->fsc_nchunks;
+	hdr->gen = gen;
+	if (counts) {
+		memcpy(hdr + 1, fs->fsc_free, fs->fsc_nchunks * sizeof(uint32_t));
+	}
+
+	int ret = 0;
+	if ((pwrite(fs->fd, buf, len, (off_t)fs->sb->sb_fsc_start * A1FS_BLOCK_SIZE) != (ssize_t)len) ||
+	    (fdatasync(fs->fd) != 0))
+	{
+		ret = errno ? -errno : -EIO;
+	}
+	free(buf);
+	return ret;
+}
+
+bool freecache_open(fs_ctx *fs)
+{
+	fs->fsc_nchunks = (num_data_blocks(fs) + A1FS_FSC_CHUNK - 1) / A1FS_FSC_CHUNK;
+	fs->fsc_free = calloc(fs->fsc_nchunks + 1, sizeof(uint32_t));
+	if (fs->fsc_free == NULL) {
+		return false;
+	}
+
+	fs->fsc_loaded = load(fs);
+	if (fs->fsc_loaded) {
+		// Until the next clean unmount the counts on disk go stale
+		int ret = store(fs, 0, false);
+		if (ret != 0) {
+			fprintf(stderr, "a1fs: free-space cache: %s\n", strerror(-ret));
+			free(fs->fsc_free);
+			fs->fsc_free = NULL;
+			return false;
+		}
+		fs->fsc_threads = 0;
+		return true;
+	}
+
+	fs->fsc_threads = rebuild(fs);
+
+	// After an unclean shutdown without a journal the counter can be off
+	int64_t total = 0;
+	for (int c = 0; c < fs->fsc_nchunks; c++) {
+		total += fs->fsc_free[c];
+	}
+	if (total != fs->sb->sb_free_blocks_count) {
+		fprintf(stderr, "a1fs: free block count was %ld, correcting it to %ld\n",
+		        (long)fs->sb->sb_free_blocks_count, (long)total);
+		fs->sb->sb_free_blocks_count = total;
+	}
+	return true;
+}
+
+void freecache_close(fs_ctx *fs)
+{
+	if (fs->fsc_free == NULL) {
+		return;
+	}
+
+	// The superblock must not point at counts that are not durable yet
+	if (cache_len(fs) != 0) {
+		uint64_t gen = fs->sb->sb_fsc_gen + 1;
+		int ret = store(fs, gen, true);
+		if (ret == 0) {
+			fs->sb->sb_fsc_gen = gen;
+		} else {
+			fprintf(stderr, "a1fs: free-space cache: %s\n", strerror(-ret));
+		}
+	}
+
+	free(fs->fsc_free);
+	fs->fsc_free = NULL;
+}
+
+void freecache_note(fs_ctx *fs, int start, int count, bool used)
+{
+	if (fs->fsc_free == NULL) {
+		return;
+	}
+	while (count > 0) {
+		int chunk = start / A1FS_FSC_CHUNK;
+		int n = (chunk + 1) * A1FS_FSC_CHUNK - start;
+		if (n > count) n = count;
+		__atomic_fetch_add(&fs->fsc_free[chunk], used ? -n : n, __ATOMIC_RELAXED);
+		start += n;
+		count -= n;
+	}
+}
+
+int freecache_count(fs_ctx *fs, int start, int count)
+{
+	if (fs->fsc_free == NULL) {
+		return 0;
+	}
+	int nfree = 0;
+	for (int c = start / A1FS_FSC_CHUNK; c < (start + count + A1FS_FSC_CHUNK - 1) / A1FS_FSC_CHUNK; c++) {
+		nfree += __atomic_load_n(&fs->fsc_free[c], __ATOMIC_RELAXED);
+	}
+	return nfree;
+}
+
+int freecache_find(fs_ctx *fs, int count, int goal)
+{
+	if (sbc_read(fs, SBC_FREE_BLOCKS) < count) {
+		return -1;
+	}
+
+	// Runs don't wrap around from the last chunk to the first
+	int goal_chunk = (goal >= 0) && (goal < num_data_blocks(fs)) ? goal / A1FS_FSC_CHUNK : 0;
+	int run_start = 0;
+	int run = 0;
+	for (int i = 0; i < fs->fsc_nchunks; i++) {
+		int c = (goal_chunk + i) % fs->fsc_nchunks;
+		if (c == 0) {
+			run = 0;
+		}
+		int first = c * A1FS_FSC_CHUNK;
+		int n = chunk_size(fs, c);
+		uint32_t nfree = __atomic_load_n(&fs->fsc_free[c], __ATOMIC_RELAXED);
+
+		if (nfree == 0) {
+			run = 0;
+			continue;
+		}
+		// Blocks are only allocated under fs->lock, so an empty chunk stays so
+		if (nfree == (uint32_t)n) {
+			if (run == 0) run_start = first;
+			run += n;
+			if (run >= count) return run_start;
+			continue;
+		}
+
+		for (int b = first; b < first + n; b++) {
+			if (check_bit_usage(fs->block_bits, b)) {
+				run = 0;
+				continue;
+			}
+			if (run == 0) run_start = b;
+			if (++run == count) return run_start;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,88 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Free-space cache header file.
+ *
+ * The allocator keeps the number of free blocks in each chunk of
+ * A1FS_FSC_CHUNK data blocks (fs->fsc_free), so that searching for free
+ * blocks skips full chunks and takes empty ones whole instead of testing
+ * every bit. At mount the counts are loaded from the on-disk cache (see
+ * a1fs.h) if it was written by a clean unmount, or rebuilt from the block
+ * bitmap by several threads otherwise. The on-disk copy is invalidated as
+ * soon as it is loaded, and written again at unmount.
+ *
+ * Counts are updated atomically, like the bitmap itself.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "fs_ctx.h"
+
+
+/** Maximum number of threads rebuilding the counts. */
+#define A1FS_FSC_THREADS 8
+
+
+/**
+ * Load or rebuild the free block counts, and invalidate the on-disk cache.
+ * Must be called after journal_open().
+ *
+ * @param fs  file system context.
+ * @return    true on success; false on failure.
+ */
+bool freecache_open(fs_ctx *fs);
+
+/**
+ * Write the on-disk cache and free the counts. Called at unmount once nothing
+ * allocates or frees blocks any more, before the superblock is written back.
+ *
+ * @param fs  file system context.
+ */
+void freecache_close(fs_ctx *fs);
+
+/**
+ * Record that data blocks were allocated or freed. Called after the bitmap is
+ * updated.
+ *
+ * @param fs     file system context.
+ * @param start  first data block.
+ * @param count  number of blocks.
+ * @param used   true if the blocks were allocated, false if freed.
+ */
+void freecache_note(fs_ctx *fs, int start, int count, bool used);
+
+/**
+ * Count the free data blocks in a range that starts at a chunk boundary.
+ *
+ * @param fs     file system context.
+ * @param start  first data block; a multiple of A1FS_FSC_CHUNK.
+ * @param count  number of blocks.
+ * @return       number of free blocks.
+ */
+int freecache_count(fs_ctx *fs, int start, int count);
+
+/**
+ * Find the first run of free data blocks that is long enough, starting from
+ * the chunk of <goal> and wrapping around to the start. The caller holds
+ * fs->lock.
+ *
+ * @param fs     file system context.
+ * @param count  number of blocks.
+ * @param goal   data block to start the search at.
+ * @return       first data block of the run; -1 if there is none.
+ */
+int freecache_find(fs_ctx *fs, int count, int goal);
@@ -16,13 +16,20 @@
  * CSC369 Assignment 1 - File system runtime context implementation.
  */
 
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "fs_ctx.h"
+#include "sbcount.h"
+#include "sync.h"
 
 
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
+bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, int fd)
 {
 	fs->image = image;
 	fs->size = size;
+	fs->fd = fd;
 
 	//TODO: check if the file system image can be mounted and initialize its
 	// runtime state
@@ -36,11 +43,90 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
 		return false;
 	}
 
+	// Every lookup and allocation touches the metadata; ask for huge pages to
+	// save TLB misses there. Only effective if the host supports them for the
+	// image file (e.g. on tmpfs), so failure is not an error
+	size_t page = sysconf(_SC_PAGESIZE);
+	fs->meta_size = (size_t)fs->sb->sb_first_data_block * A1FS_BLOCK_SIZE;
+	fs->meta_size = (fs->meta_size + page - 1) / page * page;
+	if (fs->meta_size > size) {
+		fs->meta_size = size;
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(image, fs->meta_size, MADV_HUGEPAGE);
+#endif
+
+	// Sequence counters for lock-free inode reads, all even (no writer active)
+	fs->ino_seq = calloc(fs->sb->sb_inodes_count, sizeof(*fs->ino_seq));
+	if (fs->ino_seq == NULL) {
+		return false;
+	}
+
+	fs->dirty = calloc(fs->sb->sb_inodes_count, sizeof(*fs->dirty));
+	fs->sync_queue = calloc(fs->sb->sb_inodes_count, sizeof(*fs->sync_queue));
+	if ((fs->dirty == NULL) || (fs->sync_queue == NULL) || !sbc_init(fs)) {
+		free(fs->dirty);
+		free(fs->sync_queue);
+		free(fs->ino_seq);
+		return false;
+	}
+
+	pthread_mutex_init(&fs->lock, NULL);
+	pthread_cond_init(&fs->reclaim_cond, NULL);
+	pthread_cond_init(&fs->zero_cond, NULL);
+	pthread_mutex_init(&fs->discard_lock, NULL);
+	pthread_cond_init(&fs->discard_cond, NULL);
+	pthread_mutex_init(&fs->sync_lock, NULL);
+	pthread_cond_init(&fs->sync_cond, NULL);
+
+	return true;
+}
+
+bool fs_ctx_pin_metadata(fs_ctx *fs)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t npages = fs->meta_size / page;
+	unsigned char *vec = malloc(npages);
+	if (vec == NULL) {
+		return false;
+	}
+
+	// Count the pages that locking has to fault in
+	size_t resident = 0;
+	if (mincore(fs->image, fs->meta_size, vec) == 0) {
+		for (size_t i = 0; i < npages; i++) {
+			resident += vec[i] & 1;
+		}
+	}
+	free(vec);
+
+	if (mlock(fs->image, fs->meta_size) != 0) {
+		return false;
+	}
+	fs->meta_locked = true;
+	fs->meta_pages = npages;
+	fs->meta_prefaulted = npages - resident;
 	return true;
 }
 
 void fs_ctx_destroy(fs_ctx *fs)
 {
-	//TODO: cleanup any resources allocated in fs_ctx_init()
-	(void)fs;
+	if (fs->meta_locked) {
+		munlock(fs->image, fs->meta_size);
+		fs->meta_locked = false;
+	}
+	pthread_cond_destroy(&fs->sync_cond);
+	pthread_mutex_destroy(&fs->sync_lock);
+	free(fs->sync_queue);
+	fs->sync_queue = NULL;
+	free(fs->dirty);
+	fs->dirty = NULL;
+	pthread_cond_destroy(&fs->discard_cond);
+	pthread_mutex_destroy(&fs->discard_lock);
+	pthread_cond_destroy(&fs->zero_cond);
+	pthread_cond_destroy(&fs->reclaim_cond);
+	pthread_mutex_destroy(&fs->lock);
+	free(fs->ino_seq);
+	fs->ino_seq = NULL;
+	sbc_destroy(fs);
 }
@@ -18,11 +18,17 @@
 
 #pragma once
 
+#include <pthread.h>
 #include <stddef.h>
 
 #include "a1fs.h"
 #include "options.h"
 
+struct a1fs_backend;
+struct a1fs_dirty;
+struct a1fs_journal;
+struct a1fs_sbc;
+
 extern a1fs_superblock *sb;
 extern unsigned char *block_bits;
 extern unsigned char *inode_bits;
@@ -36,6 +42,14 @@ typedef struct fs_ctx {
 	void *image;	
 	/** Image size in bytes. */
 	size_t size;
+	/** Open file descriptor of the image, for I/O that bypasses the mapping. */
+	int fd;
+	/** Mount options. */
+	const a1fs_opts *opts;
+	/** Storage backend for file data. */
+	const struct a1fs_backend *backend;
+	/** Backend private state. */
+	void *backend_data;
 
 	//TODO: useful runtime state of the mounted file system should be cached
 	// here (NOT in global variables in a1fs.c)
@@ -43,6 +57,108 @@ typedef struct fs_ctx {
 	unsigned char* inode_bits;
 	unsigned char* block_bits;
 	struct a1fs_inode* itable;
+	/** Bytes at the front of the image holding the superblock, bitmaps and
+	    inode table, rounded up to whole pages. */
+	size_t meta_size;
+
+	/** Per-inode sequence counters; odd while a writer is updating the inode. */
+	unsigned int *ino_seq;
+
+	/** Protects the orphan list, data block allocation, zero_bits and
+	    inode table initialization. */
+	pthread_mutex_t lock;
+	/** Signalled when orphans are added or the worker should stop. */
+	pthread_cond_t reclaim_cond;
+	/** Reclamation worker thread. */
+	pthread_t reclaim_thread;
+	/** The worker thread has been started. */
+	bool reclaim_running;
+	/** Tells the worker thread to exit. */
+	bool reclaim_stop;
+
+	/** Free data blocks known to read as zeros; NULL if prezero is off. */
+	unsigned char *zero_bits;
+	/** Signalled when the zeroing worker should stop. */
+	pthread_cond_t zero_cond;
+	/** Zeroing worker thread. */
+	pthread_t zero_thread;
+	/** The zeroing worker thread has been started. */
+	bool zero_running;
+	/** Tells the zeroing worker thread to exit. */
+	bool zero_stop;
+	/** Data block where the zeroing worker continues. */
+	int zero_cursor;
+	/** Time of the last data block allocation (CLOCK_MONOTONIC). */
+	struct timespec last_alloc;
+
+	/** Protects the discard queue; may be taken while holding lock. */
+	pthread_mutex_t discard_lock;
+	/** Signalled when extents are queued or the worker should stop. */
+	pthread_cond_t discard_cond;
+	/** Freed extents waiting to be discarded. */
+	a1fs_extent *discard_q;
+	/** Number of extents in discard_q. */
+	int discard_len;
+	/** Extents were dropped because the queue was full. */
+	bool discard_overflow;
+	/** Discard worker thread. */
+	pthread_t discard_thread;
+	/** The discard worker thread has been started. */
+	bool discard_running;
+	/** Tells the discard worker thread to exit. */
+	bool discard_stop;
+	/** Punching holes failed; reported once. */
+	bool discard_failed;
+
+	/** Protects the dirty state and the sync queue. */
+	pthread_mutex_t sync_lock;
+	/** Signalled when a sync batch completes. */
+	pthread_cond_t sync_cond;
+	/** Per-inode unsynced changes. */
+	struct a1fs_dirty *dirty;
+	/** Inodes waiting for the next sync batch. */
+	int *sync_queue;
+	/** Number of entries in sync_queue. */
+	int sync_nqueued;
+	/** Number of sync batches started and completed. */
+	unsigned long sync_started, sync_done;
+	/** A sync batch is being written back. */
+	bool sync_active;
+
+	/** Metadata journal; NULL if the image has none. */
+	struct a1fs_journal *journal;
+
+	/** Free data blocks in each chunk of A1FS_FSC_CHUNK blocks. */
+	uint32_t *fsc_free;
+	/** Number of entries in fsc_free. */
+	int fsc_nchunks;
+	/** The counts were loaded from the on-disk cache rather than rebuilt. */
+	bool fsc_loaded;
+	/** Number of threads that rebuilt the counts; 0 if they were loaded. */
+	int fsc_threads;
+
+	/** Superblock counter shards (see sbcount.h). */
+	struct a1fs_sbc *sbc;
+	/** Number of shards minus 1; the number is a power of 2. */
+	unsigned int sbc_mask;
+
+	/** Free inodes in each allocation group (see group.h). */
+	int *group_free_inodes;
+	/** Where the search for a group for a new tree starts next. */
+	unsigned int group_cursor;
+
+	/** Checksum verification state of each inode (CSUM_*). */
+	unsigned char *csum_state;
+	/** Serializes the first verification of each inode. */
+	pthread_mutex_t csum_lock;
+
+	/** The metadata region is locked in memory. */
+	bool meta_locked;
+	/** Pages of the metadata region. */
+	size_t meta_pages;
+	/** Metadata pages that were not resident when they were locked, i.e.
+	    page faults taken at mount instead of on the first access. */
+	size_t meta_prefaulted;
 
 } fs_ctx;
 
@@ -52,9 +168,21 @@ typedef struct fs_ctx {
  * @param fs     pointer to the context to initialize.
  * @param image  pointer to the start of the image.
  * @param size   image size in bytes.
+ * @param fd     open file descriptor of the image.
  * @return       true on success; false on failure (e.g. invalid superblock).
  */
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size);
+bool fs_ctx_init(fs_ctx *fs, void *image, size_t size, int fd);
+
+/**
+ * Lock the metadata region of the image in memory, so that accessing it never
+ * faults. Memory locks are not inherited across fork(), so this must be called
+ * in the process that serves requests. Fills in the meta_* statistics.
+ *
+ * @param fs  file system context.
+ * @return    true on success; false on failure (e.g. RLIMIT_MEMLOCK is too
+ *            low), with errno set.
+ */
+bool fs_ctx_pin_metadata(fs_ctx *fs);
 
 /**
  * Destroy file system context.
@@ -0,0 +1,962 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs consistency checker.
+ *
+ * Checks an unmounted a1fs image and repairs what it can:
+ *
+ * - Pass 1 checks every in-use inode: its mode, its extent list (truncated at
+ *   the first extent that is out of range), its size against its blocks, and
+ *   its checksums. The blocks of all inodes are claimed in a bitmap; if two
+ *   inodes claim the same block, the lower numbered one keeps it and the
+ *   other is truncated before that extent.
+ * - Pass 2 walks the directory tree breadth first from the root. Entries that
+ *   point to a free inode, an orphan, or an inode already linked from
+ *   elsewhere (a directory loop or an unsupported hard link) are cleared, and
+ *   the entry count of each directory is fixed.
+ * - Pass 3 frees in-use inodes that no directory links to and that are not
+ *   waiting on the orphan list, fixes link counts and updates the checksums of
+ *   the inodes that were changed.
+ * - Pass 4 makes the block bitmap match the claimed blocks.
+ * - Finally, the superblock counters and checksums are fixed.
+ *
+ * Passes 1, 3 and 4 split the inode table and the bitmap between the threads
+ * of a pool; pass 2 processes each level of the tree in parallel. With -n the
+ * repairs are made on a private copy of the image, so nothing is written.
+ *
+ * Exit status, as for e2fsck: 0 if the file system is consistent, 1 if errors
+ * were corrected, 4 if errors were left uncorrected, 8 on an operational error.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "csum.h"
+#include "map.h"
+#include "util.h"
+
+
+/** Maximum number of threads. */
+#define FSCK_MAX_THREADS 64
+
+/** Inodes handed to a thread at a time. */
+#define FSCK_INODE_BATCH 256
+
+/** Directories handed to a thread at a time in pass 2. */
+#define FSCK_DIR_BATCH 16
+
+/** Data blocks handed to a thread at a time in pass 4; a multiple of 8. */
+#define FSCK_BLOCK_BATCH (64 * 1024)
+
+/** Inodes in an inode table block. */
+#define INODES_PER_BLOCK ((int)(A1FS_BLOCK_SIZE / sizeof(a1fs_inode)))
+
+/** Exit status. */
+enum {
+	FSCK_OK        = 0,
+	FSCK_FIXED     = 1,
+	FSCK_UNFIXED   = 4,
+	FSCK_ERROR     = 8,
+};
+
+/** Per-inode state (fsck_ctx.state). */
+enum {
+	/** Marked in use in the inode bitmap. */
+	I_LIVE    = 1,
+	/** On the orphan list. */
+	I_ORPHAN  = 2,
+	/** Changed; the checksums must be updated. */
+	I_CHANGED = 4,
+};
+
+
+/** Command line options. */
+typedef struct fsck_opts {
+	/** File system image file path. */
+	const char *img_path;
+	/** Number of threads; 0 for one per CPU. */
+	int threads;
+
+	/** Print help and exit. */
+	bool help;
+	/** Only report problems, don't repair them. */
+	bool no_repair;
+	/** Print the progress of each pass. */
+	bool verbose;
+
+} fsck_opts;
+
+static const char *help_str = "\
+Usage: %s options image\n\
+\n\
+Check an a1fs image for consistency and repair the problems found. The file\n\
+system must not be mounted.\n\
+\n\
+Options:\n\
+    -h      print help and exit\n\
+    -n      only report problems, don't repair them\n\
+    -t num  number of threads (default: one per CPU)\n\
+    -v      print the progress of each pass\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+
+static bool parse_args(int argc, char *argv[], fsck_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "hnt:v")) != -1) {
+		switch (o) {
+			case 'h': opts->help      = true; return true;// skip other arguments
+			case 'n': opts->no_repair = true; break;
+			case 't': opts->threads   = strtol(optarg, NULL, 10); break;
+			case 'v': opts->verbose   = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (opts->threads < 0) {
+		fprintf(stderr, "Invalid number of threads\n");
+		return false;
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	return true;
+}
+
+
+struct fsck_ctx;
+
+/** Work on items [first, last) of a parallel pass. */
+typedef void (*fsck_job)(struct fsck_ctx *c, int first, int last);
+
+/** Checker state. */
+typedef struct fsck_ctx {
+	const fsck_opts *opts;
+	void *image;
+	size_t size;
+	a1fs_superblock *sb;
+	unsigned char *inode_bits;
+	unsigned char *block_bits;
+	a1fs_inode *itable;
+	/** Number of inodes. */
+	int ninodes;
+	/** Number of data blocks. */
+	int ndata;
+	/** Inode table blocks of each group. */
+	uint32_t group_iblocks;
+
+	/** Per-inode I_* flags. */
+	unsigned char *state;
+	/** Directory that links to each inode; -1 if none found yet. */
+	int *parent;
+	/** Number of subdirectories of each directory. */
+	int *subdirs;
+	/** Data blocks claimed by in-use inodes. */
+	unsigned char *claimed;
+	/** Some blocks were claimed more than once in pass 1. */
+	bool shared;
+
+	/** Directories at the current and the next level of pass 2. */
+	int *level, *next_level;
+	int level_len, next_len;
+
+	/** Counters filled in by the passes. */
+	long live_inodes, live_dirs, free_blocks;
+	/** Problems found. */
+	long problems;
+
+	/** Thread pool. */
+	pthread_t threads[FSCK_MAX_THREADS];
+	int nthreads;
+	pthread_barrier_t start, done;
+	/** Current job, its number of items, batch size and next item. */
+	fsck_job job;
+	int nitems, batch, next_item;
+	/** Tells the pool threads to exit. */
+	bool stop;
+
+} fsck_ctx;
+
+
+/**
+ * Report a problem, and how it was repaired unless running with -n.
+ *
+ * @param c    checker state.
+ * @param fix  what was done about it; NULL for just "fixed".
+ * @param fmt  printf() format of the problem description.
+ */
+__attribute__((format(printf, 3, 4)))
+static void problem(fsck_ctx *c, const char *fix, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	flockfile(stdout);
+	vprintf(fmt, args);
+	if (c->opts->no_repair) {
+		printf("\n");
+	} else {
+		printf(" - %s\n", fix ? fix : "fixed");
+	}
+	funlockfile(stdout);
+	va_end(args);
+	__atomic_fetch_add(&c->problems, 1, __ATOMIC_RELAXED);
+}
+
+static double elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+
+/** Take batches of items of the current job until there are none left. */
+static void run_batches(fsck_ctx *c)
+{
+	int first;
+	while ((first = __atomic_fetch_add(&c->next_item, c->batch, __ATOMIC_RELAXED)) < c->nitems) {
+		int last = first + c->batch;
+		c->job(c, first, last < c->nitems ? last : c->nitems);
+	}
+}
+
+static void *pool_worker(void *arg)
+{
+	fsck_ctx *c = arg;
+	while (true) {
+		pthread_barrier_wait(&c->start);
+		if (c->stop) {
+			break;
+		}
+		run_batches(c);
+		pthread_barrier_wait(&c->done);
+	}
+	return NULL;
+}
+
+/**
+ * Run a job over <nitems> items on all threads of the pool, the calling thread
+ * included, handing out <batch> items at a time. Returns when all are done.
+ */
+static void run_parallel(fsck_ctx *c, fsck_job job, int nitems, int batch)
+{
+	c->job = job;
+	c->nitems = nitems;
+	c->batch = batch;
+	c->next_item = 0;
+	pthread_barrier_wait(&c->start);
+	run_batches(c);
+	pthread_barrier_wait(&c->done);
+}
+
+static bool pool_start(fsck_ctx *c, int nthreads)
+{
+	c->nthreads = nthreads;
+	pthread_barrier_init(&c->start, NULL, nthreads);
+	pthread_barrier_init(&c->done, NULL, nthreads);
+	for (int t = 1; t < nthreads; t++) {
+		if (pthread_create(&c->threads[t], NULL, pool_worker, c) != 0) {
+			// The barriers count on every thread; the ones already started
+			// are left to exit with the process
+			fprintf(stderr, "fsck: could not start thread %d\n", t);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void pool_stop(fsck_ctx *c)
+{
+	c->stop = true;
+	pthread_barrier_wait(&c->start);
+	for (int t = 1; t < c->nthreads; t++) {
+		pthread_join(c->threads[t], NULL);
+	}
+	pthread_barrier_destroy(&c->start);
+	pthread_barrier_destroy(&c->done);
+}
+
+
+/**
+ * Mark a range of blocks as claimed.
+ *
+ * @return  true if any of them were claimed already.
+ */
+static bool claim_blocks(unsigned char *bits, int start, int count)
+{
+	bool shared = false;
+	for (int b = start; b < start + count; ) {
+		int n = 8 - b % 8;
+		if (n > start + count - b) {
+			n = start + count - b;
+		}
+		unsigned char mask = ((1u << n) - 1) << (b % 8);
+		shared |= (__atomic_fetch_or(&bits[b / 8], mask, __ATOMIC_RELAXED) & mask) != 0;
+		b += n;
+	}
+	return shared;
+}
+
+/** Unmark a range of claimed blocks. */
+static void unclaim_blocks(unsigned char *bits, int start, int count)
+{
+	for (int b = start; b < start + count; ) {
+		int n = 8 - b % 8;
+		if (n > start + count - b) {
+			n = start + count - b;
+		}
+		unsigned char mask = ((1u << n) - 1) << (b % 8);
+		__atomic_fetch_and(&bits[b / 8], (unsigned char)~mask, __ATOMIC_RELAXED);
+		b += n;
+	}
+}
+
+/** Check if any block in a range is claimed. */
+static bool any_claimed(const unsigned char *bits, int start, int count)
+{
+	for (int b = start; b < start + count; b++) {
+		if (check_bit_usage((unsigned char *)bits, b)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Check if an inode is in the part of its group's inode table not initialized yet. */
+static bool itable_unused(const fsck_ctx *c, int ino)
+{
+	uint32_t group = ino / c->sb->sb_group_inodes;
+	uint32_t block = ino % c->sb->sb_group_inodes / INODES_PER_BLOCK;
+	return block >= c->group_iblocks - c->sb->sb_groups[group].gd_itable_unused;
+}
+
+/** Number of blocks in the used extents of an inode. */
+static long inode_blocks(const a1fs_inode *inode)
+{
+	long n = 0;
+	for (int e = 0; e <= inode->last_used_extent; e++) {
+		n += inode->i_extent[e].count;
+	}
+	return n;
+}
+
+/** Cut an inode's extent list before extent <e>, and its size to match. */
+static void truncate_extents(fsck_ctx *c, int ino, int e)
+{
+	a1fs_inode *inode = &c->itable[ino];
+	inode->last_used_extent = e - 1;
+	uint64_t max_size = (uint64_t)inode_blocks(inode) * A1FS_BLOCK_SIZE;
+	if (S_ISREG(inode->mode) && (inode->size > max_size)) {
+		inode->size = max_size;
+	}
+	c->state[ino] |= I_CHANGED;
+}
+
+/** Free an inode, along with its blocks if they were claimed. */
+static void free_inode(fsck_ctx *c, int ino, bool claimed)
+{
+	a1fs_inode *inode = &c->itable[ino];
+	if (claimed) {
+		for (int e = 0; e <= inode->last_used_extent; e++) {
+			unclaim_blocks(c->claimed, inode->i_extent[e].start, inode->i_extent[e].count);
+		}
+	}
+	inode->links = 0;
+	inode->size = 0;
+	inode->last_used_extent = -1;
+	inode->num_entries = 0;
+	__atomic_fetch_and(&c->inode_bits[ino / 8], (unsigned char)~(1u << (ino % 8)),
+	                   __ATOMIC_RELAXED);
+	c->state[ino] &= ~I_LIVE;
+}
+
+
+/** Pass 1: check the inodes and claim their blocks. */
+static void pass1(fsck_ctx *c, int first, int last)
+{
+	bool shared = false;
+	for (int ino = first; ino < last; ino++) {
+		if (!check_bit_usage(c->inode_bits, ino)) {
+			continue;
+		}
+		c->state[ino] |= I_LIVE;
+		a1fs_inode *inode = &c->itable[ino];
+
+		// Whatever is there was never written by the file system
+		if (itable_unused(c, ino)) {
+			problem(c, "inode freed", "Inode %d: in the uninitialized part of the inode table",
+			        ino);
+			free_inode(c, ino, false);
+			continue;
+		}
+
+		// Checked first, since the checks below may change the inode
+		if (csum_inode(inode, ino) != inode->i_checksum) {
+			problem(c, NULL, "Inode %d: checksum mismatch", ino);
+			c->state[ino] |= I_CHANGED;
+		}
+
+		if (!S_ISREG(inode->mode) && !S_ISDIR(inode->mode)) {
+			// An orphan is only ever freed, so what it was doesn't matter
+			if (c->state[ino] & I_ORPHAN) {
+				problem(c, NULL, "Orphan inode %d: invalid mode 0%o", ino, inode->mode);
+				inode->mode = S_IFREG;
+				c->state[ino] |= I_CHANGED;
+			} else {
+				problem(c, "inode freed", "Inode %d: invalid mode 0%o", ino, inode->mode);
+				free_inode(c, ino, false);
+				continue;
+			}
+		}
+
+		if (inode->last_used_indirect != -1) {
+			problem(c, "dropped", "Inode %d: indirect block %d is not supported", ino,
+			        inode->last_used_indirect);
+			inode->last_used_indirect = -1;
+			c->state[ino] |= I_CHANGED;
+		}
+		if ((inode->last_used_extent < -1) || (inode->last_used_extent >= A1FS_MAX_EXTENTS)) {
+			problem(c, "truncated", "Inode %d: invalid extent count %d", ino,
+			        inode->last_used_extent + 1);
+			truncate_extents(c, ino, inode->last_used_extent < -1 ? 0 : A1FS_MAX_EXTENTS);
+		}
+		for (int e = 0; e <= inode->last_used_extent; e++) {
+			a1fs_extent *ext = &inode->i_extent[e];
+			if ((ext->count < 0) || (ext->start >= (a1fs_blk_t)c->ndata) ||
+			    (ext->count > c->ndata - (int)ext->start))
+			{
+				problem(c, "truncated", "Inode %d: extent %d (%u+%d) is out of range",
+				        ino, e, ext->start, ext->count);
+				truncate_extents(c, ino, e);
+				break;
+			}
+		}
+
+		uint64_t max_size = (uint64_t)inode_blocks(inode) * A1FS_BLOCK_SIZE;
+		if (S_ISREG(inode->mode) && (inode->size > max_size)) {
+			problem(c, NULL, "Inode %d: size %lu exceeds its %lu blocks", ino,
+			        (unsigned long)inode->size, (unsigned long)(max_size / A1FS_BLOCK_SIZE));
+			inode->size = max_size;
+			c->state[ino] |= I_CHANGED;
+		}
+
+		if (S_ISDIR(inode->mode) && !(c->state[ino] & I_ORPHAN)) {
+			for (int e = 0; e <= inode->last_used_extent; e++) {
+				if (csum_dir_extent(c->image, c->sb, ino, &inode->i_extent[e]) !=
+				    inode->i_dir_checksum[e])
+				{
+					problem(c, NULL, "Directory inode %d: extent %d checksum mismatch", ino, e);
+					c->state[ino] |= I_CHANGED;
+				}
+			}
+		}
+
+		for (int e = 0; e <= inode->last_used_extent; e++) {
+			shared |= claim_blocks(c->claimed, inode->i_extent[e].start, inode->i_extent[e].count);
+		}
+	}
+	if (shared) {
+		__atomic_store_n(&c->shared, true, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Pass 1b: give each block claimed by more than one inode to the lowest
+ * numbered one, and truncate the others before the extent that shares it. Only
+ * runs if pass 1 found such blocks, which is rare enough to be done serially.
+ */
+static void pass1b(fsck_ctx *c)
+{
+	memset(c->claimed, 0, (c->ndata + 7) / 8);
+	for (int ino = 0; ino < c->ninodes; ino++) {
+		if (!(c->state[ino] & I_LIVE)) {
+			continue;
+		}
+		a1fs_inode *inode = &c->itable[ino];
+		for (int e = 0; e <= inode->last_used_extent; e++) {
+			a1fs_extent *ext = &inode->i_extent[e];
+			if (any_claimed(c->claimed, ext->start, ext->count)) {
+				problem(c, "truncated", "Inode %d: extent %d (%u+%d) shares blocks with another inode",
+				        ino, e, ext->start, ext->count);
+				truncate_extents(c, ino, e);
+				break;
+			}
+			claim_blocks(c->claimed, ext->start, ext->count);
+		}
+	}
+}
+
+
+/** Check if a directory entry name is a valid path component. */
+static bool valid_name(const char *name)
+{
+	size_t len = strnlen(name, A1FS_NAME_MAX);
+	return (len > 0) && (len < A1FS_NAME_MAX) && (memchr(name, '/', len) == NULL);
+}
+
+/** Check the entries of a directory and queue its subdirectories. */
+static void check_dir(fsck_ctx *c, int dir)
+{
+	a1fs_inode *inode = &c->itable[dir];
+	uint32_t entries = 0;
+
+	for (int e = 0; e <= inode->last_used_extent; e++) {
+		a1fs_dentry *d = c->image + ((size_t)c->sb->sb_first_data_block + inode->i_extent[e].start)
+		                            * A1FS_BLOCK_SIZE;
+		size_t n = (size_t)inode->i_extent[e].count * A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
+		for (size_t i = 0; i < n; i++) {
+			int ino = d[i].ino;
+			if (ino == -1) {
+				continue;
+			}
+
+			const char *why = NULL;
+			if (!valid_name(d[i].name)) {
+				why = "has an invalid name";
+			} else if ((ino <= 0) || (ino >= c->ninodes)) {
+				why = "points to an invalid inode";
+			} else if (!(c->state[ino] & I_LIVE)) {
+				why = "points to a free inode";
+			} else if (c->state[ino] & I_ORPHAN) {
+				why = "points to an orphan";
+			} else {
+				// The first entry found keeps the inode
+				int none = -1;
+				if (!__atomic_compare_exchange_n(&c->parent[ino], &none, dir, false,
+				                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				{
+					why = "is an extra link";
+				}
+			}
+			if (why != NULL) {
+				problem(c, "cleared", "Directory inode %d: entry %zu of extent %d (inode %d) %s",
+				        dir, i, e, ino, why);
+				d[i].ino = -1;
+				d[i].name[0] = '\0';
+				c->state[dir] |= I_CHANGED;
+				continue;
+			}
+
+			entries++;
+			if (S_ISDIR(c->itable[ino].mode)) {
+				c->subdirs[dir]++;
+				int slot = __atomic_fetch_add(&c->next_len, 1, __ATOMIC_RELAXED);
+				c->next_level[slot] = ino;
+			}
+		}
+	}
+
+	if (inode->num_entries != entries) {
+		problem(c, NULL, "Directory inode %d: %u entries counted as %u", dir, entries,
+		        inode->num_entries);
+		inode->num_entries = entries;
+		c->state[dir] |= I_CHANGED;
+	}
+}
+
+/** Pass 2: check the directories at the current level of the tree. */
+static void pass2(fsck_ctx *c, int first, int last)
+{
+	for (int i = first; i < last; i++) {
+		check_dir(c, c->level[i]);
+	}
+}
+
+
+/** Pass 3: free unreachable inodes and fix link counts and checksums. */
+static void pass3(fsck_ctx *c, int first, int last)
+{
+	long live = 0, dirs = 0;
+	for (int ino = first; ino < last; ino++) {
+		if (!(c->state[ino] & I_LIVE)) {
+			continue;
+		}
+		a1fs_inode *inode = &c->itable[ino];
+		bool orphan = c->state[ino] & I_ORPHAN;
+
+		if ((ino != 0) && !orphan && (c->parent[ino] == -1)) {
+			problem(c, "inode freed", "Inode %d: not linked from any directory", ino);
+			free_inode(c, ino, true);
+			continue;
+		}
+
+		uint32_t links = orphan ? 0 : S_ISDIR(inode->mode) ? 2 + c->subdirs[ino] : 1;
+		if (inode->links != links) {
+			problem(c, NULL, "Inode %d: link count %u should be %u", ino, inode->links, links);
+			inode->links = links;
+			c->state[ino] |= I_CHANGED;
+		}
+
+		if (c->state[ino] & I_CHANGED) {
+			if (S_ISDIR(inode->mode)) {
+				for (int e = 0; e <= inode->last_used_extent; e++) {
+					inode->i_dir_checksum[e] = csum_dir_extent(c->image, c->sb, ino,
+					                                           &inode->i_extent[e]);
+				}
+			}
+			inode->i_checksum = csum_inode(inode, ino);
+		}
+
+		live++;
+		if (!orphan && S_ISDIR(inode->mode)) {
+			dirs++;
+		}
+	}
+	__atomic_fetch_add(&c->live_inodes, live, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->live_dirs, dirs, __ATOMIC_RELAXED);
+}
+
+
+/** Pass 4: make the block bitmap match the claimed blocks. */
+static void pass4(fsck_ctx *c, int first, int last)
+{
+	long free_blocks = 0, unused = 0, missing = 0;
+	int mismatch = -1;
+
+	// first is a multiple of 8, so whole bytes can be compared
+	for (int b = first; b < last; b += 8) {
+		int n = last - b < 8 ? last - b : 8;
+		unsigned char valid = (1u << n) - 1;
+		unsigned char bits = c->block_bits[b / 8];
+		unsigned char want = c->claimed[b / 8] & valid;
+		free_blocks += n - __builtin_popcount(want);
+		if ((bits & valid) == want) {
+			continue;
+		}
+		if (mismatch < 0) {
+			mismatch = b + __builtin_ctz((bits & valid) ^ want);
+		}
+		unused += __builtin_popcount(bits & valid & ~want);
+		missing += __builtin_popcount(~bits & want);
+		// Bits past the last data block are left alone
+		c->block_bits[b / 8] = (bits & ~valid) | want;
+	}
+
+	if (unused != 0) {
+		problem(c, NULL, "Blocks %d-%d: %ld blocks marked in use are free", first, last - 1,
+		        unused);
+	}
+	if (missing != 0) {
+		problem(c, NULL, "Blocks %d-%d: %ld blocks in use are marked free (first %d)",
+		        first, last - 1, missing, mismatch);
+	}
+	__atomic_fetch_add(&c->free_blocks, free_blocks, __ATOMIC_RELAXED);
+}
+
+
+/** Check that the layout in the superblock is usable at all. */
+static bool check_layout(fsck_ctx *c)
+{
+	a1fs_superblock *sb = c->sb;
+	size_t nblocks = c->size / A1FS_BLOCK_SIZE;
+	size_t itable_blocks = (sb->sb_inodes_count + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK;
+
+	if ((sb->size != c->size) || (sb->sb_inodes_count <= 0) || (sb->sb_inodes_count > INT_MAX) ||
+	    (sb->sb_inode_bitmap < 1) || (sb->sb_block_bitmap <= sb->sb_inode_bitmap) ||
+	    (sb->sb_inode_table <= sb->sb_block_bitmap) ||
+	    (sb->sb_inode_table + itable_blocks > sb->sb_first_data_block) ||
+	    (sb->sb_first_data_block >= nblocks))
+	{
+		return false;
+	}
+	c->ninodes = sb->sb_inodes_count;
+	c->ndata = nblocks - sb->sb_first_data_block;
+	c->group_iblocks = sb->sb_group_inodes / INODES_PER_BLOCK;
+
+	// Every group has whole inode table blocks and chunks, and some data blocks
+	if ((sb->sb_groups_count < 1) || (sb->sb_groups_count > A1FS_MAX_GROUPS) ||
+	    (c->group_iblocks == 0) || (sb->sb_group_inodes % INODES_PER_BLOCK != 0) ||
+	    ((int64_t)sb->sb_group_inodes * sb->sb_groups_count != sb->sb_inodes_count) ||
+	    (sb->sb_group_blocks == 0) || (sb->sb_group_blocks % A1FS_FSC_CHUNK != 0) ||
+	    ((size_t)(sb->sb_groups_count - 1) * sb->sb_group_blocks >= (size_t)c->ndata))
+	{
+		return false;
+	}
+
+	// The bitmaps must have a bit for every inode and data block
+	return ((size_t)(sb->sb_block_bitmap - sb->sb_inode_bitmap) * A1FS_BLOCK_SIZE * 8 >=
+	        (size_t)c->ninodes) &&
+	       ((size_t)(sb->sb_inode_table - sb->sb_block_bitmap) * A1FS_BLOCK_SIZE * 8 >=
+	        (size_t)c->ndata);
+}
+
+/** Walk the orphan list, and cut it at the first inode that can't be on it. */
+static void check_orphans(fsck_ctx *c)
+{
+	a1fs_ino_t *link = &c->sb->sb_orphan_head;
+	int prev = -1;
+	while (*link != 0) {
+		int ino = *link;
+		const char *why = NULL;
+		if ((ino < 0) || (ino >= c->ninodes) || itable_unused(c, ino) ||
+		    !check_bit_usage(c->inode_bits, ino))
+		{
+			why = "is not in use";
+		} else if (c->state[ino] & I_ORPHAN) {
+			why = "is on the list twice";
+		}
+		if (why != NULL) {
+			problem(c, "list cut", "Orphan list: inode %d %s", ino, why);
+			*link = 0;
+			if (prev >= 0) {
+				c->state[prev] |= I_CHANGED;
+			}
+			break;
+		}
+		c->state[ino] |= I_ORPHAN;
+		prev = ino;
+		link = &c->itable[ino].i_next_orphan;
+	}
+}
+
+/**
+ * Check and repair the file system.
+ *
+ * @return  exit status.
+ */
+static int fsck(fsck_ctx *c)
+{
+	const fsck_opts *opts = c->opts;
+	a1fs_superblock *sb = c->sb;
+	struct timespec start;
+
+	if (!check_layout(c)) {
+		fprintf(stderr, "%s: the superblock is damaged; the file system can't be checked\n",
+		        opts->img_path);
+		return FSCK_ERROR;
+	}
+	bool sb_bad = csum_super(sb) != sb->sb_checksum;
+	bool bitmaps_bad = csum_bitmaps(c->image, sb) != sb->sb_bitmap_checksum;
+
+	c->state = calloc(c->ninodes, sizeof(*c->state));
+	c->parent = malloc(c->ninodes * sizeof(*c->parent));
+	c->subdirs = calloc(c->ninodes, sizeof(*c->subdirs));
+	c->level = malloc(c->ninodes * sizeof(*c->level));
+	c->next_level = malloc(c->ninodes * sizeof(*c->next_level));
+	c->claimed = calloc((c->ndata + 7) / 8, 1);
+	if (!c->state || !c->parent || !c->subdirs || !c->level || !c->next_level || !c->claimed) {
+		fprintf(stderr, "%s: out of memory\n", opts->img_path);
+		return FSCK_ERROR;
+	}
+	memset(c->parent, 0xff, c->ninodes * sizeof(*c->parent));
+
+	if (sb_bad) {
+		problem(c, NULL, "Superblock checksum mismatch");
+	}
+	if (bitmaps_bad) {
+		problem(c, NULL, "Bitmap checksum mismatch");
+	}
+	if (sb->sb_mounted) {
+		problem(c, NULL, "Not unmounted cleanly");
+		sb->sb_mounted = 0;
+	}
+	for (uint32_t g = 0; g < sb->sb_groups_count; g++) {
+		if (sb->sb_groups[g].gd_itable_unused > c->group_iblocks) {
+			problem(c, NULL, "Group %u: uninitialized inode table blocks %u, more than it has",
+			        g, sb->sb_groups[g].gd_itable_unused);
+			sb->sb_groups[g].gd_itable_unused = 0;
+		}
+	}
+	if (sb->sb_reserved_blocks > (uint32_t)c->ndata) {
+		problem(c, NULL, "Reserved blocks %u, more than the data blocks", sb->sb_reserved_blocks);
+		sb->sb_reserved_blocks = 0;
+	}
+	check_orphans(c);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_parallel(c, pass1, c->ninodes, FSCK_INODE_BATCH);
+	if (c->shared) {
+		pass1b(c);
+	}
+	if (opts->verbose) {
+		printf("Pass 1: inodes and blocks checked in %.1f ms\n", elapsed_ms(&start));
+	}
+
+	if (!(c->state[0] & I_LIVE) || !S_ISDIR(c->itable[0].mode)) {
+		fprintf(stderr, "%s: the root directory is missing; the file system can't be repaired\n",
+		        opts->img_path);
+		return FSCK_ERROR;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	c->parent[0] = 0;
+	c->level[0] = 0;
+	c->level_len = 1;
+	int depth = 0;
+	while (c->level_len > 0) {
+		c->next_len = 0;
+		run_parallel(c, pass2, c->level_len, FSCK_DIR_BATCH);
+		int *tmp = c->level;
+		c->level = c->next_level;
+		c->next_level = tmp;
+		c->level_len = c->next_len;
+		depth++;
+	}
+	if (opts->verbose) {
+		printf("Pass 2: directory tree of depth %d checked in %.1f ms\n", depth, elapsed_ms(&start));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_parallel(c, pass3, c->ninodes, FSCK_INODE_BATCH);
+	if (opts->verbose) {
+		printf("Pass 3: connectivity and link counts checked in %.1f ms\n", elapsed_ms(&start));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_parallel(c, pass4, c->ndata, FSCK_BLOCK_BATCH);
+	if (opts->verbose) {
+		printf("Pass 4: block bitmap checked in %.1f ms\n", elapsed_ms(&start));
+	}
+
+	if (sb->sb_free_blocks_count != c->free_blocks) {
+		problem(c, NULL, "Free blocks count %ld should be %ld", (long)sb->sb_free_blocks_count,
+		        c->free_blocks);
+		sb->sb_free_blocks_count = c->free_blocks;
+	}
+	if (sb->sb_free_inodes_count != c->ninodes - c->live_inodes) {
+		problem(c, NULL, "Free inodes count %ld should be %ld", (long)sb->sb_free_inodes_count,
+		        c->ninodes - c->live_inodes);
+		sb->sb_free_inodes_count = c->ninodes - c->live_inodes;
+	}
+	if (sb->sb_used_dirs_count != c->live_dirs) {
+		problem(c, NULL, "Directories count %ld should be %ld", (long)sb->sb_used_dirs_count,
+		        c->live_dirs);
+		sb->sb_used_dirs_count = c->live_dirs;
+	}
+
+	if (c->problems == 0) {
+		printf("%s: clean, %ld/%d inodes, %ld/%d blocks\n", opts->img_path, c->live_inodes,
+		       c->ninodes, c->ndata - c->free_blocks, c->ndata);
+		return FSCK_OK;
+	}
+	if (opts->no_repair) {
+		printf("%s: %ld problems found\n", opts->img_path, c->problems);
+		return FSCK_UNFIXED;
+	}
+
+	// The free-space cache no longer matches the bitmap
+	sb->sb_fsc_gen = 0;
+	sb->sb_bitmap_checksum = csum_bitmaps(c->image, sb);
+	sb->sb_checksum = csum_super(sb);
+	if (msync(c->image, c->size, MS_SYNC) != 0) {
+		perror("msync");
+		return FSCK_ERROR | FSCK_UNFIXED;
+	}
+	printf("%s: %ld problems fixed, %ld/%d inodes, %ld/%d blocks\n", opts->img_path,
+	       c->problems, c->live_inodes, c->ninodes, c->ndata - c->free_blocks, c->ndata);
+	return FSCK_FIXED;
+}
+
+
+int main(int argc, char *argv[])
+{
+	fsck_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return FSCK_ERROR;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return FSCK_OK;
+	}
+
+	// Map image file into memory
+	size_t size;
+	int fd;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size, &fd);
+	if (image == NULL) return FSCK_ERROR;
+
+	// With -n the repairs go to a private copy of the image that is dropped
+	if (opts.no_repair &&
+	    (mmap(image, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+	{
+		perror("mmap");
+		munmap(image, size);
+		close(fd);
+		return FSCK_ERROR;
+	}
+
+	int ret = FSCK_ERROR;
+	a1fs_superblock *sb = image;
+	if (sb->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image does not contain a1fs\n");
+		goto end;
+	}
+	// Committed transactions that are not in place yet would look like damage
+	if (sb->sb_journal_blocks != 0) {
+		a1fs_journal_header *hdr = image + (size_t)sb->sb_journal_start * A1FS_BLOCK_SIZE;
+		if (((size_t)sb->sb_journal_start >= size / A1FS_BLOCK_SIZE) ||
+		    (hdr->magic != A1FS_JOURNAL_MAGIC) || !hdr->clean)
+		{
+			fprintf(stderr, "The journal needs to be replayed; mount the image first\n");
+			goto end;
+		}
+	}
+
+	int nthreads = opts.threads;
+	if (nthreads == 0) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > FSCK_MAX_THREADS) nthreads = FSCK_MAX_THREADS;
+
+	fsck_ctx c = {
+		.opts = &opts,
+		.image = image,
+		.size = size,
+		.sb = sb,
+		.inode_bits = image + (size_t)sb->sb_inode_bitmap * A1FS_BLOCK_SIZE,
+		.block_bits = image + (size_t)sb->sb_block_bitmap * A1FS_BLOCK_SIZE,
+		.itable = image + (size_t)sb->sb_inode_table * A1FS_BLOCK_SIZE,
+	};
+	if (!pool_start(&c, nthreads)) {
+		goto end;
+	}
+	if (opts.verbose) {
+		printf("%s: checking with %d threads\n", opts.img_path, nthreads);
+	}
+	ret = fsck(&c);
+	pool_stop(&c);
+
+	free(c.state);
+	free(c.parent);
+	free(c.subdirs);
+	free(c.level);
+	free(c.next_level);
+	free(c.claimed);
+end:
+	munmap(image, size);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,183 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs offline discard tool.
+ *
+ * Punches holes in an unmounted a1fs image for all free data blocks, so that
+ * the host file system can reuse the space.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "map.h"
+#include "util.h"
+
+
+/** Command line options. */
+typedef struct fstrim_opts {
+	/** File system image file path. */
+	const char *img_path;
+
+	/** Print help and exit. */
+	bool help;
+	/** Only report what would be discarded. */
+	bool dry_run;
+	/** Print the amount of space discarded. */
+	bool verbose;
+
+} fstrim_opts;
+
+static const char *help_str = "\
+Usage: %s options image\n\
+\n\
+Release the free space of an a1fs image to the host file system by punching\n\
+holes for all free blocks. The file system must not be mounted.\n\
+\n\
+Options:\n\
+    -h      print help and exit\n\
+    -n      dry run - only count the free space\n\
+    -v      print the amount of space discarded\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+
+static bool parse_args(int argc, char *argv[], fstrim_opts *opts)
+{
+	int o;
+	while ((o = getopt(argc, argv, "hnv")) != -1) {
+		switch (o) {
+			case 'h': opts->help    = true; return true;// skip other arguments
+			case 'n': opts->dry_run = true; break;
+			case 'v': opts->verbose = true; break;
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	return true;
+}
+
+
+/**
+ * Punch holes for every run of free data blocks.
+ *
+ * @param image  pointer to the start of the image.
+ * @param size   image size in bytes.
+ * @param fd     open file descriptor of the image.
+ * @param opts   command line options.
+ * @return       number of blocks discarded; -1 on error.
+ */
+static long fstrim(void *image, size_t size, int fd, fstrim_opts *opts)
+{
+	a1fs_superblock *sb = (a1fs_superblock *)image;
+	unsigned char *block_bits = (unsigned char *)(image + A1FS_BLOCK_SIZE * sb->sb_block_bitmap);
+	int nblocks = size / A1FS_BLOCK_SIZE - sb->sb_first_data_block;
+
+	long discarded = 0;
+	int b = 0;
+	while (b < nblocks) {
+		if (check_bit_usage(block_bits, b)) {
+			b++;
+			continue;
+		}
+		int run = b;
+		while ((b < nblocks) && !check_bit_usage(block_bits, b)) {
+			b++;
+		}
+
+		off_t off = (off_t)(sb->sb_first_data_block + run) * A1FS_BLOCK_SIZE;
+		if (!opts->dry_run &&
+		    (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+		               (size_t)(b - run) * A1FS_BLOCK_SIZE) != 0))
+		{
+			perror("fallocate");
+			return -1;
+		}
+		discarded += b - run;
+	}
+	return discarded;
+}
+
+
+int main(int argc, char *argv[])
+{
+	fstrim_opts opts = {0};// defaults are all 0
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return 0;
+	}
+
+	// Map image file into memory
+	size_t size;
+	int fd;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size, &fd);
+	if (image == NULL) return 1;
+
+	int ret = 1;
+	if (((a1fs_superblock *)image)->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image does not contain a1fs\n");
+		goto end;
+	}
+	// The bitmap in place may be missing blocks allocated by committed
+	// transactions
+	a1fs_superblock *sb = image;
+	if (sb->sb_journal_blocks != 0) {
+		a1fs_journal_header *hdr = image + (size_t)sb->sb_journal_start * A1FS_BLOCK_SIZE;
+		if ((hdr->magic != A1FS_JOURNAL_MAGIC) || !hdr->clean) {
+			fprintf(stderr, "The journal needs to be replayed; mount the image first\n");
+			goto end;
+		}
+	}
+
+	long discarded = fstrim(image, size, fd, &opts);
+	if (discarded < 0) {
+		fprintf(stderr, "Failed to discard free space\n");
+		goto end;
+	}
+	if (opts.verbose || opts.dry_run) {
+		printf("%s: %ld bytes (%ld blocks) %s\n", opts.img_path,
+		       discarded * A1FS_BLOCK_SIZE, discarded,
+		       opts.dry_run ? "free" : "trimmed");
+	}
+
+	ret = 0;
+end:
+	munmap(image, size);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,144 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Allocation groups implementation.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freecache.h"
+#include "group.h"
+#include "sbcount.h"
+#include "util.h"
+
+
+bool group_open(fs_ctx *fs)
+{
+	a1fs_superblock *sb = fs->sb;
+	fs->group_free_inodes = calloc(sb->sb_groups_count, sizeof(*fs->group_free_inodes));
+	if (fs->group_free_inodes == NULL) {
+		return false;
+	}
+
+	// Group slices start on a byte boundary, so whole words can be counted
+	for (uint32_t g = 0; g < sb->sb_groups_count; g++) {
+		const unsigned char *bits = fs->inode_bits + (size_t)g * sb->sb_group_inodes / 8;
+		int used = 0;
+		uint32_t i = 0;
+		for (; i + 64 <= sb->sb_group_inodes; i += 64) {
+			uint64_t word;
+			memcpy(&word, bits + i / 8, sizeof(word));
+			used += __builtin_popcountll(word);
+		}
+		for (; i < sb->sb_group_inodes; i += 8) {
+			used += __builtin_popcount(bits[i / 8]);
+		}
+		fs->group_free_inodes[g] = sb->sb_group_inodes - used;
+	}
+	return true;
+}
+
+void group_close(fs_ctx *fs)
+{
+	free(fs->group_free_inodes);
+	fs->group_free_inodes = NULL;
+}
+
+
+/** Number of free data blocks in a group. */
+static long group_free_blocks(fs_ctx *fs, int group)
+{
+	const a1fs_superblock *sb = fs->sb;
+	int ndata = fs->size / A1FS_BLOCK_SIZE - sb->sb_first_data_block;
+	int start = group * sb->sb_group_blocks;
+	int end = (group == (int)sb->sb_groups_count - 1) ? ndata : start + (int)sb->sb_group_blocks;
+	return freecache_count(fs, start, end - start);
+}
+
+/** Pick a group for a directory that starts a new tree. */
+static int find_group_dir(fs_ctx *fs)
+{
+	int ngroups = fs->sb->sb_groups_count;
+	long avg_inodes = sbc_read(fs, SBC_FREE_INODES) / ngroups;
+	long avg_blocks = sbc_read(fs, SBC_FREE_BLOCKS) / ngroups;
+
+	int start = __atomic_fetch_add(&fs->group_cursor, 1, __ATOMIC_RELAXED) % ngroups;
+	int best = -1;
+	int best_inodes = 0;
+	for (int i = 0; i < ngroups; i++) {
+		int g = (start + i) % ngroups;
+		int free_inodes = __atomic_load_n(&fs->group_free_inodes[g], __ATOMIC_RELAXED);
+		if (free_inodes == 0) {
+			continue;
+		}
+		if ((free_inodes >= avg_inodes) && (group_free_blocks(fs, g) >= avg_blocks)) {
+			return g;
+		}
+		// Failing that, the group with the most free inodes
+		if (free_inodes > best_inodes) {
+			best = g;
+			best_inodes = free_inodes;
+		}
+	}
+	return best;
+}
+
+/** Claim a free inode of a group in the inode bitmap; -1 if there is none. */
+static int claim_inode(fs_ctx *fs, int group)
+{
+	uint32_t per_group = fs->sb->sb_group_inodes;
+	unsigned char *bits = fs->inode_bits + (size_t)group * per_group / 8;
+	for (uint32_t byte = 0; byte < per_group / 8; byte++) {
+		unsigned char b = __atomic_load_n(&bits[byte], __ATOMIC_RELAXED);
+		while (b != 0xff) {
+			unsigned char mask = ~b & (b + 1);
+			b = __atomic_fetch_or(&bits[byte], mask, __ATOMIC_RELAXED);
+			if (!(b & mask)) {
+				return group * per_group + byte * 8 + __builtin_ctz(mask);
+			}
+			// Someone else took it; try the next free bit of the byte
+		}
+	}
+	return -1;
+}
+
+int group_alloc_inode(fs_ctx *fs, int parent, bool dir)
+{
+	int ngroups = fs->sb->sb_groups_count;
+	int first = (dir && (parent == 0)) ? find_group_dir(fs)
+	                                   : parent / (int)fs->sb->sb_group_inodes;
+	if (first < 0) {
+		return -1;
+	}
+
+	// The counts only narrow the search; the bitmap has the final say
+	for (int i = 0; i < ngroups; i++) {
+		int g = (first + i) % ngroups;
+		if (__atomic_load_n(&fs->group_free_inodes[g], __ATOMIC_RELAXED) <= 0) {
+			continue;
+		}
+		int ino = claim_inode(fs, g);
+		if (ino >= 0) {
+			sbc_add(fs, SBC_FREE_INODES, -1);
+			group_note_inode(fs, ino, true);
+			return ino;
+		}
+	}
+	return -1;
+}
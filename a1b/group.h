@@ -0,0 +1,94 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Allocation groups header file.
+ *
+ * Inodes and data blocks are split into groups (see a1fs.h), and the allocator
+ * keeps related things in the same group:
+ *
+ * - A directory created in the root starts a tree that is unrelated to the
+ *   others, so it goes into a group with more free inodes and blocks than
+ *   average, trying the groups in turn from a rotating start. Concurrent trees
+ *   thus allocate from different parts of the bitmaps.
+ * - Every other inode goes into the group of its parent directory, or the
+ *   next group with a free inode.
+ * - Data blocks are searched from the start of the group of their inode.
+ *
+ * The number of free inodes in each group is counted at mount and kept up to
+ * date with the inode bitmap; the free blocks come from the free-space cache,
+ * since chunks never straddle groups.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+
+
+/**
+ * Count the free inodes of each group. Must be called after journal_open().
+ *
+ * @param fs  file system context.
+ * @return    true on success; false if out of memory.
+ */
+bool group_open(fs_ctx *fs);
+
+/** Free the per-group counts. */
+void group_close(fs_ctx *fs);
+
+/**
+ * Record that an inode was allocated or freed. Called after the inode bitmap
+ * is updated.
+ *
+ * @param fs    file system context.
+ * @param ino   inode number.
+ * @param used  true if the inode was allocated, false if freed.
+ */
+static inline void group_note_inode(fs_ctx *fs, int ino, bool used)
+{
+	if (fs->group_free_inodes == NULL) {
+		return;
+	}
+	__atomic_fetch_add(&fs->group_free_inodes[ino / fs->sb->sb_group_inodes], used ? -1 : 1,
+	                   __ATOMIC_RELAXED);
+}
+
+/**
+ * First data block of the group of an inode, where the search for its data
+ * blocks starts.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number.
+ * @return     data block number.
+ */
+static inline int group_goal(const fs_ctx *fs, int ino)
+{
+	return (ino / fs->sb->sb_group_inodes) * fs->sb->sb_group_blocks;
+}
+
+/**
+ * Allocate an inode: pick a group for it, and mark a free inode of the group
+ * as used in the inode bitmap and the counters. The inode itself is not
+ * touched.
+ *
+ * @param fs      file system context.
+ * @param parent  inode number of the parent directory.
+ * @param dir     the new inode is a directory.
+ * @return        inode number; -1 if there are no free inodes.
+ */
+int group_alloc_inode(fs_ctx *fs, int parent, bool dir);
@@ -0,0 +1,919 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Metadata journal implementation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "csum.h"
+#include "journal.h"
+#include "sbcount.h"
+#include "util.h"
+
+
+/** Metadata blocks compared with the image per read while committing. */
+#define JOURNAL_CHUNK 64
+
+/** Smallest useful journal: header, descriptor, one block and commit. */
+#define JOURNAL_MIN_BLOCKS 4
+
+/**
+ * Blocks charged to every handle when it ends: the superblock, an inode bitmap
+ * block each for an allocated and a freed inode, and the inode table blocks of
+ * the inodes one callback changes. The rest of A1FS_JOURNAL_OP_FIXED is for
+ * directory and newly initialized inode table blocks, which are counted as
+ * they change, like the block bitmap.
+ */
+#define JOURNAL_HANDLE_BLOCKS 9
+
+static_assert(JOURNAL_HANDLE_BLOCKS <= A1FS_JOURNAL_OP_FIXED, "handle charge too large");
+
+
+/** Journal runtime state. */
+typedef struct a1fs_journal {
+	/** Held for reading by handles and for writing by a commit. */
+	pthread_rwlock_t lock;
+	/** Serializes commits. */
+	pthread_mutex_t commit_lock;
+	/** Number of handles ended so far. */
+	unsigned long gen;
+	/** Value of gen included in the last commit; under commit_lock. */
+	unsigned long committed_gen;
+	/**
+	 * Blocks the running transaction may take: those counted for the handles
+	 * that have ended, plus the most that each running handle may add.
+	 */
+	unsigned long credits;
+	/** Most blocks of a transaction that fits in the journal. */
+	unsigned long max_credits;
+	/** Most blocks a single handle may add to a transaction. */
+	unsigned long handle_credits;
+
+	/** First journal block in the image. */
+	a1fs_blk_t start;
+	/** Number of journal blocks, including the header. */
+	uint32_t nblocks;
+	/** Journal block where the next transaction goes. */
+	uint32_t head;
+	/** Sequence number of the next transaction. */
+	uint64_t seq;
+	/** The header on disk says that the journal is empty. */
+	bool clean;
+	/** A block logged since the last checkpoint was freed. */
+	bool revoked;
+	/** Bytes at the front of the image that are mapped privately. */
+	size_t meta_len;
+
+	/** Image blocks changed by the transaction being committed. */
+	a1fs_blk_t *list;
+	size_t nlist, list_cap;
+	/** Image blocks logged since the last checkpoint, one bit each. */
+	unsigned char *logged;
+	/**
+	 * Image blocks counted in credits since the last commit, one bit each.
+	 * Directory blocks are logged from here; the other metadata blocks are
+	 * found by comparing them with the image.
+	 */
+	unsigned char *dirty;
+	/** Block bitmap as of the last commit. */
+	unsigned char *disk_bits;
+	size_t bits_len;
+	/** Buffer for reading the image. */
+	unsigned char *scratch;
+	/** Descriptor block being written. */
+	a1fs_journal_desc desc;
+	/** Pieces of a descriptor and its blocks for one pwritev(). */
+	struct iovec iov[A1FS_JDESC_MAX + 1];
+
+	/** Protects stop; signalled to stop the commit thread. */
+	pthread_mutex_t thread_lock;
+	pthread_cond_t thread_cond;
+	/** Periodic commit thread. */
+	pthread_t thread;
+	/** The commit thread has been started. */
+	bool running;
+	/** Tells the commit thread to exit. */
+	bool stop;
+	/** A failed commit has been reported. */
+	bool failed;
+
+} a1fs_journal;
+
+
+/** pread() or pwrite() all of a range; 0 on success, -errno on error. */
+static int do_io(int fd, void *buf, size_t len, off_t pos, bool write)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = write ? pwrite(fd, buf + done, len - done, pos + done)
+		                  : pread(fd, buf + done, len - done, pos + done);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		if (n == 0) {
+			return -EIO;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+/** Read or write a journal block; 0 on success, -errno on error. */
+static int journal_io(fs_ctx *fs, uint32_t jblock, void *buf, bool write)
+{
+	a1fs_journal *j = fs->journal;
+	return do_io(fs->fd, buf, A1FS_BLOCK_SIZE,
+	             (off_t)(j->start + jblock) * A1FS_BLOCK_SIZE, write);
+}
+
+static int write_header(fs_ctx *fs, bool clean)
+{
+	a1fs_journal *j = fs->journal;
+	unsigned char buf[A1FS_BLOCK_SIZE] = {0};
+	a1fs_journal_header *hdr = (a1fs_journal_header *)buf;
+	hdr->magic = A1FS_JOURNAL_MAGIC;
+	hdr->clean = clean;
+	hdr->seq = j->seq;
+	return journal_io(fs, 0, buf, true);
+}
+
+static int sync_image(fs_ctx *fs)
+{
+	return (fdatasync(fs->fd) != 0) ? -errno : 0;
+}
+
+/** Check if a block may appear in a transaction. */
+static bool valid_target(const fs_ctx *fs, a1fs_blk_t block)
+{
+	const a1fs_journal *j = fs->journal;
+	return (block < fs->size / A1FS_BLOCK_SIZE) &&
+	       ((block < j->start) || (block >= j->start + j->nblocks));
+}
+
+/**
+ * Make everything committed so far durable in place and empty the journal.
+ * Called with the journal locked for writing, or while mounting.
+ */
+static int checkpoint(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	if (j->clean) {
+		return 0;
+	}
+
+	// The in-place writes must not be overtaken by the header
+	int ret = sync_image(fs);
+	if (ret == 0) ret = write_header(fs, true);
+	if (ret == 0) ret = sync_image(fs);
+	if (ret != 0) {
+		return ret;
+	}
+
+	j->head = 1;
+	j->clean = true;
+	j->revoked = false;
+	memset(j->logged, 0, (fs->size / A1FS_BLOCK_SIZE + 7) / 8);
+	return 0;
+}
+
+
+/**
+ * Check that a committed transaction starts at journal block <pos>.
+ *
+ * @param fs      file system context.
+ * @param pos     journal block of the first descriptor.
+ * @param seq     expected sequence number.
+ * @param commit  receives the journal block of the commit block.
+ * @return        true if the transaction is complete and intact.
+ */
+static bool scan_transaction(fs_ctx *fs, uint32_t pos, uint64_t seq, uint32_t *commit)
+{
+	a1fs_journal *j = fs->journal;
+	a1fs_journal_desc *desc = &j->desc;
+	uint32_t csum = 0;
+	bool any = false;
+
+	while (pos < j->nblocks) {
+		if (journal_io(fs, pos, desc, false) != 0) {
+			return false;
+		}
+
+		if ((desc->magic == A1FS_JDESC_MAGIC) && (desc->seq == seq) &&
+		    (desc->count <= A1FS_JDESC_MAX) && (pos + 1 + desc->count < j->nblocks))
+		{
+			csum = crc32c(csum, desc, A1FS_BLOCK_SIZE);
+			for (uint32_t i = 0; i < desc->count; i++) {
+				if (!valid_target(fs, desc->blocks[i]) ||
+				    (journal_io(fs, pos + 1 + i, j->scratch, false) != 0))
+				{
+					return false;
+				}
+				csum = crc32c(csum, j->scratch, A1FS_BLOCK_SIZE);
+			}
+			pos += 1 + desc->count;
+			any = true;
+			continue;
+		}
+
+		const a1fs_journal_commit *c = (const a1fs_journal_commit *)desc;
+		if (any && (c->magic == A1FS_JCOMMIT_MAGIC) && (c->seq == seq) &&
+		    (c->checksum == csum))
+		{
+			*commit = pos;
+			return true;
+		}
+		return false;
+	}
+	return false;
+}
+
+/** Write the blocks of the transaction in [pos, commit) in place. */
+static int apply_transaction(fs_ctx *fs, uint32_t pos, uint32_t commit)
+{
+	a1fs_journal *j = fs->journal;
+	a1fs_journal_desc *desc = &j->desc;
+
+	while (pos < commit) {
+		int ret = journal_io(fs, pos, desc, false);
+		for (uint32_t i = 0; (ret == 0) && (i < desc->count); i++) {
+			ret = journal_io(fs, pos + 1 + i, j->scratch, false);
+			if (ret == 0) {
+				ret = do_io(fs->fd, j->scratch, A1FS_BLOCK_SIZE,
+				            (off_t)desc->blocks[i] * A1FS_BLOCK_SIZE, true);
+			}
+		}
+		if (ret != 0) {
+			return ret;
+		}
+		pos += 1 + desc->count;
+	}
+	return 0;
+}
+
+/** Replay the committed transactions, starting with sequence number <seq>. */
+static int replay(fs_ctx *fs, uint64_t seq)
+{
+	a1fs_journal *j = fs->journal;
+	uint32_t pos = 1;
+	int ntrans = 0;
+
+	uint32_t commit;
+	while (scan_transaction(fs, pos, seq, &commit)) {
+		int ret = apply_transaction(fs, pos, commit);
+		if (ret != 0) {
+			return ret;
+		}
+		pos = commit + 1;
+		seq++;
+		ntrans++;
+	}
+	fprintf(stderr, "a1fs: replayed %d journal transaction%s\n", ntrans, ntrans == 1 ? "" : "s");
+
+	j->seq = seq;
+	j->clean = false;
+	return checkpoint(fs);
+}
+
+
+bool journal_open(fs_ctx *fs)
+{
+	a1fs_superblock *sb = fs->sb;
+	fs->journal = NULL;
+	if (sb->sb_journal_blocks == 0) {
+		return true;
+	}
+	if ((sb->sb_journal_blocks < JOURNAL_MIN_BLOCKS) ||
+	    (sb->sb_journal_start < sb->sb_inode_table) ||
+	    (sb->sb_journal_start + sb->sb_journal_blocks > sb->sb_first_data_block))
+	{
+		fprintf(stderr, "a1fs: invalid journal location\n");
+		return false;
+	}
+
+	a1fs_journal *j = calloc(1, sizeof(*j));
+	if (j == NULL) {
+		return false;
+	}
+	fs->journal = j;
+	j->start = sb->sb_journal_start;
+	j->nblocks = sb->sb_journal_blocks;
+	j->meta_len = (size_t)j->start * A1FS_BLOCK_SIZE;
+	j->bits_len = (fs->size / A1FS_BLOCK_SIZE - sb->sb_first_data_block + 7) / 8;
+	j->logged = calloc((fs->size / A1FS_BLOCK_SIZE + 7) / 8, 1);
+	j->dirty = calloc((fs->size / A1FS_BLOCK_SIZE + 7) / 8, 1);
+	j->disk_bits = malloc(j->bits_len);
+	j->scratch = malloc(JOURNAL_CHUNK * A1FS_BLOCK_SIZE);
+	if ((j->logged == NULL) || (j->dirty == NULL) || (j->disk_bits == NULL) ||
+	    (j->scratch == NULL))
+	{
+		goto fail;
+	}
+
+	// A transaction takes descriptors, the blocks and a commit block after the
+	// header. Every handle must fit in one on its own
+	unsigned long avail = j->nblocks - 2;
+	j->max_credits = avail - (avail + A1FS_JDESC_MAX) / (A1FS_JDESC_MAX + 1);
+	j->handle_credits = A1FS_JOURNAL_OP_BLOCKS(fs->size / A1FS_BLOCK_SIZE - sb->sb_first_data_block);
+	if (j->handle_credits > j->max_credits) {
+		fprintf(stderr, "a1fs: the journal is too small for this image; it needs at least %lu blocks\n",
+		        (unsigned long)A1FS_JOURNAL_MIN_BLOCKS(j->handle_credits));
+		goto fail;
+	}
+
+	a1fs_journal_header *hdr = (a1fs_journal_header *)j->scratch;
+	if (journal_io(fs, 0, hdr, false) != 0) {
+		perror("a1fs: journal");
+		goto fail;
+	}
+	if (hdr->magic != A1FS_JOURNAL_MAGIC) {
+		fprintf(stderr, "a1fs: invalid journal header\n");
+		goto fail;
+	}
+	j->seq = hdr->seq;
+	j->head = 1;
+	j->clean = true;
+	if (!hdr->clean) {
+		int ret = replay(fs, hdr->seq);
+		if (ret != 0) {
+			fprintf(stderr, "a1fs: journal replay failed: %s\n", strerror(-ret));
+			goto fail;
+		}
+	}
+
+	// From now on, metadata changes only reach the image through commits
+	if (mmap(fs->image, j->meta_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+	         fs->fd, 0) == MAP_FAILED)
+	{
+		perror("a1fs: journal: mmap");
+		goto fail;
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(fs->image, j->meta_len, MADV_HUGEPAGE);
+#endif
+	memcpy(j->disk_bits, fs->block_bits, j->bits_len);
+
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	// Commits must not starve behind a steady stream of handles
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&j->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	pthread_mutex_init(&j->commit_lock, NULL);
+	pthread_mutex_init(&j->thread_lock, NULL);
+	pthread_cond_init(&j->thread_cond, NULL);
+	return true;
+
+fail:
+	free(j->scratch);
+	free(j->disk_bits);
+	free(j->dirty);
+	free(j->logged);
+	free(j);
+	fs->journal = NULL;
+	return false;
+}
+
+
+/** Add an image block to the transaction being committed. */
+static bool list_add(a1fs_journal *j, a1fs_blk_t block)
+{
+	if (j->nlist == j->list_cap) {
+		size_t cap = j->list_cap ? j->list_cap * 2 : 256;
+		a1fs_blk_t *list = realloc(j->list, cap * sizeof(*list));
+		if (list == NULL) {
+			return false;
+		}
+		j->list = list;
+		j->list_cap = cap;
+	}
+	j->list[j->nlist++] = block;
+	return true;
+}
+
+/**
+ * Add the directory blocks that changed. Directory entries are written in
+ * place, so their blocks are logged to match the inodes that refer to them.
+ *
+ * @param fs  file system context.
+ * @return    true on success; false if out of memory.
+ */
+static bool add_directories(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	a1fs_blk_t first = fs->sb->sb_first_data_block;
+	a1fs_blk_t end = fs->size / A1FS_BLOCK_SIZE;
+
+	for (a1fs_blk_t b = first; b < end; b++) {
+		if (j->dirty[b / 8] == 0) {
+			b |= 7;
+			continue;
+		}
+		if (check_bit_usage(j->dirty, b) && check_bit_usage(fs->block_bits, b - first) &&
+		    !list_add(j, b))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Update the checksums of the inodes that changed in a block of the inode
+ * table, and of the blocks of changed directories.
+ *
+ * @param fs     file system context.
+ * @param block  image block of the inode table.
+ * @param old    the block as it is in the image.
+ */
+static void update_inodes(fs_ctx *fs, a1fs_blk_t block, const unsigned char *old)
+{
+	const int per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_inode);
+	const a1fs_inode *old_inodes = (const a1fs_inode *)old;
+	int first = (block - fs->sb->sb_inode_table) * per_block;
+
+	for (int k = 0; (k < per_block) && (first + k < fs->sb->sb_inodes_count); k++) {
+		if (memcmp(&fs->itable[first + k], &old_inodes[k], sizeof(a1fs_inode)) != 0) {
+			csum_update_inode(fs, first + k);
+		}
+	}
+}
+
+/**
+ * Collect the blocks of the transaction: the metadata blocks that differ from
+ * the image, and the blocks of changed directories.
+ */
+static int collect(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	a1fs_superblock *sb = fs->sb;
+	a1fs_superblock old_sb;
+	j->nlist = 0;
+
+	// No handles are open, so the counters match the bitmaps
+	sbc_fold(fs);
+
+	for (a1fs_blk_t b = 0; b < j->start; b += JOURNAL_CHUNK) {
+		size_t n = (j->start - b < JOURNAL_CHUNK) ? j->start - b : JOURNAL_CHUNK;
+		int ret = do_io(fs->fd, j->scratch, n * A1FS_BLOCK_SIZE, (off_t)b * A1FS_BLOCK_SIZE, false);
+		if (ret != 0) {
+			return ret;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			const unsigned char *old = j->scratch + i * A1FS_BLOCK_SIZE;
+			void *cur = fs->image + (b + i) * A1FS_BLOCK_SIZE;
+			// The superblock takes the checksums of everything else, so it
+			// is compared last
+			if (b + i == 0) {
+				memcpy(&old_sb, old, sizeof(old_sb));
+				continue;
+			}
+			if (memcmp(old, cur, A1FS_BLOCK_SIZE) == 0) {
+				continue;
+			}
+			if (!list_add(j, b + i)) {
+				return -ENOMEM;
+			}
+
+			if (b + i < sb->sb_inode_table) {
+				sb->sb_bitmap_checksum ^= csum_bitmap_block(old, b + i) ^
+				                          csum_bitmap_block(cur, b + i);
+				continue;
+			}
+			update_inodes(fs, b + i, old);
+		}
+	}
+	if (!add_directories(fs)) {
+		return -ENOMEM;
+	}
+
+	sb->sb_checksum = csum_super(sb);
+	if ((memcmp(&old_sb, sb, sizeof(old_sb)) != 0) && !list_add(j, 0)) {
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/** Write the transaction at the journal head and wait until it is durable. */
+static int write_transaction(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	uint32_t pos = j->head;
+	uint32_t csum = 0;
+
+	// Replay must look at the journal as soon as anything is committed
+	if (j->clean) {
+		int ret = write_header(fs, false);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	for (size_t i = 0; i < j->nlist; i += A1FS_JDESC_MAX) {
+		size_t n = (j->nlist - i < A1FS_JDESC_MAX) ? j->nlist - i : A1FS_JDESC_MAX;
+		memset(&j->desc, 0, sizeof(j->desc));
+		j->desc.magic = A1FS_JDESC_MAGIC;
+		j->desc.count = n;
+		j->desc.seq = j->seq;
+		memcpy(j->desc.blocks, &j->list[i], n * sizeof(a1fs_blk_t));
+
+		csum = crc32c(csum, &j->desc, A1FS_BLOCK_SIZE);
+		j->iov[0] = (struct iovec){ .iov_base = &j->desc, .iov_len = A1FS_BLOCK_SIZE };
+		for (size_t k = 0; k < n; k++) {
+			void *data = fs->image + (size_t)j->list[i + k] * A1FS_BLOCK_SIZE;
+			csum = crc32c(csum, data, A1FS_BLOCK_SIZE);
+			j->iov[1 + k] = (struct iovec){ .iov_base = data, .iov_len = A1FS_BLOCK_SIZE };
+		}
+
+		size_t len = (n + 1) * A1FS_BLOCK_SIZE;
+		ssize_t done = pwritev(fs->fd, j->iov, n + 1, (off_t)(j->start + pos) * A1FS_BLOCK_SIZE);
+		if (done != (ssize_t)len) {
+			return (done < 0) ? -errno : -EIO;
+		}
+		pos += n + 1;
+	}
+
+	// One flush covers the header, the blocks and the commit block; replay
+	// checks the checksum in case the commit block got there first
+	unsigned char buf[A1FS_BLOCK_SIZE] = {0};
+	a1fs_journal_commit *c = (a1fs_journal_commit *)buf;
+	c->magic = A1FS_JCOMMIT_MAGIC;
+	c->checksum = csum;
+	c->seq = j->seq;
+	int ret = journal_io(fs, pos, buf, true);
+	if (ret == 0) ret = sync_image(fs);
+	if (ret != 0) {
+		return ret;
+	}
+
+	j->clean = false;
+	j->head = pos + 1;
+	j->seq++;
+	return 0;
+}
+
+/** Write the metadata blocks of the transaction in place. */
+static int write_in_place(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	for (size_t i = 0; i < j->nlist; i++) {
+		if (j->list[i] >= j->start) {
+			continue;// directory blocks are already there
+		}
+		int ret = do_io(fs->fd, fs->image + (size_t)j->list[i] * A1FS_BLOCK_SIZE,
+		                A1FS_BLOCK_SIZE, (off_t)j->list[i] * A1FS_BLOCK_SIZE, true);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/** Start counting credits for a new transaction. */
+static void reset_credits(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	memset(j->dirty, 0, (fs->size / A1FS_BLOCK_SIZE + 7) / 8);
+	j->credits = 0;
+}
+
+/** Commit with the journal locked for writing. */
+static int commit_locked(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	int ret = collect(fs);
+	if (ret != 0) {
+		return ret;
+	}
+	if (j->nlist == 0) {
+		reset_credits(fs);
+		return 0;
+	}
+
+	size_t ndesc = (j->nlist + A1FS_JDESC_MAX - 1) / A1FS_JDESC_MAX;
+	size_t need = ndesc + j->nlist + 1;
+
+	// Handles are counted so that this only happens after a failed commit
+	// has left more behind than the journal takes
+	if (need > j->nblocks - 1) {
+		fprintf(stderr, "a1fs: transaction of %zu blocks does not fit in the journal\n",
+		        j->nlist);
+		return -ENOSPC;
+	}
+
+	// Replay must not write an old image of a freed block over its new
+	// contents, so those images go away with a checkpoint first
+	if (j->revoked || (j->head + need > j->nblocks)) {
+		ret = checkpoint(fs);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	ret = write_transaction(fs);
+	if (ret == 0) ret = write_in_place(fs);
+	if (ret != 0) {
+		return ret;
+	}
+	for (size_t i = 0; i < j->nlist; i++) {
+		j->logged[j->list[i] / 8] |= 1 << (j->list[i] % 8);
+	}
+	reset_credits(fs);
+
+	pthread_mutex_lock(&fs->lock);
+	memcpy(j->disk_bits, fs->block_bits, j->bits_len);
+	pthread_mutex_unlock(&fs->lock);
+	return 0;
+}
+
+/** Commit everything ended so far. The caller holds commit_lock. */
+static int commit_all(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	pthread_rwlock_wrlock(&j->lock);
+	unsigned long gen = j->gen;
+	int ret = commit_locked(fs);
+	if (ret == 0) {
+		j->committed_gen = gen;
+	}
+	pthread_rwlock_unlock(&j->lock);
+	return ret;
+}
+
+bool journal_commit_mount(fs_ctx *fs)
+{
+	if (fs->journal == NULL) {
+		return true;
+	}
+	// Nothing else runs yet
+	int ret = commit_locked(fs);
+	if (ret != 0) {
+		fprintf(stderr, "a1fs: journal: %s\n", strerror(-ret));
+	}
+	return ret == 0;
+}
+
+/** Report the first failed commit. */
+static void commit_failed(a1fs_journal *j, int ret)
+{
+	if (!__atomic_exchange_n(&j->failed, true, __ATOMIC_RELAXED)) {
+		fprintf(stderr, "a1fs: journal commit failed: %s\n", strerror(-ret));
+	}
+}
+
+int journal_commit(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	if (j == NULL) {
+		return 0;
+	}
+
+	unsigned long want = __atomic_load_n(&j->gen, __ATOMIC_ACQUIRE);
+	pthread_mutex_lock(&j->commit_lock);
+	// Someone else may have committed our handles while we waited
+	int ret = (j->committed_gen >= want) ? 0 : commit_all(fs);
+	pthread_mutex_unlock(&j->commit_lock);
+	return ret;
+}
+
+/**
+ * Commit the running transaction if a new handle might not fit in it.
+ *
+ * @param fs  file system context.
+ * @return    true on success; false if the commit failed.
+ */
+static bool make_room(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	int ret = 0;
+
+	pthread_mutex_lock(&j->commit_lock);
+	// Someone else may have committed while we waited
+	if (__atomic_load_n(&j->credits, __ATOMIC_RELAXED) + j->handle_credits > j->max_credits) {
+		ret = commit_all(fs);
+	}
+	pthread_mutex_unlock(&j->commit_lock);
+
+	if (ret != 0) {
+		commit_failed(j, ret);
+	}
+	return ret == 0;
+}
+
+void journal_begin(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	if (j == NULL) {
+		return;
+	}
+
+	// Set aside room for the most the handle may change, so that the
+	// transaction it goes into fits in the journal; if there is none left,
+	// the running transaction is committed first. Should that fail, the
+	// handle goes ahead anyway and the next commits report the error
+	while (true) {
+		pthread_rwlock_rdlock(&j->lock);
+		unsigned long credits = __atomic_add_fetch(&j->credits, j->handle_credits, __ATOMIC_RELAXED);
+		if (credits <= j->max_credits) {
+			return;
+		}
+		__atomic_fetch_sub(&j->credits, j->handle_credits, __ATOMIC_RELAXED);
+		pthread_rwlock_unlock(&j->lock);
+
+		if (!make_room(fs)) {
+			pthread_rwlock_rdlock(&j->lock);
+			__atomic_fetch_add(&j->credits, j->handle_credits, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+}
+
+void journal_end(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	if (j != NULL) {
+		// The blocks counted as they changed stay, and the rest of the room
+		// set aside gives way to what every handle is charged
+		__atomic_fetch_sub(&j->credits, j->handle_credits - JOURNAL_HANDLE_BLOCKS, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&j->gen, 1, __ATOMIC_RELEASE);
+		pthread_rwlock_unlock(&j->lock);
+	}
+}
+
+/** Count an image block in the running transaction, once. */
+static void note_block(a1fs_journal *j, a1fs_blk_t block)
+{
+	unsigned char bit = 1 << (block % 8);
+	if (!(__atomic_fetch_or(&j->dirty[block / 8], bit, __ATOMIC_RELAXED) & bit)) {
+		__atomic_fetch_add(&j->credits, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/** Count the block bitmap blocks that cover a range of data blocks. */
+static void note_bitmap(fs_ctx *fs, int start, int count)
+{
+	const int bits_per_block = A1FS_BLOCK_SIZE * 8;
+	for (int b = start / bits_per_block; b <= (start + count - 1) / bits_per_block; b++) {
+		note_block(fs->journal, fs->sb->sb_block_bitmap + b);
+	}
+}
+
+void journal_note_change(fs_ctx *fs, const void *addr)
+{
+	if (fs->journal != NULL) {
+		note_block(fs->journal,
+		           ((const unsigned char *)addr - (const unsigned char *)fs->image) / A1FS_BLOCK_SIZE);
+	}
+}
+
+void journal_note_alloc(fs_ctx *fs, int start, int count)
+{
+	if ((fs->journal != NULL) && (count > 0)) {
+		note_bitmap(fs, start, count);
+	}
+}
+
+void journal_note_free(fs_ctx *fs, int start, int count)
+{
+	a1fs_journal *j = fs->journal;
+	if ((j == NULL) || (count <= 0)) {
+		return;
+	}
+	note_bitmap(fs, start, count);
+
+	bool revoked = __atomic_load_n(&j->revoked, __ATOMIC_RELAXED);
+	for (int i = 0; i < count; i++) {
+		a1fs_blk_t b = fs->sb->sb_first_data_block + start + i;
+		// Whatever the block holds next is not a directory entry of ours
+		__atomic_fetch_and(&j->dirty[b / 8], (unsigned char)~(1 << (b % 8)), __ATOMIC_RELAXED);
+		if (!revoked && (j->logged[b / 8] & (1 << (b % 8)))) {
+			__atomic_store_n(&j->revoked, true, __ATOMIC_RELAXED);
+			revoked = true;
+		}
+	}
+}
+
+bool journal_block_free(const fs_ctx *fs, int block)
+{
+	return (fs->journal == NULL) || !check_bit_usage(fs->journal->disk_bits, block);
+}
+
+
+/** Commit thread: commit every A1FS_JOURNAL_INTERVAL_MS until told to stop. */
+static void *journal_worker(void *arg)
+{
+	fs_ctx *fs = (fs_ctx*)arg;
+	a1fs_journal *j = fs->journal;
+
+	pthread_mutex_lock(&j->thread_lock);
+	while (!j->stop) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += (A1FS_JOURNAL_INTERVAL_MS % 1000) * 1000000L;
+		until.tv_sec += A1FS_JOURNAL_INTERVAL_MS / 1000 + until.tv_nsec / 1000000000L;
+		until.tv_nsec %= 1000000000L;
+		while (!j->stop &&
+		       (pthread_cond_timedwait(&j->thread_cond, &j->thread_lock, &until) != ETIMEDOUT));
+		if (j->stop) {
+			break;
+		}
+		pthread_mutex_unlock(&j->thread_lock);
+
+		int ret = journal_commit(fs);
+		if (ret != 0) {
+			commit_failed(j, ret);
+		}
+
+		pthread_mutex_lock(&j->thread_lock);
+	}
+	pthread_mutex_unlock(&j->thread_lock);
+
+	return NULL;
+}
+
+bool journal_start(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	if (j == NULL) {
+		return true;
+	}
+
+	j->stop = false;
+	int err = pthread_create(&j->thread, NULL, journal_worker, fs);
+	if (err != 0) {
+		fprintf(stderr, "journal_start: pthread_create: %s\n", strerror(err));
+		return false;
+	}
+	j->running = true;
+	return true;
+}
+
+void journal_stop(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	if ((j == NULL) || !j->running) {
+		return;
+	}
+
+	pthread_mutex_lock(&j->thread_lock);
+	j->stop = true;
+	pthread_cond_signal(&j->thread_cond);
+	pthread_mutex_unlock(&j->thread_lock);
+
+	pthread_join(j->thread, NULL);
+	j->running = false;
+}
+
+void journal_close(fs_ctx *fs)
+{
+	a1fs_journal *j = fs->journal;
+	if (j == NULL) {
+		return;
+	}
+
+	// Leave a clean journal behind, so the next mount has nothing to replay.
+	// Everything else has stopped, so whatever changed goes in regardless of
+	// handles. The image is cleanly unmounted with this commit
+	fs->sb->sb_mounted = 0;
+	int ret = commit_locked(fs);
+	if (ret == 0) ret = checkpoint(fs);
+	if (ret != 0) {
+		fprintf(stderr, "a1fs: journal: %s\n", strerror(-ret));
+	}
+
+	pthread_cond_destroy(&j->thread_cond);
+	pthread_mutex_destroy(&j->thread_lock);
+	pthread_mutex_destroy(&j->commit_lock);
+	pthread_rwlock_destroy(&j->lock);
+	free(j->list);
+	free(j->scratch);
+	free(j->disk_bits);
+	free(j->dirty);
+	free(j->logged);
+	free(j);
+	fs->journal = NULL;
+}
@@ -0,0 +1,163 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Metadata journal header file.
+ *
+ * If the image has a journal (see a1fs.h), the superblock, bitmaps and inode
+ * table are mapped privately: callbacks change them in memory only, and the
+ * changes reach the image through the journal. Every callback that changes
+ * metadata runs as a handle (journal_begin() ... journal_end()). A commit
+ * waits for the running handles to finish, keeps new ones out, and writes
+ * everything they changed as one transaction: the metadata blocks that differ
+ * from the image, and the directory blocks whose entries changed. Once the
+ * transaction is durable, the metadata blocks are written in place.
+ *
+ * A transaction must fit in the journal, so each handle is counted against its
+ * size: when it starts, for the most a single callback can change (see
+ * A1FS_JOURNAL_OP_BLOCKS()), and when it ends, for the bitmap and directory
+ * blocks it actually changed and a fixed share for the rest. A handle that
+ * might not fit commits the running transaction first.
+ *
+ * Commits happen every A1FS_JOURNAL_INTERVAL_MS, on fsync() and at unmount;
+ * all handles finished since the previous commit go into the same transaction,
+ * so concurrent fsync() calls share one journal write. When the journal is
+ * full, it is checkpointed: the in-place writes are made durable and the
+ * journal starts over. At mount, committed transactions are replayed in order
+ * and the journal is checkpointed, which only reads the journal.
+ *
+ * Only metadata is journaled; file data is written in place as before.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "fs_ctx.h"
+
+
+/** Interval between periodic commits. */
+#define A1FS_JOURNAL_INTERVAL_MS 5000
+
+
+/**
+ * Replay the journal and switch the metadata region of the image to a private
+ * mapping. Does nothing if the image has no journal. Must be called after
+ * fs_ctx_init(), before anything changes the metadata.
+ *
+ * @param fs  file system context.
+ * @return    true on success; false on failure (e.g. an invalid journal).
+ */
+bool journal_open(fs_ctx *fs);
+
+/**
+ * Commit what csum_open() changed: sb_mounted, and the checksums recomputed
+ * after a crash. Must come before anything is written in place. Does nothing
+ * if the image has no journal.
+ *
+ * @param fs  file system context.
+ * @return    true on success; false if the commit failed.
+ */
+bool journal_commit_mount(fs_ctx *fs);
+
+/**
+ * Commit the remaining changes, checkpoint the journal and free its state.
+ * The commit thread and all other writers must be stopped.
+ *
+ * @param fs  file system context.
+ */
+void journal_close(fs_ctx *fs);
+
+/**
+ * Start the periodic commit thread.
+ *
+ * @param fs  file system context.
+ * @return    true on success or if there is no journal; false on failure.
+ */
+bool journal_start(fs_ctx *fs);
+
+/**
+ * Stop the periodic commit thread.
+ *
+ * @param fs  file system context.
+ */
+void journal_stop(fs_ctx *fs);
+
+/**
+ * Start a handle: a group of metadata changes that is committed as a whole.
+ * Handles don't nest, and must not be started while holding fs->lock. May
+ * commit the running transaction to make room for the handle.
+ *
+ * @param fs  file system context.
+ */
+void journal_begin(fs_ctx *fs);
+
+/**
+ * End a handle started with journal_begin().
+ *
+ * @param fs  file system context.
+ */
+void journal_end(fs_ctx *fs);
+
+/**
+ * Commit all handles that have ended and wait until the transaction is
+ * durable. Must not be called from within a handle.
+ *
+ * @param fs  file system context.
+ * @return    0 on success; -errno on error.
+ */
+int journal_commit(fs_ctx *fs);
+
+/**
+ * Record a change to the block of the image that holds <addr>, other than to
+ * an inode: a directory entry, which goes into the next transaction, or a newly
+ * initialized inode table block. Called within a handle.
+ *
+ * @param fs    file system context.
+ * @param addr  changed address in the image.
+ */
+void journal_note_change(fs_ctx *fs, const void *addr);
+
+/**
+ * Record that data blocks were allocated, which changes the block bitmap.
+ * Called within a handle.
+ *
+ * @param fs     file system context.
+ * @param start  first allocated data block.
+ * @param count  number of blocks.
+ */
+void journal_note_alloc(fs_ctx *fs, int start, int count);
+
+/**
+ * Record that data blocks were freed. If one of them has been logged since the
+ * last checkpoint, the next commit checkpoints first, so that replay can't
+ * write the old contents over whatever the block is used for next. Called
+ * within a handle.
+ *
+ * @param fs     file system context.
+ * @param start  first freed data block.
+ * @param count  number of blocks.
+ */
+void journal_note_free(fs_ctx *fs, int start, int count);
+
+/**
+ * Check if a data block is free as of the last commit, i.e. if its contents
+ * can be thrown away without a crash bringing it back into use. Always true
+ * without a journal. The caller holds fs->lock.
+ *
+ * @param fs     file system context.
+ * @param block  data block number.
+ * @return       true if the block is free on disk.
+ */
+bool journal_block_free(const fs_ctx *fs, int block);
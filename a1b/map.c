@@ -17,7 +17,10 @@
  */
 
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -26,22 +29,40 @@
 #include "util.h"
 
 
-void *map_file(const char *path, size_t block_size, size_t *size)
+void *map_file(const char *path, size_t block_size, size_t *size, int *fdp)
 {
-	// Open the file for reading and writing
-	int fd = open(path, O_RDWR);
+	struct stat s;
+	if (stat(path, &s) < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	// Open the file for reading and writing. A block device is claimed
+	// exclusively, which fails if it is mounted or in use by another a1fs
+	int fd = open(path, O_RDWR | (S_ISBLK(s.st_mode) ? O_EXCL : 0));
 	if (fd < 0) {
 		perror(path);
 		return NULL;
 	}
 
 	void *addr = NULL;
-	// Get file size
-	struct stat s;
+	// Get file size; a block device reports its size through an ioctl
 	if (fstat(fd, &s) < 0) {
 		perror("fstat");
 		goto end;
 	}
+	if (S_ISBLK(s.st_mode)) {
+		uint64_t dev_size;
+		if (ioctl(fd, BLKGETSIZE64, &dev_size) < 0) {
+			perror("BLKGETSIZE64");
+			goto end;
+		}
+		// Only whole blocks are used; a partial block at the end stays unused
+		s.st_size = dev_size - dev_size % block_size;
+	} else if (!S_ISREG(s.st_mode)) {
+		fprintf(stderr, "Image must be a regular file or a block device\n");
+		goto end;
+	}
 
 	// Check that the file size is valid
 	if (s.st_size == 0) {
@@ -53,17 +74,39 @@ void *map_file(const char *path, size_t block_size, size_t *size)
 		goto end;
 	}
 
+	// Reserve enough address space to align the mapping to a huge page, so
+	// that the metadata at the front of the image can be backed by huge pages
+	size_t span = s.st_size + MAP_HUGE_ALIGN;
+	void *area = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (area == MAP_FAILED) {
+		perror("mmap");
+		goto end;
+	}
+	void *aligned = (void *)align_up((size_t)area, MAP_HUGE_ALIGN);
+
 	// Map file contents into memory
-	addr = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	addr = mmap(aligned, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
 	if (addr == MAP_FAILED) {
 		perror("mmap");
+		munmap(area, span);
 		addr = NULL;
 		goto end;
 	}
+	// Give back the rest of the reservation
+	if (aligned != area) {
+		munmap(area, aligned - area);
+	}
+	munmap(aligned + s.st_size, (area + span) - (aligned + s.st_size));
 	assert(is_aligned((size_t)addr, block_size));
 	*size = s.st_size;
 
 end:
+	// Hand the descriptor to the caller if it wants to do I/O on the image
+	if ((addr != NULL) && (fdp != NULL)) {
+		*fdp = fd;
+		return addr;
+	}
+
 	//NOTE: memory mapping keeps a reference to the open file; can safely close
 	// the file descriptor now; a future munmap() will close the file
 	close(fd);
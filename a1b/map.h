@@ -21,15 +21,23 @@
 #include <stddef.h>
 
 
+/** Alignment of file mappings: the usual x86-64 and arm64 huge page size. */
+#define MAP_HUGE_ALIGN (2 * 1024 * 1024)
+
+
 /**
  * Map the whole file into memory for reading and writing.
  *
- * File size must be a non-zero multiple of the block_size.
+ * File size must be a non-zero multiple of the block_size. The file can also
+ * be a block device, which is opened exclusively; its size is rounded down to
+ * a multiple of block_size.
  *
  * @param path        image file path.
  * @param block_size  file system block size.
  * @param size        pointer to the variable that will be set to file size.
+ * @param fd          pointer to the variable that will be set to the open file
+ *                    descriptor of the image; NULL to close it after mapping.
  * @return            pointer to the file mapping in memory on success;
  *                    NULL on failure.
  */
-void *map_file(const char *path, size_t block_size, size_t *size);
+void *map_file(const char *path, size_t block_size, size_t *size, int *fd);
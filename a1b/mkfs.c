@@ -16,14 +16,21 @@
  * CSC369 Assignment 1 - a1fs formatting tool.
  */
 
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/fs.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "a1fs.h"
+#include "csum.h"
 #include "map.h"
 #include "fs_ctx.h"
 #include "util.h"
@@ -33,12 +40,41 @@ unsigned char* inode_bits;
 unsigned char* block_bits;
 struct a1fs_inode* itable;
 
+/** By default, one metadata journal block per this many blocks of the image. */
+#define DEFAULT_JOURNAL_RATIO 64
+
+/** Largest default journal in blocks. */
+#define MAX_DEFAULT_JOURNAL_BLOCKS 8192
+
+/** The default journal fits at least this many of the largest operations. */
+#define MIN_DEFAULT_JOURNAL_OPS 8
+
+/** Images whose default journal would take more than 1/this of them get none. */
+#define MAX_DEFAULT_JOURNAL_SHARE 8
+
+/** Default number of bytes of the image per inode. */
+#define DEFAULT_INODE_RATIO 16384
+
+/** Default number of data blocks per allocation group. */
+#define DEFAULT_GROUP_BLOCKS 32768
+
+/** Largest reserved blocks percentage. */
+#define MAX_RESERVED_PERCENT 50
+
 /** Command line options. */
 typedef struct mkfs_opts {
 	/** File system image file path. */
 	const char *img_path;
-	/** Number of inodes. */
+	/** Number of inodes; 0 to derive it from inode_ratio. */
 	size_t n_inodes;
+	/** Bytes of the image per inode. */
+	size_t inode_ratio;
+	/** Data blocks per allocation group; 0 for the default. */
+	size_t group_blocks;
+	/** Percentage of the data blocks reserved for directories. */
+	long reserved_percent;
+	/** Number of metadata journal blocks; 0 for no journal, -1 for the default. */
+	long journal_blocks;
 
 	/** Print help and exit. */
 	bool help;
@@ -53,27 +89,47 @@ static const char *help_str = "\
 Usage: %s options image\n\
 \n\
 Format the image file into a1fs file system. The file must exist and\n\
-its size must be a multiple of a1fs block size - %zu bytes.\n\
+its size must be a multiple of a1fs block size - %zu bytes. The image\n\
+can also be a block device, e.g. a partition or a loop device.\n\
 \n\
 Options:\n\
-    -i num  number of inodes; required argument\n\
+    -i num  number of inodes (default: one per -I bytes of the image),\n\
+            rounded up to a multiple of %zu in each allocation group\n\
+    -I num  bytes of the image per inode (default: %d)\n\
+    -g num  data blocks per allocation group, a multiple of %d\n\
+            (default: %d, or larger to keep within %d groups)\n\
+    -m num  percentage of data blocks reserved for directories (default: 0)\n\
+    -j num  number of metadata journal blocks, 0 for none; it must fit the\n\
+            largest operation, which takes a few blocks and one per %zu\n\
+            blocks of the image (default: 1/%d of the image, at most %d,\n\
+            none if the image is too small)\n\
     -h      print help and exit\n\
     -f      force format - overwrite existing a1fs file system\n\
-    -z      zero out image contents\n\
+    -z      zero out image contents, by releasing the space if possible\n\
 ";
 
 static void print_help(FILE *f, const char *progname)
 {
-	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE);
+	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE, A1FS_BLOCK_SIZE / sizeof(a1fs_inode),
+	        DEFAULT_INODE_RATIO, A1FS_FSC_CHUNK,
+	        DEFAULT_GROUP_BLOCKS, A1FS_MAX_GROUPS, (size_t)A1FS_BLOCK_SIZE * 8,
+	        DEFAULT_JOURNAL_RATIO, MAX_DEFAULT_JOURNAL_BLOCKS);
 }
 
 
 static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 {
+	opts->journal_blocks = -1;
+	opts->inode_ratio = DEFAULT_INODE_RATIO;
+
 	char o;
-	while ((o = getopt(argc, argv, "i:hfvz")) != -1) {
+	while ((o = getopt(argc, argv, "i:I:g:m:j:hfvz")) != -1) {
 		switch (o) {
 			case 'i': opts->n_inodes = strtoul(optarg, NULL, 10); break;
+			case 'I': opts->inode_ratio = strtoul(optarg, NULL, 10); break;
+			case 'g': opts->group_blocks = strtoul(optarg, NULL, 10); break;
+			case 'm': opts->reserved_percent = strtol(optarg, NULL, 10); break;
+			case 'j': opts->journal_blocks = strtol(optarg, NULL, 10); break;
 
 			case 'h': opts->help  = true; return true;// skip other arguments
 			case 'f': opts->force = true; break;
@@ -90,8 +146,21 @@ static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 	}
 	opts->img_path = argv[optind];
 
-	if (opts->n_inodes == 0) {
-		fprintf(stderr, "Missing or invalid number of inodes\n");
+	if ((opts->n_inodes > INT32_MAX) || (opts->inode_ratio < sizeof(a1fs_inode))) {
+		fprintf(stderr, "Invalid number of inodes or inode ratio\n");
+		return false;
+	}
+	if ((opts->group_blocks % A1FS_FSC_CHUNK != 0) || (opts->group_blocks > INT32_MAX)) {
+		fprintf(stderr, "Invalid group size; must be a multiple of %d blocks\n", A1FS_FSC_CHUNK);
+		return false;
+	}
+	if ((opts->reserved_percent < 0) || (opts->reserved_percent > MAX_RESERVED_PERCENT)) {
+		fprintf(stderr, "Invalid reserved blocks percentage; must be 0 to %d\n",
+		        MAX_RESERVED_PERCENT);
+		return false;
+	}
+	if ((opts->journal_blocks < -1) || (opts->journal_blocks > INT32_MAX)) {
+		fprintf(stderr, "Invalid journal size\n");
 		return false;
 	}
 	return true;
@@ -109,6 +178,34 @@ static bool a1fs_is_present(void *image)
 	return false;
 }
 
+/**
+ * Make the whole image read as zeros, preferably without writing it. Punching
+ * a hole releases the space of a file, and lets a block device that supports
+ * it unmap its blocks. Failing that, a regular file is truncated and extended
+ * again, and a block device is zeroed with BLKZEROOUT, which at least lets the
+ * device do it without the data passing through memory.
+ *
+ * @param fd    open file descriptor of the image.
+ * @param size  image size in bytes.
+ * @return      true if the image was zeroed; false if it has to be written.
+ */
+static bool zero_image(int fd, size_t size)
+{
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, size) == 0) {
+		return true;
+	}
+
+	struct stat s;
+	if (fstat(fd, &s) < 0) {
+		return false;
+	}
+	if (S_ISREG(s.st_mode)) {
+		return (ftruncate(fd, 0) == 0) && (ftruncate(fd, size) == 0);
+	}
+	uint64_t range[2] = { 0, size };
+	return S_ISBLK(s.st_mode) && (ioctl(fd, BLKZEROOUT, range) == 0);
+}
+
 
 /**
  * Format the image into a1fs.
@@ -129,99 +226,169 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 		return false;
 	}
 
-	int blocks_remaining = size / A1FS_BLOCK_SIZE;
-	int num_ibm_blocks;
-	int num_iblocks;
-	int num_dbm_blocks;
-	bool num_dblocks_optimized = false;
-
-	int root_inode_index;
-
-	// Decrement blocks remaining and check space
-	blocks_remaining -= 1;
-	if (blocks_remaining <= 0) {
-		fprintf(stderr, "mkfs: insufficient blocks to initialize superblock\n");
+	const size_t bits_per_block = A1FS_BLOCK_SIZE * 8;
+	const size_t per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_inode);
+	size_t total_blocks = size / A1FS_BLOCK_SIZE;
+	if (total_blocks > INT32_MAX) {
+		fprintf(stderr, "mkfs: the image is too large\n");
 		return false;
 	}
 
-	// Initialize the superblock and its inode metadata
-	sb = (a1fs_superblock *)(image);
-	sb->sb_free_inodes_count = opts->n_inodes;
-	sb->sb_inodes_count = opts->n_inodes;
+	int root_inode_index;
 
-	// Calculate number of inode bitmap blocks
-	num_ibm_blocks = opts->n_inodes / (A1FS_BLOCK_SIZE * 8) + (opts->n_inodes % (A1FS_BLOCK_SIZE * 8) != 0);
+	// Number of inodes, at least one for the root directory
+	size_t n_inodes = opts->n_inodes ? opts->n_inodes : size / opts->inode_ratio;
+	if (n_inodes == 0) {
+		n_inodes = 1;
+	}
 
-	// Decrement blocks remaining and check space
-	blocks_remaining -= num_ibm_blocks;
-	if (blocks_remaining <= 0) {
-		fprintf(stderr, "mkfs: insufficient blocks to initialize inode bitmap\n");
+	// The journal must fit the largest single operation, which grows with the
+	// block bitmap; the whole image bounds the data region it covers
+	size_t min_journal = A1FS_JOURNAL_MIN_BLOCKS(A1FS_JOURNAL_OP_BLOCKS(total_blocks));
+	size_t journal_blocks = opts->journal_blocks;
+	if (opts->journal_blocks < 0) {
+		// A share of the image, but room for a few operations per transaction
+		journal_blocks = total_blocks / DEFAULT_JOURNAL_RATIO;
+		if (journal_blocks > MAX_DEFAULT_JOURNAL_BLOCKS) {
+			journal_blocks = MAX_DEFAULT_JOURNAL_BLOCKS;
+		}
+		if (journal_blocks < MIN_DEFAULT_JOURNAL_OPS * min_journal) {
+			journal_blocks = MIN_DEFAULT_JOURNAL_OPS * min_journal;
+		}
+		if (journal_blocks > total_blocks / MAX_DEFAULT_JOURNAL_SHARE) {
+			journal_blocks = 0;
+		}
+	} else if ((journal_blocks != 0) && (journal_blocks < min_journal)) {
+		fprintf(stderr, "mkfs: the journal must be 0 or at least %zu blocks for this image\n",
+		        min_journal);
 		return false;
 	}
 
-	// Initialize inode bitmap block(s)
-	sb->sb_inode_bitmap = 1;
-	inode_bits = (unsigned char *)(image + A1FS_BLOCK_SIZE * sb->sb_inode_bitmap);
-
-
-
-	// Calculate number of inode blocks
-	num_iblocks = opts->n_inodes / sizeof(struct a1fs_inode) + (opts->n_inodes % sizeof(struct a1fs_inode) != 0);
-
-	// Decrement blocks remaining and check space
-	blocks_remaining -= num_iblocks;
-	if (blocks_remaining <= 0) {
-		fprintf(stderr, "mkfs: insufficient blocks to initialize inode table\n");
-		return false;
+	// Group size; by default, large enough that the groups fit in the superblock
+	size_t group_blocks = opts->group_blocks;
+	if (group_blocks == 0) {
+		group_blocks = DEFAULT_GROUP_BLOCKS;
+		while (group_blocks * A1FS_MAX_GROUPS < total_blocks) {
+			group_blocks *= 2;
+		}
 	}
 
+	// Free-space cache: a header and a count per chunk of data blocks, sized
+	// for the whole image since the data region is not known yet
+	size_t fsc_chunks = total_blocks / A1FS_FSC_CHUNK + 1;
+	size_t num_fsc_blocks = (sizeof(a1fs_fsc_header) + fsc_chunks * sizeof(uint32_t) + A1FS_BLOCK_SIZE - 1)
+	                        / A1FS_BLOCK_SIZE;
+
+	// The metadata size depends on the number of groups (through the inodes
+	// per group), and the number of groups on what is left for data. Start
+	// from groups covering the whole image and drop the ones that get no data
+	// blocks until it settles. The last group takes any blocks left over
+	size_t num_groups = (total_blocks + group_blocks - 1) / group_blocks;
+	size_t group_inodes, num_ibm_blocks, num_iblocks, num_dbm_blocks, num_data_blocks;
+	for (;;) {
+		// Each group gets whole inode table blocks
+		group_inodes = align_up((n_inodes + num_groups - 1) / num_groups, per_block);
+		num_ibm_blocks = (num_groups * group_inodes + bits_per_block - 1) / bits_per_block;
+		num_iblocks = num_groups * group_inodes / per_block;
+
+		size_t meta_blocks = 1 + num_ibm_blocks + num_iblocks + journal_blocks + num_fsc_blocks;
+		if (meta_blocks >= total_blocks) {
+			fprintf(stderr, "mkfs: insufficient blocks to initialize the metadata; use fewer inodes or a smaller journal\n");
+			return false;
+		}
 
+		// The smallest data bitmap that covers the blocks left after it
+		size_t blocks_remaining = total_blocks - meta_blocks;
+		num_dbm_blocks = (blocks_remaining + bits_per_block) / (bits_per_block + 1);
+		if (blocks_remaining <= num_dbm_blocks) {
+			fprintf(stderr, "mkfs: insufficient blocks to initialize data bitmap\n");
+			return false;
+		}
+		num_data_blocks = blocks_remaining - num_dbm_blocks;
 
-	// Calculate the optimal number of data bitmap blocks
-	num_dbm_blocks = 1;
-	while (!num_dblocks_optimized) {
-		if (!(num_dbm_blocks >= ((blocks_remaining - num_dbm_blocks) / (A1FS_BLOCK_SIZE * 8)) + ((blocks_remaining - num_dbm_blocks) / (A1FS_BLOCK_SIZE * 8) != 0))) {
-			num_dbm_blocks += 1;
-		} else {
-			num_dblocks_optimized = true;
+		size_t n = (num_data_blocks + group_blocks - 1) / group_blocks;
+		if (n >= num_groups) {
+			break;
 		}
+		num_groups = n;
 	}
-
-	// Decrement blocks remaining and check space
-	blocks_remaining -= num_dbm_blocks;
-	if (blocks_remaining <= 0) {
-		fprintf(stderr, "mkfs: insufficient blocks to initialize data bitmap\n");
+	if (num_groups > A1FS_MAX_GROUPS) {
+		fprintf(stderr, "mkfs: more than %d allocation groups; use a larger group size\n",
+		        A1FS_MAX_GROUPS);
+		return false;
+	}
+	if (num_groups * group_inodes > INT32_MAX) {
+		fprintf(stderr, "mkfs: too many inodes\n");
 		return false;
 	}
 
-	// Initialize data bitmap block(s)
-	sb->sb_block_bitmap = 1 + num_ibm_blocks;
-	block_bits = (unsigned char *)(image + A1FS_BLOCK_SIZE * sb->sb_block_bitmap);
+	// Initialize the superblock and its inode metadata
+	sb = (a1fs_superblock *)(image);
+	memset(sb, 0, A1FS_BLOCK_SIZE);
+	sb->sb_free_inodes_count = num_groups * group_inodes;
+	sb->sb_inodes_count = num_groups * group_inodes;
+	sb->sb_group_blocks = group_blocks;
+	sb->sb_group_inodes = group_inodes;
+	sb->sb_groups_count = num_groups;
+	sb->sb_reserved_blocks = num_data_blocks * opts->reserved_percent / 100;
 
+	// Initialize inode bitmap block(s)
+	sb->sb_inode_bitmap = 1;
+	inode_bits = (unsigned char *)(image + A1FS_BLOCK_SIZE * sb->sb_inode_bitmap);
 
+	// Initialize data bitmap block(s)
+	sb->sb_block_bitmap = sb->sb_inode_bitmap + num_ibm_blocks;
+	block_bits = (unsigned char *)(image + A1FS_BLOCK_SIZE * sb->sb_block_bitmap);
 
 	// Initialize inode table block(s)
-	sb->sb_inode_table = 1 + num_ibm_blocks + num_dbm_blocks;
+	sb->sb_inode_table = sb->sb_block_bitmap + num_dbm_blocks;
 	itable = (a1fs_inode *)(image + A1FS_BLOCK_SIZE * sb->sb_inode_table);
-	
 
-	// Initialize data region
-	sb->sb_first_data_block = 1 + num_ibm_blocks + num_dbm_blocks + num_iblocks;
-
-	// Find first available inode bit in inode bitmap
-	root_inode_index = get_available_bit(sb, inode_bits, 0, -1);
-	if (root_inode_index == -1) {
-		fprintf(stderr, "mkfs: could not find empty inode for root directory\n");
-		return false;
+	// Initialize the journal, between the inode table and the data region. It
+	// is cleared so that nothing left over from an earlier file system can be
+	// mistaken for a transaction
+	size_t journal_start = sb->sb_inode_table + num_iblocks;
+	sb->sb_journal_start = journal_blocks ? journal_start : 0;
+	sb->sb_journal_blocks = journal_blocks;
+	if (journal_blocks != 0) {
+		void *journal = image + journal_start * A1FS_BLOCK_SIZE;
+		memset(journal, 0, journal_blocks * A1FS_BLOCK_SIZE);
+		a1fs_journal_header *hdr = journal;
+		hdr->magic = A1FS_JOURNAL_MAGIC;
+		hdr->clean = 1;
+		hdr->seq = 1;
 	}
 
-	// Set corresponding inode bit in inode bitmap
-	if (set_bits(sb, inode_bits, root_inode_index, 0, -1, 1) < 0) {
-		printf("%d\n", root_inode_index);
-		fprintf(stderr, "mkfs: could not set inode bit for root directory\n");
-		return false;
+	// Initialize the free-space cache after the journal; generation 0 marks it
+	// as not written yet, so the first mount counts the bitmap
+	size_t fsc_start = journal_start + journal_blocks;
+	memset(image + fsc_start * A1FS_BLOCK_SIZE, 0, num_fsc_blocks * A1FS_BLOCK_SIZE);
+	sb->sb_fsc_start = fsc_start;
+	sb->sb_fsc_blocks = num_fsc_blocks;
+	sb->sb_fsc_gen = 0;
+
+	// Initialize data region
+	sb->sb_first_data_block = fsc_start + num_fsc_blocks;
+
+	// Only the bitmaps and the inode table block of the root directory are
+	// written here. The rest of the inode table of each group is initialized
+	// by the file system as inodes are allocated, unless the whole image was
+	// zeroed
+	memset(inode_bits, 0, (size_t)(sb->sb_inode_table - sb->sb_inode_bitmap) * A1FS_BLOCK_SIZE);
+	memset(itable, 0, A1FS_BLOCK_SIZE);
+	for (size_t g = 0; g < num_groups; g++) {
+		sb->sb_groups[g].gd_itable_unused = opts->zero ? 0 : group_inodes / per_block - (g == 0);
 	}
 
+	// The inode bitmap is clear, so the root directory takes the first inode,
+	// in the inode table block written above
+	root_inode_index = 0;
+
+	// Set corresponding inode bit in inode bitmap. set_bits() updates the
+	// counters of a mounted file system, so the count is updated here
+	inode_bits[root_inode_index / 8] |= 1 << (root_inode_index % 8);
+	sb->sb_free_inodes_count -= 1;
+
 	// Create corresponding inode in inode table
 	if (!create_inode(itable, root_inode_index, S_IFDIR | 0777)) {
 		fprintf(stderr, "mkfs: could not create inode for root directory\n");
@@ -243,8 +410,14 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	sb->magic = A1FS_MAGIC;
 	sb->size = size;
 	sb->sb_total_data_blocks = size / A1FS_BLOCK_SIZE - sb->sb_first_data_block;
-	sb->sb_free_blocks_count = blocks_remaining;
+	sb->sb_free_blocks_count = num_data_blocks;
 	sb->sb_used_dirs_count = 1;
+	sb->sb_orphan_head = 0;
+
+	// Checksums go last, once everything they cover is in place
+	itable[root_inode_index].i_checksum = csum_inode(&itable[root_inode_index], root_inode_index);
+	sb->sb_bitmap_checksum = csum_bitmaps(image, sb);
+	sb->sb_checksum = csum_super(sb);
 
 	return true;
 }
@@ -266,7 +439,8 @@ int main(int argc, char *argv[])
 
 	// Map image file into memory
 	size_t size;
-	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
+	int fd;
+	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size, &fd);
 	if (image == NULL) return 1;
 
 	// Check if overwriting existing file system
@@ -276,7 +450,7 @@ int main(int argc, char *argv[])
 		goto end;
 	}
 
-	if (opts.zero) memset(image, 0, size);
+	if (opts.zero && !zero_image(fd, size)) memset(image, 0, size);
 	if (!mkfs(image, size, &opts)) {
 		fprintf(stderr, "Failed to format the image\n");
 		goto end;
@@ -285,5 +459,6 @@ int main(int argc, char *argv[])
 	ret = 0;
 end:
 	munmap(image, size);
+	close(fd);
 	return ret;
 }
@@ -28,9 +28,23 @@
 
 #define A1FS_OPT(t, p) { t, offsetof(a1fs_opts, p), 1 }
 
+// Default kernel cache timeouts in seconds, as in FUSE. A1FS_IOC_COPY_RANGE
+// changes a file without the kernel seeing a write to it, so longer ones are
+// up to the user.
+#define A1FS_DEFAULT_TIMEOUT 1.0
+
 static const struct fuse_opt opt_spec[] = {
 	A1FS_OPT("-h"    , help),
 	A1FS_OPT("--help", help),
+	A1FS_OPT("entry_timeout=%lf", entry_timeout),
+	A1FS_OPT("attr_timeout=%lf" , attr_timeout),
+	A1FS_OPT("keep_cache"       , keep_cache),
+	A1FS_OPT("direct_io_threshold=%lu", direct_io_threshold),
+	A1FS_OPT("prezero"          , prezero),
+	A1FS_OPT("discard"          , discard),
+	A1FS_OPT("backend=%s"       , backend),
+	A1FS_OPT("cache_size=%lu"   , cache_size),
+	A1FS_OPT("mlock_metadata"   , mlock_metadata),
 	FUSE_OPT_END
 };
 
@@ -44,6 +58,25 @@ general options:\n\
     -o opt,[opt...]        mount options\n\
     -h   --help            print help\n\
 \n\
+a1fs options:\n\
+    -o entry_timeout=T     cache names for T seconds (default: 1)\n\
+    -o attr_timeout=T      cache attributes for T seconds (default: 1)\n\
+    -o keep_cache          keep file data cached in the kernel across opens;\n\
+                           data copied with A1FS_IOC_COPY_RANGE may then\n\
+                           read stale\n\
+    -o direct_io_threshold=N\n\
+                           don't cache data of files of N bytes or more in\n\
+                           the kernel (default: 0, cache all files)\n\
+    -o prezero             zero free blocks in the background while idle\n\
+    -o discard             release freed blocks to the host file system\n\
+    -o backend=NAME        file data I/O: mmap (default), pread, direct\n\
+                           (default on block devices) or uring (if\n\
+                           built with URING=1)\n\
+    -o cache_size=N        block cache of the pread backend in MiB\n\
+                           (default: 64)\n\
+    -o mlock_metadata      keep the superblock, bitmaps and inode table\n\
+                           locked in memory\n\
+\n\
 ";
 
 // Callback for fuse_opt_parse()
@@ -62,6 +95,8 @@ static int opt_proc(void *data, const char *arg, int key, struct fuse_args *out)
 
 bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
 {
+	opts->entry_timeout = A1FS_DEFAULT_TIMEOUT;
+	opts->attr_timeout  = A1FS_DEFAULT_TIMEOUT;
 	if (fuse_opt_parse(args, opts, opt_spec, opt_proc) != 0) return false;
 
 	//NOTE: printing to stderr to keep it consistent with FUSE
@@ -76,11 +111,20 @@ bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
 
 	// Only single-threaded mount is supported
 	fuse_opt_add_arg(args, "-s");
-	// Limit the size of reads and writes to 4K
+	// Pass the cache timeouts on to FUSE
+	char timeouts[128];
+	snprintf(timeouts, sizeof(timeouts), "entry_timeout=%g,attr_timeout=%g",
+	         opts->entry_timeout, opts->attr_timeout);
+	fuse_opt_add_arg(args, "-o");
+	fuse_opt_add_arg(args, timeouts);
+	// Reads and writes are mapped onto all the extents they cover, so allow
+	// large ones
+	fuse_opt_add_arg(args, "-o");
+	fuse_opt_add_arg(args, "max_read=1048576");
 	fuse_opt_add_arg(args, "-o");
-	fuse_opt_add_arg(args, "max_read=4096");
+	fuse_opt_add_arg(args, "big_writes");
 	fuse_opt_add_arg(args, "-o");
-	fuse_opt_add_arg(args, "max_write=4096");
+	fuse_opt_add_arg(args, "max_write=1048576");
 
 	return true;
 }
@@ -29,6 +29,24 @@ typedef struct a1fs_opts {
 	const char *img_path;
 	/** Print help and exit. FUSE option. */
 	int help;
+	/** Seconds the kernel may cache names (dentries). */
+	double entry_timeout;
+	/** Seconds the kernel may cache file attributes. */
+	double attr_timeout;
+	/** Keep the kernel page cache of a file across opens. */
+	int keep_cache;
+	/** Bypass the kernel cache for files at least this large; 0 = never. */
+	unsigned long direct_io_threshold;
+	/** Zero free blocks in the background while idle. */
+	int prezero;
+	/** Punch holes in the image for freed blocks. */
+	int discard;
+	/** Storage backend name; NULL for the default. */
+	const char *backend;
+	/** Block cache size of the pread backend in MiB; 0 for the default. */
+	unsigned long cache_size;
+	/** Lock the metadata region of the image in memory. */
+	int mlock_metadata;
 
 } a1fs_opts;
 
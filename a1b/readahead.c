@@ -0,0 +1,64 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Extent-aware readahead.
+ */
+
+#include "a1fs_helper.h"
+#include "backend.h"
+#include "readahead.h"
+
+
+void readahead_note(fs_ctx *fs, a1fs_ra_state *ra, const a1fs_inode *inode,
+                    off_t offset, size_t size)
+{
+	if (ra == NULL) return;
+
+	off_t end = offset + size;
+	// A read from the start of the file also counts as sequential
+	bool sequential = (offset == ra->next);
+	ra->next = end;
+
+	if (!sequential) {
+		// Random access; start over, without prefetching
+		ra->window = 0;
+		ra->ahead_end = 0;
+		return;
+	}
+	// Still far enough from the end of the previous prefetch
+	if ((ra->window != 0) && (ra->ahead_end - end >= (off_t)ra->window / 2)) {
+		return;
+	}
+
+	// The previous window was consumed; the next one is twice as large
+	ra->window = (ra->window == 0) ? A1FS_RA_MIN : ra->window * 2;
+	if (ra->window > A1FS_RA_MAX) {
+		ra->window = A1FS_RA_MAX;
+	}
+
+	off_t start = (ra->ahead_end > end) ? ra->ahead_end : end;
+	size_t len = end + ra->window - start;
+
+	// The pieces of the window in logical order, which may be far apart in
+	// the image if the file is fragmented
+	a1fs_seg segs[A1FS_MAX_EXTENTS];
+	int num_segs = map_file_range(fs, inode, start, len, segs);
+	if (num_segs < 0) return;
+
+	for (int i = 0; i < num_segs; i++) {
+		backend_prefetch(fs, segs[i].pos, segs[i].len);
+	}
+	ra->ahead_end = start + len;
+}
@@ -0,0 +1,64 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Extent-aware readahead header file.
+ *
+ * Each open file keeps a readahead state (in fuse_file_info fh). Reads that
+ * continue where the previous one ended are sequential; for those the data
+ * past the read is mapped through the inode's extents, in logical order, and
+ * handed to the backend as a prefetch hint. The next prefetch is issued once
+ * the reader gets within half a window of the end of the previous one, so the
+ * hint is given before the data is needed. The window starts small, doubles
+ * with every prefetch up to a limit, and is reset by a seek.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+
+
+/** Initial readahead window in bytes. */
+#define A1FS_RA_MIN (128 * 1024)
+
+/** Maximum readahead window in bytes. */
+#define A1FS_RA_MAX (8 * 1024 * 1024)
+
+
+/** Readahead state of an open file. */
+typedef struct a1fs_ra_state {
+	/** File offset just past the previous read. */
+	off_t next;
+	/** Current window size in bytes; 0 before the first sequential read. */
+	size_t window;
+	/** File offset just past the data already prefetched. */
+	off_t ahead_end;
+
+} a1fs_ra_state;
+
+
+/**
+ * Record a read and prefetch the data that is likely to be read next.
+ *
+ * @param fs      file system context.
+ * @param ra      readahead state of the open file; NULL to do nothing.
+ * @param inode   consistent copy of the file's inode.
+ * @param offset  offset of the read.
+ * @param size    number of bytes read.
+ */
+void readahead_note(fs_ctx *fs, a1fs_ra_state *ra, const a1fs_inode *inode,
+                    off_t offset, size_t size);
@@ -0,0 +1,217 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Background block reclamation implementation.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "a1fs_helper.h"
+#include "backend.h"
+#include "csum.h"
+#include "discard.h"
+#include "freecache.h"
+#include "journal.h"
+#include "reclaim.h"
+#include "util.h"
+
+
+/**
+ * Free up to <max> blocks from the end of an inode's extent list.
+ *
+ * Each extent is shortened before its blocks are marked free, so a crash in
+ * between leaks blocks instead of leaving them referenced and free.
+ *
+ * @return  number of blocks freed.
+ */
+static int free_tail_blocks(fs_ctx *fs, int ino, int max)
+{
+	a1fs_inode *inode = &fs->itable[ino];
+	int freed = 0;
+
+	while ((freed < max) && (inode->last_used_extent >= 0)) {
+		a1fs_extent *ext = &inode->i_extent[inode->last_used_extent];
+		int n = ext->count;
+		if (n > max - freed) {
+			n = max - freed;
+		}
+
+		inode_write_begin(fs, ino);
+		ext->count -= n;
+		if (ext->count == 0) {
+			inode->last_used_extent -= 1;
+		}
+		inode_write_end(fs, ino);
+
+		set_bits(fs, fs->block_bits, ext->start + ext->count, 1, n, 0);
+		freecache_note(fs, ext->start + ext->count, n, false);
+		backend_drop(fs, ext->start + ext->count, n);
+		journal_note_free(fs, ext->start + ext->count, n);
+		discard_queue(fs, ext->start + ext->count, n);
+		freed += n;
+	}
+	return freed;
+}
+
+/** Reset an inode that has no blocks left and mark it free. */
+static void free_empty_inode(fs_ctx *fs, int ino)
+{
+	inode_write_begin(fs, ino);
+	clock_gettime(CLOCK_REALTIME, &fs->itable[ino].i_mtime);
+	fs->itable[ino].links = 0;
+	fs->itable[ino].size = 0;
+	fs->itable[ino].last_used_extent = -1;
+	fs->itable[ino].last_used_indirect = -1;
+	fs->itable[ino].num_entries = 0;
+	inode_write_end(fs, ino);
+
+	set_bits(fs, fs->inode_bits, ino, 0, -1, 0);
+}
+
+/** Put an inode on the orphan list and wake up the worker. */
+static void orphan_add(fs_ctx *fs, int ino)
+{
+	pthread_mutex_lock(&fs->lock);
+	fs->itable[ino].i_next_orphan = fs->sb->sb_orphan_head;
+	fs->sb->sb_orphan_head = ino;
+	pthread_cond_signal(&fs->reclaim_cond);
+	pthread_mutex_unlock(&fs->lock);
+}
+
+int release_inode(fs_ctx *fs, int ino)
+{
+	if (!check_bit_usage(fs->inode_bits, ino)) {
+		fprintf(stderr, "release_inode: supposedly existing inode does not exist per inode bitmap\n");
+		return -EIO;
+	}
+
+	// The inode is unreachable either way, so it can be reset right away
+	inode_write_begin(fs, ino);
+	fs->itable[ino].links = 0;
+	fs->itable[ino].size = 0;
+	fs->itable[ino].num_entries = 0;
+	inode_write_end(fs, ino);
+
+	if (fs->reclaim_running &&
+	    (file_block_count(&fs->itable[ino]) >= A1FS_RECLAIM_MIN_BLOCKS))
+	{
+		orphan_add(fs, ino);
+		return 0;
+	}
+
+	free_tail_blocks(fs, ino, file_block_count(&fs->itable[ino]));
+	free_empty_inode(fs, ino);
+	return 0;
+}
+
+int orphan_extents(fs_ctx *fs, int ino, int first)
+{
+	if (!fs->reclaim_running) {
+		return -1;
+	}
+	int orphan = group_alloc_inode(fs, ino, false);
+	if (orphan < 0) {
+		return -1;
+	}
+	csum_inode_new(fs, orphan);
+	itable_init(fs, orphan);
+
+	// Move the extents over to the new inode
+	a1fs_inode *inode = &fs->itable[ino];
+	inode_write_begin(fs, orphan);
+	create_inode(fs->itable, orphan, S_IFREG);
+	int n = inode->last_used_extent - first + 1;
+	memcpy(fs->itable[orphan].i_extent, &inode->i_extent[first], n * sizeof(a1fs_extent));
+	fs->itable[orphan].last_used_extent = n - 1;
+	inode_write_end(fs, orphan);
+
+	inode->last_used_extent = first - 1;
+
+	orphan_add(fs, orphan);
+	return 0;
+}
+
+/** Worker thread: free orphans one batch at a time until told to stop. */
+static void *reclaim_worker(void *arg)
+{
+	fs_ctx *fs = (fs_ctx*)arg;
+
+	pthread_mutex_lock(&fs->lock);
+	while (true) {
+		while (!fs->reclaim_stop && (fs->sb->sb_orphan_head == 0)) {
+			pthread_cond_wait(&fs->reclaim_cond, &fs->lock);
+		}
+		if (fs->reclaim_stop) {
+			break;
+		}
+
+		// Each batch is a journal handle. Starting one may wait for a commit,
+		// which must not happen with the lock held; this also lets callbacks
+		// waiting for the lock in
+		pthread_mutex_unlock(&fs->lock);
+		journal_begin(fs);
+		pthread_mutex_lock(&fs->lock);
+
+		// Orphans are taken from the head, newest first: one that is partly
+		// freed waits behind any added meanwhile, still linked in its place
+		// on the list. If one left over from an earlier mount can't be trusted, neither
+		// can the rest of the list it links to; it is dropped, leaking the
+		// blocks rather than freeing someone else's
+		int ino = fs->sb->sb_orphan_head;
+		if ((ino != 0) && !csum_verify_inode(fs, ino)) {
+			fs->sb->sb_orphan_head = 0;
+		} else if ((ino != 0) && (free_tail_blocks(fs, ino, A1FS_RECLAIM_BATCH) < A1FS_RECLAIM_BATCH)) {
+			fs->sb->sb_orphan_head = fs->itable[ino].i_next_orphan;
+			free_empty_inode(fs, ino);
+		}
+
+		pthread_mutex_unlock(&fs->lock);
+		journal_end(fs);
+		pthread_mutex_lock(&fs->lock);
+	}
+	pthread_mutex_unlock(&fs->lock);
+
+	return NULL;
+}
+
+bool reclaim_start(fs_ctx *fs)
+{
+	fs->reclaim_stop = false;
+	int err = pthread_create(&fs->reclaim_thread, NULL, reclaim_worker, fs);
+	if (err != 0) {
+		fprintf(stderr, "reclaim_start: pthread_create: %s\n", strerror(err));
+		return false;
+	}
+	fs->reclaim_running = true;
+	return true;
+}
+
+void reclaim_stop(fs_ctx *fs)
+{
+	if (!fs->reclaim_running) {
+		return;
+	}
+
+	pthread_mutex_lock(&fs->lock);
+	fs->reclaim_stop = true;
+	pthread_cond_signal(&fs->reclaim_cond);
+	pthread_mutex_unlock(&fs->lock);
+
+	pthread_join(fs->reclaim_thread, NULL);
+	fs->reclaim_running = false;
+}
@@ -0,0 +1,75 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Background block reclamation header file.
+ *
+ * Inodes whose blocks are too many to free inside a FUSE callback are put on
+ * the orphan list, which is kept in the image (superblock sb_orphan_head,
+ * linked through i_next_orphan), and freed by a worker thread in batches.
+ * Orphans left over from a previous mount are freed once the worker starts.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "fs_ctx.h"
+
+
+/** Inodes with at least this many blocks are freed in the background. */
+#define A1FS_RECLAIM_MIN_BLOCKS 256
+
+/** Maximum number of blocks the worker frees before letting others run. */
+#define A1FS_RECLAIM_BATCH 4096
+
+
+/**
+ * Start the reclamation worker thread.
+ *
+ * @param fs  file system context.
+ * @return    true on success; false on failure.
+ */
+bool reclaim_start(fs_ctx *fs);
+
+/**
+ * Stop the reclamation worker thread. Orphans that were not freed yet stay on
+ * the list in the image.
+ *
+ * @param fs  file system context.
+ */
+void reclaim_stop(fs_ctx *fs);
+
+/**
+ * Free an inode that no directory entry points to any more, along with its
+ * data blocks. Large inodes are put on the orphan list instead.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number to free.
+ * @return     0 on success; -errno on error.
+ */
+int release_inode(fs_ctx *fs, int ino);
+
+/**
+ * Detach the trailing extents of an inode, starting at extent <first>, and
+ * hand them to the worker. Used to shrink large files without freeing the
+ * blocks inline. The caller must hold the inode's write section.
+ *
+ * @param fs     file system context.
+ * @param ino    inode number of the file.
+ * @param first  index of the first extent to detach.
+ * @return       0 on success; -1 if no spare inode is available to hold the
+ *               extents, in which case nothing is changed.
+ */
+int orphan_extents(fs_ctx *fs, int ino, int first);
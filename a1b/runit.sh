@@ -12,7 +12,7 @@ truncate -s 65536 disk
 ./mkfs.a1fs -z -f -i 16 disk
 
 # just in case something is already there...
-fusermount -u /tmp/lamroger
+fusermount -u /tmp/lamroger 2> /dev/null
 
 # launch our file system
 ./a1fs disk /tmp/lamroger
@@ -75,4 +75,4 @@ stat -f .
 ls -la
 
 #read contents of newfile
-cat /tmp/lamroger/newfile
\ No newline at end of file
+cat /tmp/lamroger/newfile
@@ -0,0 +1,97 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Sharded superblock counters implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sbcount.h"
+
+
+__thread unsigned int sbc_shard;
+
+/** Shard for the next thread that asks for one. */
+static unsigned int next_shard;
+
+
+/** The superblock field a counter is folded into. */
+static int64_t *sb_field(fs_ctx *fs, int counter)
+{
+	switch (counter) {
+		case SBC_FREE_BLOCKS: return &fs->sb->sb_free_blocks_count;
+		case SBC_FREE_INODES: return &fs->sb->sb_free_inodes_count;
+		default             : return &fs->sb->sb_used_dirs_count;
+	}
+}
+
+unsigned int sbc_assign(void)
+{
+	// Threads are spread round-robin; the mask in sbc_add() wraps the count
+	sbc_shard = __atomic_add_fetch(&next_shard, 1, __ATOMIC_RELAXED);
+	if (sbc_shard == 0) {
+		sbc_shard = __atomic_add_fetch(&next_shard, 1, __ATOMIC_RELAXED);
+	}
+	return sbc_shard;
+}
+
+bool sbc_init(fs_ctx *fs)
+{
+	// One shard per CPU, rounded up to a power of 2 so that picking one is a
+	// mask rather than a division
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int n = 1;
+	while ((n < ncpus) && (n < A1FS_SBC_MAX_SHARDS)) {
+		n *= 2;
+	}
+
+	fs->sbc = aligned_alloc(sizeof(a1fs_sbc), n * sizeof(a1fs_sbc));
+	if (fs->sbc == NULL) {
+		return false;
+	}
+	memset(fs->sbc, 0, n * sizeof(a1fs_sbc));
+	fs->sbc_mask = n - 1;
+	return true;
+}
+
+void sbc_destroy(fs_ctx *fs)
+{
+	free(fs->sbc);
+	fs->sbc = NULL;
+}
+
+int64_t sbc_read(fs_ctx *fs, int counter)
+{
+	int64_t value = __atomic_load_n(sb_field(fs, counter), __ATOMIC_RELAXED);
+	for (unsigned int s = 0; s <= fs->sbc_mask; s++) {
+		value += __atomic_load_n(&fs->sbc[s].delta[counter], __ATOMIC_RELAXED);
+	}
+	return value;
+}
+
+void sbc_fold(fs_ctx *fs)
+{
+	for (unsigned int s = 0; s <= fs->sbc_mask; s++) {
+		for (int c = 0; c < SBC_NR; c++) {
+			int64_t delta = __atomic_exchange_n(&fs->sbc[s].delta[c], 0, __ATOMIC_RELAXED);
+			if (delta != 0) {
+				__atomic_fetch_add(sb_field(fs, c), delta, __ATOMIC_RELAXED);
+			}
+		}
+	}
+}
@@ -0,0 +1,105 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+
+/**
+ * CSC369 Assignment 1 - Sharded superblock counters header file.
+ *
+ * The free blocks, free inodes and directories counts change on every
+ * allocation. Rather than having every thread update the same superblock cache
+ * line, changes go to one of several shards, each on its own cache line, and
+ * are folded into the superblock by sbc_fold(): by a journal commit (or an
+ * fsync() without a journal), by statfs() and at unmount. In between, the
+ * counters in the superblock lag behind the bitmaps by the changes not folded
+ * yet; sbc_read() adds them in.
+ *
+ * Each thread is given a shard the first time it changes a counter. Shards are
+ * shared once there are more threads than shards, so updates stay atomic.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "fs_ctx.h"
+
+
+/** Maximum number of shards. */
+#define A1FS_SBC_MAX_SHARDS 64
+
+/** Sharded superblock counters. */
+enum {
+	SBC_FREE_BLOCKS = 0,
+	SBC_FREE_INODES,
+	SBC_USED_DIRS,
+	SBC_NR,
+};
+
+/** Changes to the counters not folded into the superblock yet. */
+typedef struct a1fs_sbc {
+	int64_t delta[SBC_NR];
+} __attribute__((aligned(64))) a1fs_sbc;
+
+/** Shard of the calling thread plus 1; 0 until one is assigned. */
+extern __thread unsigned int sbc_shard;
+
+/** Assign a shard to the calling thread; see sbc_add(). */
+unsigned int sbc_assign(void);
+
+/**
+ * Set up the shards. Called from fs_ctx_init().
+ *
+ * @param fs  file system context.
+ * @return    true on success; false if out of memory.
+ */
+bool sbc_init(fs_ctx *fs);
+
+/** Free the shards. The counters must have been folded. */
+void sbc_destroy(fs_ctx *fs);
+
+/**
+ * Change a counter.
+ *
+ * @param fs       file system context.
+ * @param counter  SBC_* counter.
+ * @param delta    amount to add.
+ */
+static inline void sbc_add(fs_ctx *fs, int counter, int64_t delta)
+{
+	unsigned int shard = sbc_shard;
+	if (shard == 0) {
+		shard = sbc_assign();
+	}
+	__atomic_fetch_add(&fs->sbc[(shard - 1) & fs->sbc_mask].delta[counter], delta,
+	                   __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the current value of a counter. Changes made concurrently may or may not
+ * be included.
+ *
+ * @param fs       file system context.
+ * @param counter  SBC_* counter.
+ * @return         counter value.
+ */
+int64_t sbc_read(fs_ctx *fs, int counter);
+
+/**
+ * Fold the changes in the shards into the superblock. With a journal, must be
+ * called inside a handle or by a commit, so that the superblock doesn't change
+ * while a commit takes its checksum.
+ *
+ * @param fs  file system context.
+ */
+void sbc_fold(fs_ctx *fs);
@@ -0,0 +1,253 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Dirty range tracking and fsync.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "csum.h"
+#include "journal.h"
+#include "sbcount.h"
+#include "sync.h"
+
+
+/** Add a range to an inode's dirty ranges, merging it with its neighbours. */
+static void add_range(a1fs_dirty *d, off_t pos, off_t end)
+{
+	for (;;) {
+		// Absorb every range the new one overlaps or touches
+		for (int i = 0; i < d->nranges; ) {
+			off_t r_pos = d->ranges[i].pos;
+			off_t r_end = r_pos + d->ranges[i].len;
+			if ((r_end < pos) || (r_pos > end)) {
+				i++;
+				continue;
+			}
+			if (r_pos < pos) pos = r_pos;
+			if (r_end > end) end = r_end;
+			d->ranges[i] = d->ranges[--d->nranges];
+		}
+		if (d->nranges < A1FS_DIRTY_RANGES) break;
+
+		// No room; grow the new range to reach the closest one
+		int closest = 0;
+		off_t closest_gap = -1;
+		for (int i = 0; i < d->nranges; i++) {
+			off_t r_pos = d->ranges[i].pos;
+			off_t r_end = r_pos + d->ranges[i].len;
+			off_t gap = (r_pos > end) ? r_pos - end : pos - r_end;
+			if ((closest_gap < 0) || (gap < closest_gap)) {
+				closest = i;
+				closest_gap = gap;
+			}
+		}
+		if (d->ranges[closest].pos < pos) {
+			pos = d->ranges[closest].pos;
+		} else {
+			end = d->ranges[closest].pos;
+		}
+	}
+	d->ranges[d->nranges++] = (a1fs_seg){ .pos = pos, .len = end - pos };
+}
+
+void dirty_note(fs_ctx *fs, int ino, const a1fs_seg *segs, int num_segs)
+{
+	pthread_mutex_lock(&fs->sync_lock);
+	for (int i = 0; i < num_segs; i++) {
+		add_range(&fs->dirty[ino], segs[i].pos, segs[i].pos + segs[i].len);
+	}
+	pthread_mutex_unlock(&fs->sync_lock);
+}
+
+void dirty_note_meta(fs_ctx *fs, int ino, bool alloc)
+{
+	pthread_mutex_lock(&fs->sync_lock);
+	fs->dirty[ino].meta = true;
+	fs->dirty[ino].alloc |= alloc;
+	pthread_mutex_unlock(&fs->sync_lock);
+}
+
+
+/** msync(MS_SYNC) a range of the image; 0 on success, -errno on error. */
+static int msync_range(fs_ctx *fs, off_t pos, size_t len)
+{
+	off_t page = sysconf(_SC_PAGESIZE);
+	off_t start = pos - pos % page;
+	if (msync(fs->image + start, len + (pos - start), MS_SYNC) != 0) {
+		return -errno;
+	}
+	return 0;
+}
+
+/**
+ * Write back the changes taken from the queue for one batch: all data first,
+ * then the metadata that refers to it.
+ *
+ * @param fs    file system context.
+ * @param inos  inode numbers in the batch.
+ * @param snap  the changes of each inode to write back.
+ * @param n     number of inodes.
+ * @return      0 on success; -errno on error.
+ */
+static int sync_batch(fs_ctx *fs, const int *inos, const a1fs_dirty *snap, int n)
+{
+	int err = 0;
+
+	// Data cached by the backend itself reaches the image file first
+	if (fs->backend->flush(fs) != 0) {
+		err = -EIO;
+	}
+
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < snap[i].nranges; j++) {
+			int ret = msync_range(fs, snap[i].ranges[j].pos, snap[i].ranges[j].len);
+			if (ret != 0) err = ret;
+		}
+	}
+
+	// With a journal, metadata only reaches the image through a commit
+	if (fs->journal != NULL) {
+		bool meta = false;
+		for (int i = 0; i < n; i++) {
+			meta |= snap[i].meta || snap[i].alloc;
+		}
+		if (meta) {
+			int ret = journal_commit(fs);
+			if (ret != 0) err = ret;
+		}
+		return err;
+	}
+
+	bool alloc = false;
+	for (int i = 0; i < n; i++) {
+		if (snap[i].meta || snap[i].alloc) {
+			csum_update_inode(fs, inos[i]);
+			int ret = msync_range(fs, (char *)&fs->itable[inos[i]] - (char *)fs->image,
+			                      sizeof(a1fs_inode));
+			if (ret != 0) err = ret;
+		}
+		alloc |= snap[i].alloc;
+	}
+
+	// The superblock and both bitmaps sit in front of the inode table
+	if (alloc) {
+		sbc_fold(fs);
+		csum_update_super(fs);
+		int ret = msync_range(fs, 0, (size_t)fs->sb->sb_inode_table * A1FS_BLOCK_SIZE);
+		if (ret != 0) err = ret;
+	}
+	return err;
+}
+
+int sync_inode(fs_ctx *fs, int ino, bool datasync)
+{
+	pthread_mutex_lock(&fs->sync_lock);
+
+	a1fs_dirty *d = &fs->dirty[ino];
+	if (!d->queued) {
+		d->queued = true;
+		fs->sync_queue[fs->sync_nqueued++] = ino;
+	}
+	d->queued_meta |= !datasync;
+
+	// The next batch to start picks this inode up
+	unsigned long batch = fs->sync_started + 1;
+	while (fs->sync_done < batch) {
+		if (fs->sync_active) {
+			pthread_cond_wait(&fs->sync_cond, &fs->sync_lock);
+			continue;
+		}
+
+		// Become the leader: take everything queued so far
+		fs->sync_active = true;
+		fs->sync_started++;
+		int n = fs->sync_nqueued;
+		int *inos = malloc(n * sizeof(int));
+		a1fs_dirty *snap = malloc(n * sizeof(a1fs_dirty));
+		if ((inos == NULL) || (snap == NULL)) {
+			free(inos);
+			free(snap);
+			fs->sync_active = false;
+			fs->sync_started--;
+			pthread_mutex_unlock(&fs->sync_lock);
+			return -ENOMEM;
+		}
+		for (int i = 0; i < n; i++) {
+			a1fs_dirty *q = &fs->dirty[fs->sync_queue[i]];
+			inos[i] = fs->sync_queue[i];
+			snap[i] = *q;
+			// fdatasync() leaves changes that don't affect the data for later
+			snap[i].meta = q->meta && q->queued_meta;
+			q->nranges = 0;
+			q->alloc = false;
+			q->meta &= !q->queued_meta;
+			q->queued = false;
+			q->queued_meta = false;
+		}
+		fs->sync_nqueued = 0;
+		pthread_mutex_unlock(&fs->sync_lock);
+
+		int err = sync_batch(fs, inos, snap, n);
+
+		pthread_mutex_lock(&fs->sync_lock);
+		for (int i = 0; i < n; i++) {
+			a1fs_dirty *q = &fs->dirty[inos[i]];
+			q->sync_err = err;
+			if (err != 0) {
+				// Keep the changes so that the next fsync() tries again
+				for (int j = 0; j < snap[i].nranges; j++) {
+					add_range(q, snap[i].ranges[j].pos,
+					          snap[i].ranges[j].pos + snap[i].ranges[j].len);
+				}
+				q->meta |= snap[i].meta;
+				q->alloc |= snap[i].alloc;
+			}
+		}
+		free(inos);
+		free(snap);
+		fs->sync_done = fs->sync_started;
+		fs->sync_active = false;
+		pthread_cond_broadcast(&fs->sync_cond);
+	}
+
+	int ret = d->sync_err;
+	pthread_mutex_unlock(&fs->sync_lock);
+	return ret;
+}
+
+int flush_inode(fs_ctx *fs, int ino)
+{
+	a1fs_dirty d;
+	pthread_mutex_lock(&fs->sync_lock);
+	d = fs->dirty[ino];
+	pthread_mutex_unlock(&fs->sync_lock);
+
+	if (fs->backend->flush(fs) != 0) {
+		return -EIO;
+	}
+	// Nothing becomes durable, so the ranges stay dirty for fsync()
+	for (int i = 0; i < d.nranges; i++) {
+		sync_file_range(fs->fd, d.ranges[i].pos, d.ranges[i].len, SYNC_FILE_RANGE_WRITE);
+	}
+	return 0;
+}
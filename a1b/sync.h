@@ -0,0 +1,103 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Dirty range tracking and fsync header file.
+ *
+ * Every change to file data records the image ranges it touched in the
+ * inode's dirty state (fs->dirty), and every change to the inode records
+ * whether its block allocation changed. fsync() then only writes back those
+ * ranges with msync(MS_SYNC), followed by the metadata the inode touched: its
+ * block of the inode table, and the superblock and bitmaps if blocks were
+ * allocated or freed. fdatasync() skips the metadata unless the allocation
+ * changed. With a metadata journal, the metadata is committed through the
+ * journal instead (see journal.h).
+ *
+ * Concurrent fsync() calls are merged: inodes to sync are queued, and one
+ * caller at a time (the leader) writes back everything queued so far while
+ * later callers queue up for the next batch.
+ *
+ * The dirty state and the queue are protected by fs->sync_lock.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "a1fs_helper.h"
+#include "fs_ctx.h"
+
+
+/** Maximum number of separate dirty ranges per inode; more are merged. */
+#define A1FS_DIRTY_RANGES 8
+
+
+/** Unsynced changes of an inode. */
+typedef struct a1fs_dirty {
+	/** Dirty data ranges of the image, sorted and not touching. */
+	a1fs_seg ranges[A1FS_DIRTY_RANGES];
+	/** Number of entries in ranges. */
+	int nranges;
+	/** The inode itself changed (e.g. its times). */
+	bool meta;
+	/** The inode's blocks changed (size, extents, bitmaps). */
+	bool alloc;
+
+	/** The inode is in fs->sync_queue. */
+	bool queued;
+	/** A queued fsync wants the metadata too. */
+	bool queued_meta;
+	/** Result of the last batch that synced the inode. */
+	int sync_err;
+
+} a1fs_dirty;
+
+
+/**
+ * Record that file data was written.
+ *
+ * @param fs        file system context.
+ * @param ino       inode number.
+ * @param segs      image ranges that were written.
+ * @param num_segs  number of ranges.
+ */
+void dirty_note(fs_ctx *fs, int ino, const a1fs_seg *segs, int num_segs);
+
+/**
+ * Record that an inode changed.
+ *
+ * @param fs     file system context.
+ * @param ino    inode number.
+ * @param alloc  blocks were allocated or freed, or the size changed.
+ */
+void dirty_note_meta(fs_ctx *fs, int ino, bool alloc);
+
+/**
+ * Make the changes to an inode durable; fsync() and fdatasync().
+ *
+ * @param fs        file system context.
+ * @param ino       inode number.
+ * @param datasync  only the data and what is needed to read it back.
+ * @return          0 on success; -errno on error.
+ */
+int sync_inode(fs_ctx *fs, int ino, bool datasync);
+
+/**
+ * Start writing back the dirty data of an inode without waiting for it.
+ *
+ * @param fs   file system context.
+ * @param ino  inode number.
+ * @return     0 on success; -errno on error.
+ */
+int flush_inode(fs_ctx *fs, int ino);
@@ -0,0 +1,423 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - io_uring backend.
+ *
+ * All pieces of a file range are queued on an io_uring and submitted with a
+ * single system call, so the extents of a fragmented file are read or written
+ * concurrently instead of one after another. The image file descriptor is
+ * registered with the ring, and so is a pool of buffers, one per submission
+ * queue entry, that the data is staged through; this saves the kernel from
+ * looking up the file and pinning user memory on every request. Pieces larger
+ * than a buffer are split.
+ *
+ * After a failed io_uring_enter(), the requests already submitted are waited
+ * for, since their completions and buffers would otherwise be mistaken for the
+ * next batch's. If even waiting fails, the ring is given up on and the rest of
+ * the I/O goes through plain pread() and pwrite().
+ *
+ * Built only with "make URING=1", since it needs kernel headers with io_uring
+ * support. The ring is driven with the raw system calls, without liburing.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+
+/** Number of submission queue entries, and of registered buffers. */
+#define URING_DEPTH 32
+
+/** Size of each registered buffer; the largest single request. */
+#define URING_BUF_SIZE (128 * 1024)
+
+
+/** Ring state. */
+typedef struct uring_ctx {
+	/** io_uring file descriptor. */
+	int ring_fd;
+	/** Serializes use of the ring. */
+	pthread_mutex_t lock;
+	/** Requests may still be in flight after an error; the ring is not used. */
+	bool broken;
+
+	/** Submission queue ring mapping. */
+	void *sq_ptr;
+	size_t sq_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	/** Submission queue entries mapping. */
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	/** Completion queue ring mapping; same as sq_ptr with a single mmap. */
+	void *cq_ptr;
+	size_t cq_size;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/** Registered buffers, URING_BUF_SIZE bytes each. */
+	unsigned char *bufs;
+
+} uring_ctx;
+
+/** A request in flight, using the buffer with the same index. */
+typedef struct uring_op {
+	/** Caller's memory to copy the data from or to. */
+	void *user;
+	/** Image position. */
+	off_t pos;
+	/** Number of bytes. */
+	size_t len;
+} uring_op;
+
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static unsigned char *slot_buf(uring_ctx *uc, int slot)
+{
+	return uc->bufs + (size_t)slot * URING_BUF_SIZE;
+}
+
+/** Add a read or write of a buffer to the submission queue. */
+static void queue_op(uring_ctx *uc, int slot, const uring_op *op, bool write)
+{
+	unsigned tail = *uc->sq_tail;
+	unsigned idx = tail & *uc->sq_mask;
+	struct io_uring_sqe *sqe = &uc->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;// index of the image in the registered files
+	sqe->addr = (uintptr_t)slot_buf(uc, slot);
+	sqe->len = op->len;
+	sqe->off = op->pos;
+	sqe->buf_index = slot;
+	sqe->user_data = slot;
+
+	uc->sq_array[idx] = idx;
+	__atomic_store_n(uc->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/** Read or write with plain system calls; 0 on success, -errno on error. */
+static int sync_io(fs_ctx *fs, unsigned char *p, size_t len, off_t pos, bool write)
+{
+	for (size_t done = 0; done < len; ) {
+		ssize_t r = write ? pwrite(fs->fd, p + done, len - done, pos + done)
+		                  : pread(fs->fd, p + done, len - done, pos + done);
+		if (r < 0) {
+			if (errno != EINTR) return -errno;
+		} else if (r == 0) {
+			return -EIO;
+		} else {
+			done += r;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Submit the queued requests and wait for all of them. Short transfers are
+ * finished synchronously. Leaves the ring empty, even on error.
+ *
+ * @return  0 on success; -errno on error.
+ */
+static int run_batch(fs_ctx *fs, uring_op *ops, int n, bool write)
+{
+	uring_ctx *uc = fs->backend_data;
+	int ret = 0;
+
+	int submitted = 0;
+	while (submitted < n) {
+		int r = sys_enter(uc->ring_fd, n - submitted, 0, 0);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			ret = -errno;
+			fprintf(stderr, "a1fs: io_uring_enter: %s\n", strerror(errno));
+			// Take back what the kernel has not consumed, so that it is not
+			// submitted with the next batch
+			__atomic_store_n(uc->sq_tail, __atomic_load_n(uc->sq_head, __ATOMIC_ACQUIRE),
+			                 __ATOMIC_RELEASE);
+			break;
+		}
+		submitted += r;
+	}
+
+	int reaped = 0;
+	while (reaped < submitted) {
+		unsigned head = *uc->cq_head;
+		if (head == __atomic_load_n(uc->cq_tail, __ATOMIC_ACQUIRE)) {
+			if ((sys_enter(uc->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR)) {
+				int err = errno;
+				fprintf(stderr, "a1fs: io_uring_enter: %s; no longer using the ring\n",
+				        strerror(err));
+				uc->broken = true;
+				return -err;
+			}
+			continue;
+		}
+		struct io_uring_cqe *cqe = &uc->cqes[head & *uc->cq_mask];
+		int slot = cqe->user_data;
+		int res = cqe->res;
+		__atomic_store_n(uc->cq_head, head + 1, __ATOMIC_RELEASE);
+		reaped++;
+
+		if (res < 0) {
+			ret = res;
+			continue;
+		}
+		if (ret == 0) {
+			ret = sync_io(fs, slot_buf(uc, slot) + res, ops[slot].len - res, ops[slot].pos + res,
+			              write);
+		}
+		if ((ret == 0) && !write) {
+			memcpy(ops[slot].user, slot_buf(uc, slot), ops[slot].len);
+		}
+	}
+	return ret;
+}
+
+/** Read or write all pieces of a range, URING_DEPTH requests at a time. */
+static int transfer(fs_ctx *fs, void *buf, const a1fs_seg *segs, int num_segs, bool write)
+{
+	uring_ctx *uc = fs->backend_data;
+	uring_op ops[URING_DEPTH];
+	int n = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&uc->lock);
+	if (uc->broken) {
+		for (int i = 0; (i < num_segs) && (ret == 0); i++) {
+			ret = sync_io(fs, buf, segs[i].len, segs[i].pos, write);
+			buf += segs[i].len;
+		}
+		pthread_mutex_unlock(&uc->lock);
+		return ret;
+	}
+	for (int i = 0; (i < num_segs) && (ret == 0); i++) {
+		for (size_t done = 0; done < segs[i].len; ) {
+			size_t len = segs[i].len - done;
+			if (len > URING_BUF_SIZE) len = URING_BUF_SIZE;
+
+			ops[n] = (uring_op){ .user = buf, .pos = segs[i].pos + done, .len = len };
+			if (write) {
+				memcpy(slot_buf(uc, n), buf, len);
+			}
+			queue_op(uc, n, &ops[n], write);
+			n++;
+			buf += len;
+			done += len;
+
+			if (n == URING_DEPTH) {
+				ret = run_batch(fs, ops, n, write);
+				n = 0;
+				if (ret != 0) break;
+			}
+		}
+	}
+	if ((ret == 0) && (n > 0)) {
+		ret = run_batch(fs, ops, n, write);
+	}
+	pthread_mutex_unlock(&uc->lock);
+	return ret;
+}
+
+static int uring_read_segs(fs_ctx *fs, void *buf, const a1fs_seg *segs, int num_segs)
+{
+	return transfer(fs, buf, segs, num_segs, false);
+}
+
+static int uring_write_segs(fs_ctx *fs, const void *buf, const a1fs_seg *segs, int num_segs)
+{
+	return transfer(fs, (void *)buf, segs, num_segs, true);
+}
+
+static int uring_read(fs_ctx *fs, void *buf, size_t len, off_t pos)
+{
+	a1fs_seg seg = { .pos = pos, .len = len };
+	return transfer(fs, buf, &seg, 1, false);
+}
+
+static int uring_write(fs_ctx *fs, const void *buf, size_t len, off_t pos)
+{
+	a1fs_seg seg = { .pos = pos, .len = len };
+	return transfer(fs, (void *)buf, &seg, 1, true);
+}
+
+static int uring_flush(fs_ctx *fs)
+{
+	(void)fs;// unused
+	// Completed writes are in the page cache, like writes to the mapping
+	return 0;
+}
+
+static void uring_destroy(fs_ctx *fs)
+{
+	uring_ctx *uc = fs->backend_data;
+	if (uc == NULL) return;
+
+	if (uc->sqes != NULL) {
+		munmap(uc->sqes, uc->sqes_size);
+	}
+	if ((uc->cq_ptr != NULL) && (uc->cq_ptr != uc->sq_ptr)) {
+		munmap(uc->cq_ptr, uc->cq_size);
+	}
+	if (uc->sq_ptr != NULL) {
+		munmap(uc->sq_ptr, uc->sq_size);
+	}
+	if (uc->ring_fd >= 0) {
+		close(uc->ring_fd);
+	}
+	free(uc->bufs);
+	pthread_mutex_destroy(&uc->lock);
+	free(uc);
+	fs->backend_data = NULL;
+}
+
+/** Map the rings of a new io_uring instance. */
+static bool map_rings(uring_ctx *uc, const struct io_uring_params *p)
+{
+	uc->sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	uc->cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (uc->cq_size > uc->sq_size) uc->sq_size = uc->cq_size;
+		uc->cq_size = uc->sq_size;
+	}
+
+	uc->sq_ptr = mmap(NULL, uc->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                  uc->ring_fd, IORING_OFF_SQ_RING);
+	if (uc->sq_ptr == MAP_FAILED) {
+		uc->sq_ptr = NULL;
+		return false;
+	}
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		uc->cq_ptr = uc->sq_ptr;
+	} else {
+		uc->cq_ptr = mmap(NULL, uc->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                  uc->ring_fd, IORING_OFF_CQ_RING);
+		if (uc->cq_ptr == MAP_FAILED) {
+			uc->cq_ptr = NULL;
+			return false;
+		}
+	}
+	uc->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	uc->sqes = mmap(NULL, uc->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                uc->ring_fd, IORING_OFF_SQES);
+	if (uc->sqes == MAP_FAILED) {
+		uc->sqes = NULL;
+		return false;
+	}
+
+	uc->sq_head  = uc->sq_ptr + p->sq_off.head;
+	uc->sq_tail  = uc->sq_ptr + p->sq_off.tail;
+	uc->sq_mask  = uc->sq_ptr + p->sq_off.ring_mask;
+	uc->sq_array = uc->sq_ptr + p->sq_off.array;
+	uc->cq_head  = uc->cq_ptr + p->cq_off.head;
+	uc->cq_tail  = uc->cq_ptr + p->cq_off.tail;
+	uc->cq_mask  = uc->cq_ptr + p->cq_off.ring_mask;
+	uc->cqes     = uc->cq_ptr + p->cq_off.cqes;
+	return true;
+}
+
+static bool uring_init(fs_ctx *fs)
+{
+	uring_ctx *uc = calloc(1, sizeof(*uc));
+	if (uc == NULL) {
+		return false;
+	}
+	fs->backend_data = uc;
+	pthread_mutex_init(&uc->lock, NULL);
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	uc->ring_fd = sys_setup(URING_DEPTH, &p);
+	if (uc->ring_fd < 0) {
+		perror("a1fs: io_uring backend: io_uring_setup");
+		uring_destroy(fs);
+		return false;
+	}
+	if (!map_rings(uc, &p)) {
+		perror("a1fs: io_uring backend: mmap");
+		uring_destroy(fs);
+		return false;
+	}
+
+	if (sys_register(uc->ring_fd, IORING_REGISTER_FILES, &fs->fd, 1) < 0) {
+		perror("a1fs: io_uring backend: register files");
+		uring_destroy(fs);
+		return false;
+	}
+
+	uc->bufs = malloc((size_t)URING_DEPTH * URING_BUF_SIZE);
+	if (uc->bufs == NULL) {
+		fprintf(stderr, "a1fs: io_uring backend: cannot allocate buffers\n");
+		uring_destroy(fs);
+		return false;
+	}
+	struct iovec iov[URING_DEPTH];
+	for (int i = 0; i < URING_DEPTH; i++) {
+		iov[i].iov_base = slot_buf(uc, i);
+		iov[i].iov_len = URING_BUF_SIZE;
+	}
+	if (sys_register(uc->ring_fd, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) < 0) {
+		perror("a1fs: io_uring backend: register buffers");
+		uring_destroy(fs);
+		return false;
+	}
+	return true;
+}
+
+const a1fs_backend uring_backend = {
+	.name       = "uring",
+	.zero_copy  = false,
+	.init       = uring_init,
+	.destroy    = uring_destroy,
+	.read       = uring_read,
+	.write      = uring_write,
+	.read_segs  = uring_read_segs,
+	.write_segs = uring_write_segs,
+	.flush      = uring_flush,
+	.prefetch   = backend_fadvise_prefetch,
+	.sync_range = NULL,
+	.drop_range = NULL,
+};
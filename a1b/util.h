@@ -26,6 +26,8 @@
 
 #include "a1fs.h"
 #include "fs_ctx.h"
+#include "group.h"
+#include "sbcount.h"
 
 
 /** Check if x is a power of 2. */
@@ -64,74 +66,15 @@ static inline bool check_bit_usage(unsigned char* bitmap, int index)
 		return false;
 	}
 }
-//CONSIDERATION: do we pass in ** bitmap or just *bitmap?
-/** Return index of the first available bit */
-static inline int get_available_bit(a1fs_superblock *sb, unsigned char *bitmap, int bm_type, int extent_size)
-{
-
-	// Not enough disk space
-	if (sb->sb_free_blocks_count < extent_size) {
-		fprintf(stderr, "util.h: get_available_bit: insufficient disk space\n");
-		return -1;
-	}
-
-	// Find available inode
-	if (bm_type == 0) {
-		// Return -1 if no free inodes
-		if (sb->sb_free_inodes_count == 0) {
-			return -1;
-		}
 
-		// Loop until first available inode is found
-		// and return the corresponding index
-		for (int i = 0; i < sb->sb_inodes_count; i++) {
-			if (!check_bit_usage(bitmap, i)) {
-				return i;
-			}
-		}
-
-
-	// Find available data block
-	} else if (bm_type == 1) {
-		// Calculate the maximum possible index for data
-		int total_blocks = (sb->size)/A1FS_BLOCK_SIZE;
-		int max_index = total_blocks - 1;
-
-		// Eventually becomes the index of the large-enough and first-fit data bit
-		int avail_db_index = sb->sb_first_empty_db;
-
-		// The current data block being observed
-		int i = avail_db_index;
-
-		// The current number of contiguous and free data blocks
-		int count = 0;
-		while ((count != extent_size) && (i < max_index)) {
-
-			// Reset count if bit is occupied and increment count if bit is free
-			if (check_bit_usage(bitmap, i)) {
-				count = 0;
-				i += 1;
-				avail_db_index = i;
-			} else {
-				i += 1;
-				count += 1;
-			}
-		}
-
-		// Check if there is no contiguous space for the full extent size
-		if (i == max_index && extent_size != 1) {
-			return -1;
-		} else {
-			return avail_db_index;
-		}
-	}
-
-
-	return -1;
-}
-
-/** Flip the bits in the bitmap; bm_type 0 for inode bitmap, 1 for data bitmap; flip_type 0 for setting to 0 and 1 for setting to 1 */
-static inline int set_bits(a1fs_superblock *sb, unsigned char *bitmap, int index, int bm_type, int extent_size, int flip_type) {
+/**
+ * Flip the bits in the bitmap; bm_type 0 for inode bitmap, 1 for data bitmap; flip_type 0 for setting to 0 and 1 for setting to 1
+ *
+ * Bits and counters are updated atomically, since the reclamation worker
+ * frees blocks and inodes while FUSE callbacks allocate them. The free counts
+ * go to the sharded counters (see sbcount.h).
+ */
+static inline int set_bits(fs_ctx *fs, unsigned char *bitmap, int index, int bm_type, int extent_size, int flip_type) {
 
 	if (bm_type == 0) {
 		// Get specific byte containing the inode
@@ -141,14 +84,11 @@ static inline int set_bits(a1fs_superblock *sb, unsigned char *bitmap, int index
 		int bit = index % 8;
 
 		// Set corresponding inode bit
-		bitmap[byte] ^= (1 << bit);
+		__atomic_fetch_xor(&bitmap[byte], (unsigned char)(1 << bit), __ATOMIC_RELAXED);
 
 		// Update superblock
-		if (flip_type == 0) {
-			sb->sb_free_inodes_count += 1;
-		} else {
-			sb->sb_free_inodes_count -= 1;
-		}
+		sbc_add(fs, SBC_FREE_INODES, flip_type == 0 ? 1 : -1);
+		group_note_inode(fs, index, flip_type != 0);
 		
 		return 0;
 	} else if (bm_type == 1) {
@@ -160,17 +100,12 @@ static inline int set_bits(a1fs_superblock *sb, unsigned char *bitmap, int index
 			int bit = i % 8;
 
 			// Set corresponding data bit(s)
-			bitmap[byte] ^= (1 << bit);
-
-			// Update superblock
-			if (flip_type == 0) {
-				sb->sb_free_blocks_count += 1;
-			} else {
-				sb->sb_free_blocks_count -= 1;
-			}
-
+			__atomic_fetch_xor(&bitmap[byte], (unsigned char)(1 << bit), __ATOMIC_RELAXED);
 		}
 
+		// Update superblock
+		sbc_add(fs, SBC_FREE_BLOCKS, flip_type == 0 ? extent_size : -extent_size);
+
 		return 0;
 	}
 
@@ -192,3 +127,37 @@ static inline bool create_inode(a1fs_inode* itable, int index, mode_t mode) {
 
 	return true;
 }
+
+/**
+ * Begin an update of inode <ino>. Makes its sequence counter odd so that
+ * concurrent lock-free readers retry. Writers of the same inode must already be
+ * serialized with each other, and calls must not nest.
+ */
+static inline void inode_write_begin(fs_ctx *fs, int ino)
+{
+	__atomic_fetch_add(&fs->ino_seq[ino], 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/** Finish an update of inode <ino> started with inode_write_begin(). */
+static inline void inode_write_end(fs_ctx *fs, int ino)
+{
+	__atomic_fetch_add(&fs->ino_seq[ino], 1, __ATOMIC_RELEASE);
+}
+
+/** Start a lock-free read of inode <ino>; waits out an in-progress update. */
+static inline unsigned int inode_read_begin(fs_ctx *fs, int ino)
+{
+	unsigned int seq;
+	while ((seq = __atomic_load_n(&fs->ino_seq[ino], __ATOMIC_ACQUIRE)) & 1) {
+		// Writer active, spin
+	}
+	return seq;
+}
+
+/** Check if a read started at <seq> raced with a writer and must be redone. */
+static inline bool inode_read_retry(fs_ctx *fs, int ino, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&fs->ino_seq[ino], __ATOMIC_RELAXED) != seq;
+}
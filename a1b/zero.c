@@ -0,0 +1,205 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Background zeroing of free blocks implementation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+#include "zero.h"
+
+
+/** Number of data blocks in the file system. */
+static int num_data_blocks(const fs_ctx *fs)
+{
+	return fs->size / A1FS_BLOCK_SIZE - fs->sb->sb_first_data_block;
+}
+
+/**
+ * Make a run of free data blocks read as zeros.
+ *
+ * Punching a hole in the image is preferred: it does not write anything and
+ * drops the pages from memory, and the host file system hands out zero pages
+ * when the blocks are used again. If the image does not support it, the
+ * blocks are cleared through the mapping.
+ */
+static void zero_run(fs_ctx *fs, int start, int count)
+{
+	off_t off = (off_t)(fs->sb->sb_first_data_block + start) * A1FS_BLOCK_SIZE;
+	size_t len = (size_t)count * A1FS_BLOCK_SIZE;
+
+	if (fallocate(fs->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) != 0) {
+		memset(fs->image + off, 0, len);
+	}
+}
+
+void zero_note_alloc(fs_ctx *fs, int start, int count)
+{
+	clock_gettime(CLOCK_MONOTONIC, &fs->last_alloc);
+	if (fs->zero_bits == NULL) {
+		return;
+	}
+	for (int i = start; i < start + count; i++) {
+		fs->zero_bits[i / 8] &= ~(1 << (i % 8));
+	}
+}
+
+void zero_mark(fs_ctx *fs, int start, int count)
+{
+	if (fs->zero_bits == NULL) {
+		return;
+	}
+	for (int i = start; i < start + count; i++) {
+		fs->zero_bits[i / 8] |= 1 << (i % 8);
+	}
+}
+
+/** Check if nothing was allocated for A1FS_ZERO_IDLE_MS. */
+static bool is_idle(const fs_ctx *fs)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (now.tv_sec - fs->last_alloc.tv_sec) * 1000 +
+	          (now.tv_nsec - fs->last_alloc.tv_nsec) / 1000000;
+	return ms >= A1FS_ZERO_IDLE_MS;
+}
+
+/**
+ * Check if a data block is free and not known to be zero yet. Blocks freed
+ * since the last journal commit are left alone, since replay after a crash
+ * would bring them back.
+ */
+static bool needs_zeroing(const fs_ctx *fs, int block)
+{
+	return !check_bit_usage(fs->block_bits, block) && !zero_known(fs, block) &&
+	       journal_block_free(fs, block);
+}
+
+/**
+ * Zero up to A1FS_ZERO_BATCH free blocks that are not known to be zero,
+ * continuing where the previous batch stopped. The caller holds fs->lock.
+ *
+ * @return  number of blocks zeroed.
+ */
+static int zero_batch(fs_ctx *fs)
+{
+	int nblocks = num_data_blocks(fs);
+	int zeroed = 0;
+	int b = fs->zero_cursor;
+
+	// One pass over the bitmap at most, in allocation order, so the blocks
+	// the allocator will pick next are zeroed first
+	for (int scanned = 0; (scanned < nblocks) && (zeroed < A1FS_ZERO_BATCH); ) {
+		if (b == nblocks) {
+			b = 0;
+		}
+		if (!needs_zeroing(fs, b)) {
+			b++;
+			scanned++;
+			continue;
+		}
+
+		// Zero the whole run of such blocks at once
+		int start = b;
+		while ((b < nblocks) && (scanned < nblocks) &&
+		       (zeroed + (b - start) < A1FS_ZERO_BATCH) && needs_zeroing(fs, b))
+		{
+			b++;
+			scanned++;
+		}
+		zero_run(fs, start, b - start);
+		zero_mark(fs, start, b - start);
+		zeroed += b - start;
+	}
+
+	fs->zero_cursor = (b == nblocks) ? 0 : b;
+	return zeroed;
+}
+
+/** Worker thread: zero free blocks whenever the mount is idle. */
+static void *zero_worker(void *arg)
+{
+	fs_ctx *fs = (fs_ctx*)arg;
+
+	pthread_mutex_lock(&fs->lock);
+	while (!fs->zero_stop) {
+		// Back off while allocations are going on, and once everything free
+		// is zero
+		if (!is_idle(fs) || (zero_batch(fs) == 0)) {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += A1FS_ZERO_IDLE_MS * 1000000L;
+			until.tv_sec += until.tv_nsec / 1000000000L;
+			until.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait(&fs->zero_cond, &fs->lock, &until);
+			continue;
+		}
+
+		// Let callbacks waiting for the lock in
+		pthread_mutex_unlock(&fs->lock);
+		pthread_mutex_lock(&fs->lock);
+	}
+	pthread_mutex_unlock(&fs->lock);
+
+	return NULL;
+}
+
+bool zero_start(fs_ctx *fs)
+{
+	if (!fs->opts->prezero) {
+		return true;
+	}
+
+	fs->zero_bits = calloc(num_data_blocks(fs) / 8 + 1, 1);
+	if (fs->zero_bits == NULL) {
+		fprintf(stderr, "zero_start: out of memory\n");
+		return false;
+	}
+
+	fs->zero_stop = false;
+	int err = pthread_create(&fs->zero_thread, NULL, zero_worker, fs);
+	if (err != 0) {
+		fprintf(stderr, "zero_start: pthread_create: %s\n", strerror(err));
+		free(fs->zero_bits);
+		fs->zero_bits = NULL;
+		return false;
+	}
+	fs->zero_running = true;
+	return true;
+}
+
+void zero_stop(fs_ctx *fs)
+{
+	if (!fs->zero_running) {
+		return;
+	}
+
+	pthread_mutex_lock(&fs->lock);
+	fs->zero_stop = true;
+	pthread_cond_signal(&fs->zero_cond);
+	pthread_mutex_unlock(&fs->lock);
+
+	pthread_join(fs->zero_thread, NULL);
+	fs->zero_running = false;
+	free(fs->zero_bits);
+	fs->zero_bits = NULL;
+}
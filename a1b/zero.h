@@ -0,0 +1,83 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2019 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Background zeroing of free blocks header file.
+ *
+ * While the mount is idle, a worker thread zeroes free data blocks and records
+ * them in the in-memory "known zero" bitmap (fs->zero_bits), so that extending
+ * writes can skip zeroing the blocks they allocate. The bitmap is not stored
+ * in the image; every block is "unknown" after a mount.
+ *
+ * A set bit means the block is free and reads as zeros. The bitmap is only
+ * accessed with fs->lock held, and so is every allocation of data blocks, from
+ * choosing the blocks until they are initialized, so that the worker never
+ * zeroes a block that is being handed out.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "fs_ctx.h"
+#include "util.h"
+
+
+/** Maximum number of blocks zeroed before letting others run. */
+#define A1FS_ZERO_BATCH 256
+
+/** Time without allocations after which the mount is considered idle. */
+#define A1FS_ZERO_IDLE_MS 100
+
+
+/**
+ * Start the zeroing worker thread, if enabled with the prezero mount option.
+ *
+ * @param fs  file system context.
+ * @return    true on success or if disabled; false on failure.
+ */
+bool zero_start(fs_ctx *fs);
+
+/**
+ * Stop the zeroing worker thread.
+ *
+ * @param fs  file system context.
+ */
+void zero_stop(fs_ctx *fs);
+
+/**
+ * Record that data blocks are being allocated: they lose their known-zero
+ * state, and the worker backs off for a while. The caller must hold fs->lock.
+ *
+ * @param fs     file system context.
+ * @param start  first data block.
+ * @param count  number of blocks.
+ */
+void zero_note_alloc(fs_ctx *fs, int start, int count);
+
+/**
+ * Record that free data blocks read as zeros, e.g. after a hole was punched
+ * for them. Does nothing if prezero is off. The caller must hold fs->lock.
+ *
+ * @param fs     file system context.
+ * @param start  first data block.
+ * @param count  number of blocks.
+ */
+void zero_mark(fs_ctx *fs, int start, int count);
+
+/** Check if a data block is known to be zero. The caller must hold fs->lock. */
+static inline bool zero_known(const fs_ctx *fs, int block)
+{
+	return (fs->zero_bits != NULL) && check_bit_usage(fs->zero_bits, block);
+}